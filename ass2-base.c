@@ -13,6 +13,22 @@
 #include "shaders.h"
 #include "sdl-base.h"
 #include "objects.h"
+#include "resources.h"
+#include "bench.h"
+#include "meshfile.h"
+#include "tiles.h"
+#include "scene.h"
+#include "clusters.h"
+#include "lights.h"
+#include "handoff.h"
+#include "latency.h"
+#include "resolution.h"
+#include "overdraw.h"
+#include "megabuffer.h"
+#include "softraster.h"
+#include "impostor.h"
+#include "blocks.h"
+#include "renderqueue.h"
 
 #define CAMERA_VELOCITY 0.005		 /* Units per millisecond */
 #define CAMERA_ANGULAR_VELOCITY 0.05	 /* Degrees per millisecond */
@@ -21,6 +37,13 @@
 
 #define TEXT_HEIGHT 20
 
+#define MESH_DIRECTORY "meshes" /* prebuilt mesh files, see meshfile.h */
+
+#define NORMAL_LENGTH 0.1 /* of the normal overlay's lines */
+
+#define NEAR_PLANE 0.1
+#define FAR_PLANE 100.0
+
 #ifndef min
 #define min(a, b) ((a)>(b)?(b):(a))
 #endif
@@ -41,7 +64,52 @@ static int mouse2_down;		/* Right mouse button Up/Down. Only zoom camera when do
 Object* object = NULL;
 static int tessellation = 2; /* Tessellation level */
 const int min_tess = 2;
-const int max_tess = 10;
+const int max_tess = 14;
+const int max_mesh_tess = 10; /* finer levels are tiled, see tiles.h */
+static TiledSurface* tiled = NULL; /* replaces object above max_mesh_tess */
+
+/* Scene of many small instances, drawn instead of the object when enabled */
+#define SCENE_OBJECTS 10000
+#define SCENE_SPACING 1.0f
+#define SCENE_MESHES 3
+#define SCENE_MEGA_VERTICES (1 << 14) /* room for the meshes, see megabuffer.h */
+#define SCENE_MEGA_INDICES (1 << 15)
+static Scene* scene = NULL;
+static Object* scene_meshes[SCENE_MESHES];
+static MegaBuffer* scene_mega = NULL;
+
+/* Unbatched, the instances are drawn through a sorted queue (see
+ * renderqueue.h) in these passes, with these programs and materials */
+enum {
+  SCENE_PASS_DEPTH, SCENE_PASS_SHADE
+};
+enum {
+  SCENE_FIXED, SCENE_SHADER
+};
+#define SCENE_MATERIALS 4
+static const float scene_materials[SCENE_MATERIALS][4] = {
+	{1.0, 0.0, 0.0, 1.0}, {0.1, 0.6, 1.0, 1.0}, {1.0, 0.8, 0.1, 1.0}, {0.3, 0.9, 0.3, 1.0}
+};
+static RenderQueue* scene_queue = NULL;
+static int scene_program = SCENE_FIXED; /* the queue's current program */
+
+/* Point lights for per pixel shading, on top of GL_LIGHT0 */
+static LightSystem* lights = NULL;
+
+/* CPU renderer, drawn instead of the object when enabled */
+static SoftRaster* soft = NULL;
+
+/* Ray cast torus and sphere, drawn instead of their meshes when enabled */
+static Impostor* impostor = NULL;
+
+/* Offscreen target for dynamic resolution */
+static ResolutionScaler* scaler = NULL;
+
+/* Shaded fragments per pixel, see overdraw.h */
+static OverdrawCounter* overdraw_counter = NULL;
+
+static int window_width = 1;
+static int window_height = 1;
 
 /* Store the state (1 = pressed, 0 = not pressed) of each key  we're interested in. */
 static char key_state[1024];
@@ -49,16 +117,32 @@ static char key_state[1024];
 /* The opengl handle to our shader */
 GLuint shader = 0;
 
+/* Draws batched scene instances, transformed per instance */
+static GLuint scene_shader = 0;
+static GLint scene_transform_attrib = -1;
+
+/* Normal overlay: the object's vertices, expanded to lines by normals.geom.
+ * 0 without EXT_geometry_shader4. */
+static GLuint normals_shader = 0;
+static GLint normals_length_uniform = -1;
+
+/* Frame, light and material data every program reads, see blocks.h */
+static UniformBlocks* blocks = NULL;
+
+/* The rest of the shader's uniforms: set once, or per pass */
 static struct {
-	GLuint object;
-	GLuint lightingModel;
-	GLuint isLocalViewer;
-	GLuint isPerPixelLighting;
-	GLuint time;
+	GLuint lightData;
+	GLuint lightGrid;
+	GLuint lightIndex;
+	GLuint lightGridSize;
+	GLuint lightDepth;
+	GLuint lightDataWidth;
+	GLuint lightIndexSize;
+	GLuint pass;
 } uniform;
 
 /* Store render state variables.  Can be toggled with function keys. */
-static struct {
+typedef struct {
 	int wireframe;
 	int lighting;
 	int shaders;
@@ -70,13 +154,33 @@ static struct {
 	int shading;
 	int perPixel;
 	int animate;
-} renderstate;
+	int meshCache;
+	int scene;
+	int clusterCull;
+	int lights; /* point lights, per pixel shading only */
+	int framesInFlight; /* see latency.h */
+	int dynamicResolution;
+	float frameTarget; /* ms, for dynamicResolution */
+	int depthPrepass;
+	int overdraw; /* visualise and count shaded fragments */
+	int megaBuffer; /* scene drawn as one batch from shared buffers */
+	int software; /* the object drawn by softraster.h */
+	int impostor; /* the torus and sphere ray cast, see impostor.h */
+	int normals; /* overlay, drawn by normals.geom */
+} RenderState;
+
+static RenderState renderstate;
 
 enum Object {
-  TORUS, WAVE, OBJECT_MAX
+  TORUS, SPHERE, WAVE, OBJECT_MAX
+};
+
+/* The shader's passes, see shader.frag */
+enum Pass {
+  PASS_SHADE, PASS_DEPTH, PASS_OVERDRAW
 };
 
-char object_names[3][8] = { "Torus", "Sphere", "Wave" };
+char object_names[OBJECT_MAX][8] = { "Torus", "Sphere", "Wave" };
 
 /* Light and materials */
 static float light0_directional[] = {2.0, 2.0, 2.0, 0.0};
@@ -89,57 +193,1282 @@ static float material_diffuse[] = {1.0, 0.0, 0.0, 1.0};
 static float material_specular[] = {1.0, 1.0, 1.0, 1.0};
 static float material_shininess = 64;
 
+/* GL_LIGHT0's defaults, as the light block passes them to the shaders */
+static const float light0_default_ambient[] = {0.0, 0.0, 0.0, 1.0};
+static const float light0_default_diffuse[] = {1.0, 1.0, 1.0, 1.0};
+static const float light0_default_specular[] = {1.0, 1.0, 1.0, 1.0};
+static const float scene_default_ambient[] = {0.2, 0.2, 0.2, 1.0};
+
 //time
 static double time_s;
 
-void update_renderstate()
+/*
+Everything display() needs from the simulation, published by the main
+thread at the end of each update() (see handoff.h). display() only reads its
+own copy, so with --threaded it never sees a half updated frame.
+*/
+typedef struct {
+	float zoom;
+	float heading;
+	float pitch;
+	RenderState renderstate;
+	int tessellation;
+	double time;
+	float shininess;
+	int benchRunning;
+	int benchStep;
+	int benchSteps;
+	ScratchStats scratch; /* the main thread's generator */
+	long sequence;
+	double inputStamp; /* oldest input not yet drawn, or 0 */
+	int countOverdraw; /* without the visualisation, for the benchmark */
+} FrameState;
+
+static TripleBuffer* frames = NULL;
+static FrameState current; /* display()'s copy of the newest frame */
+
+/* Motion-to-photon latency. An input is stamped in event() and published
+ * with every frame until display() has taken one of them. Later input
+ * arriving meanwhile is covered by that frame's (older) stamp. */
+static double input_stamp = 0.0;
+static long input_sequence = 0; /* first frame published with input_stamp */
+static long frame_sequence = 0;
+static long drawn_sequence = 0; /* newest frame display() took, atomic */
+static double drawn_stamp = 0.0; /* display()'s, so a stamp counts once */
+
+/*
+Geometry built on the main thread for display() to upload, posted to the
+uploads mailbox. Only the newest build is uploaded; older ones are freed
+unseen. The clusters are handed to the object with it.
+*/
+typedef enum {
+	GEOMETRY_MESH,  /* mesh: the main thread's scratch memory, or an upload arena */
+	GEOMETRY_FILE,  /* mapped: a mesh cache file */
+	GEOMETRY_TILES  /* func/quads/params: a tiled surface */
+} GeometryKind;
+
+/*
+With --threaded, the next build may reuse the main thread's scratch memory
+before the render thread has uploaded a mesh from it, so the mesh is copied
+into one of two upload arenas: display() uploads from one while the other
+takes the next build. An arena only grows, and is busy from the build it's
+given until that's uploaded or superseded.
+*/
+typedef struct {
+	char* data;
+	size_t capacity;
+	int busy; /* atomic */
+} UploadArena;
+
+static UploadArena upload_arenas[2];
+
+typedef struct {
+	GeometryKind kind;
+	Mesh mesh;
+	UploadArena* arena; /* the mesh's memory, or NULL */
+	MappedMesh mapped;
+	struct ClusterSet* clusters;
+	int software;       /* the software renderer draws it, as when built */
+	ParametricObjFunc func;
+	int quads;
+	int closed;
+	double params[3];
+	int numParams;
+} GeometryUpload;
+
+static Mailbox uploads = { NULL };
+
+/* Benchmark sweep. [b] steps through each model, shader and lighting mode
+ * at every tessellation level, timing BENCH_FRAMES frames per step. */
+#define BENCH_WARMUP_FRAMES 10
+#define BENCH_FRAMES 60
+#define BENCH_MAX_STEPS 512
+
+typedef struct {
+	int object;
+	int shaders;
+	int perPixel;
+	int clusterCull;
+	int lights;
+	int depthPrepass;
+	int framesInFlight;
+	int tessellation;
+	int software;
+	int impostor; /* timed apart, see bench_impostor() */
+} BenchStep;
+
+static struct {
+	int running;
+	BenchStep steps[BENCH_MAX_STEPS];
+	int numSteps;
+	int step;
+	int frame;
+	double lastFrame;
+	long allocations; /* host allocation count when measuring began */
+	BenchTimer timer;
+	FILE* file;
+	FILE* latency; /* histogram of each step */
+	BenchStep saved; /* state to restore when the sweep ends */
+} bench;
+
+/* Sets the fixed function state for a frame, on the thread that draws it */
+void apply_renderstate(const FrameState* frame)
 {
-	if (renderstate.lightModel)
+	const RenderState* renderstate = &frame->renderstate;
+
+	if (renderstate->lightModel)
 		glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, GL_TRUE);
 	else
 		glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, 0.0);
 
-	if (renderstate.lighting)
+	if (renderstate->lighting)
 		glEnable(GL_LIGHTING);
 	else
 		glDisable(GL_LIGHTING);
 
-	if (renderstate.shading)
+	if (renderstate->shading)
 		glShadeModel(GL_SMOOTH);
 	else
 		glShadeModel(GL_FLAT);
 
-	glPolygonMode(GL_FRONT_AND_BACK, renderstate.wireframe ? GL_LINE : GL_FILL);
+	glPolygonMode(GL_FRONT_AND_BACK, renderstate->wireframe ? GL_LINE : GL_FILL);
 
-	glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
+	glMaterialf(GL_FRONT, GL_SHININESS, frame->shininess);
+	setMaterialBlock(blocks, material_ambient, material_diffuse, material_specular,
+			frame->shininess);
 }
 
-void regenerate_geometry()
+/*
+Icosphere subdivisions for a tessellation level: 20 * 4^level triangles
+against the grid's 2 * 4^tess, with well under its vertices. The sphere is
+never tiled, so it stops growing at max_mesh_tess.
+*/
+int sphere_level(int tess)
+{
+	return (tess < max_mesh_tess ? tess : max_mesh_tess) - min_tess;
+}
+
+/* An object as an impostor; 0 if it can't be one (the wave) */
+/*
+The lighting, scene and impostor programs read their state from uniform
+blocks (blocks.glsl), so without ARB_uniform_buffer_object they don't
+compile. Returns non-zero if they can be used, else prints why what needs
+them can't.
+*/
+int programs_supported(const char* what)
+{
+	if (!blocks->supported)
+		printf("%s: not supported without ARB_uniform_buffer_object\n", what);
+	return blocks->supported;
+}
+
+int impostor_shape(int object, ImpostorShape* shape, float* major, float* minor)
+{
+	switch (object) {
+		case TORUS:
+			*shape = IMPOSTOR_TORUS;
+			*major = 1.0f;
+			*minor = 0.5f;
+			return 1;
+		case SPHERE:
+			*shape = IMPOSTOR_SPHERE;
+			*major = 1.0f;
+			*minor = 0.0f;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Generates the current object's surface on the CPU, whatever the path */
+void generate_surface(Mesh* mesh, int tess)
 {
 	int subdivs;
-	subdivs = 1 << (tessellation);
+	subdivs = 1 << (tess);
 
-	/* Free previous object */
-	if (object) freeObject(object);
+	switch (renderstate.object) {
+		case TORUS:
+			generateMesh(mesh, parametricTorus, subdivs + 1, subdivs + 1, 1.0, 0.5);
+			break;
+		case SPHERE:
+			generateIcosphere(mesh, sphere_level(tess), 1.0f);
+			break;
+		default:
+			assert(renderstate.object == WAVE);
+			generateMesh(mesh, parametricWave, subdivs + 1, subdivs + 1, 2.0, 2.0, time_s);
+	}
+}
 
-	//printf("Generating %ix%i... ", subdivs, subdivs);
-	fflush(stdout);
+/*
+Whether the mesh is the surface itself, rather than the grid the shader
+path evaluates it on. The sphere isn't a grid: the shader passes it through
+as it is. The software renderer has no vertex shader.
+*/
+int mesh_is_surface()
+{
+	return !renderstate.shaders || renderstate.software || renderstate.object == SPHERE;
+}
 
-	if (renderstate.shaders) {
-		object = createObject(parametricGrid, subdivs + 1, subdivs + 1);
+/* Generates the current object's mesh into the generator's scratch memory */
+void generate_mesh(Mesh* mesh, int tess)
+{
+	int subdivs;
+	subdivs = 1 << (tess);
+
+	if (!mesh_is_surface())
+		generateMesh(mesh, parametricGrid, subdivs + 1, subdivs + 1);
+	else
+		generate_surface(mesh, tess);
+}
+
+/* Mesh file for the current object, or 0 if it can't be cached (it animates,
+ * or isn't a strip) */
+int mesh_filename(char* filename, size_t size, int tess)
+{
+	if (renderstate.object == SPHERE)
+		return 0;
+	if (!mesh_is_surface())
+		snprintf(filename, size, "%s/grid-%d.mesh", MESH_DIRECTORY, tess);
+	else if (renderstate.object == TORUS)
+		snprintf(filename, size, "%s/torus-%d.mesh", MESH_DIRECTORY, tess);
+	else
+		return 0;
+	return 1;
+}
+
+/* Describes the tiled surface used beyond max_mesh_tess */
+void regenerate_tiles(GeometryUpload* upload)
+{
+	upload->kind = GEOMETRY_TILES;
+	upload->quads = 1 << tessellation;
+	upload->closed = renderstate.object == TORUS;
+
+	switch (renderstate.object) {
+		case TORUS:
+			upload->func = parametricTorus;
+			upload->params[0] = 1.0;
+			upload->params[1] = 0.5;
+			upload->numParams = 2;
+			break;
+		default:
+			assert(renderstate.object == WAVE);
+			upload->func = parametricWave;
+			upload->params[0] = 2.0;
+			upload->params[1] = 2.0;
+			upload->params[2] = time_s;
+			upload->numParams = 3;
+	}
+}
+
+/* Vertices submitted for the current geometry */
+int geometry_vertices()
+{
+	if (tiled)
+		return tiled->stats.drawnVertices;
+	return object ? object->numVertices : 0;
+}
+
+/* Strip triangles submitted for the current geometry, degenerates included */
+int geometry_triangles()
+{
+	if (!object && !tiled)
+		return 0;
+	if (tiled)
+		return tiled->stats.drawnTriangles;
+	if (object->clusters)
+		return object->clusters->stats.triangles;
+	if (object->primitive == GL_TRIANGLES)
+		return object->numElements / 3;
+	return object->numElements - 2;
+}
+
+/*
+Clusters for the object when culling them is enabled, or NULL. Only the
+torus is closed. The shader path's buffers hold a grid, so the bounds come
+from the torus mesh file when it's cached, or the torus generated on the
+CPU (and cached for next time); the strips match, and mesh is ignored.
+*/
+struct ClusterSet* geometry_clusters(const Mesh* mesh)
+{
+	char filename[256];
+	struct ClusterSet* set;
+	MappedMesh mapped;
+	Mesh surface;
+
+	if (!renderstate.clusterCull || renderstate.object != TORUS)
+		return NULL;
+	if (mesh_is_surface())
+		return buildClusters(mesh);
+
+	/* The shader path's mesh is a grid with the same strip. The clusters
+	 * need the surface's positions, cached as the fixed function path's. */
+	snprintf(filename, sizeof filename, "%s/torus-%d.mesh", MESH_DIRECTORY, tessellation);
+	if (renderstate.meshCache && mapMeshFile(&mapped, filename) == 0) {
+		set = buildClusters(&mapped.mesh);
+		unmapMeshFile(&mapped);
+		return set;
+	}
+	generate_surface(&surface, tessellation);
+	if (renderstate.meshCache && createMeshDirectory(MESH_DIRECTORY) == 0)
+		writeMeshFile(filename, &surface);
+	return buildClusters(&surface);
+}
+
+void free_geometry(GeometryUpload* upload)
+{
+	if (upload->arena)
+		__atomic_store_n(&upload->arena->busy, 0, __ATOMIC_RELEASE);
+	else if (upload->kind == GEOMETRY_FILE)
+		unmapMeshFile(&upload->mapped);
+	if (upload->clusters)
+		freeClusters(upload->clusters);
+	resFree(upload);
+}
+
+/*
+An idle upload arena of at least size bytes, for the main thread. When both
+are busy, display() has one and the other holds a build it hasn't taken yet,
+which is withdrawn: the build being made supersedes it anyway.
+*/
+UploadArena* acquire_upload_arena(size_t size)
+{
+	GeometryUpload* pending;
+	UploadArena* arena = NULL;
+	int i;
+
+	while (!arena) {
+		for (i = 0; i < 2 && !arena; ++i)
+			if (!__atomic_load_n(&upload_arenas[i].busy, __ATOMIC_ACQUIRE))
+				arena = &upload_arenas[i];
+		/* If display() took it first, it's releasing the other: let it run */
+		if (!arena) {
+			if ((pending = (GeometryUpload*)mailboxTake(&uploads)))
+				free_geometry(pending);
+			else
+				SDL_Delay(1);
+		}
+	}
+	arena->busy = 1;
+	if (size > arena->capacity) {
+		resFree(arena->data);
+		arena->data = (char*)resMalloc(size, RES_ORIGIN);
+		arena->capacity = size;
+	}
+	return arena;
+}
+
+/* Moves upload's mesh out of the scratch memory into an upload arena */
+void copy_to_arena(GeometryUpload* upload)
+{
+	size_t vertexBytes = sizeof(vertex_t) * upload->mesh.numVertices;
+	size_t indexBytes = sizeof(unsigned int) * upload->mesh.numIndices;
+	UploadArena* arena = acquire_upload_arena(vertexBytes + indexBytes);
+
+	memcpy(arena->data, upload->mesh.vertices, vertexBytes);
+	memcpy(arena->data + vertexBytes, upload->mesh.indices, indexBytes);
+	upload->mesh.vertices = (vertex_t*)arena->data;
+	upload->mesh.indices = (unsigned int*)(arena->data + vertexBytes);
+	upload->arena = arena;
+}
+
+/* Builds the current geometry and posts it for display() to upload */
+void regenerate_geometry()
+{
+	char filename[256];
+	int cached;
+	GeometryUpload* upload;
+
+	upload = (GeometryUpload*)resMalloc(sizeof(GeometryUpload), RES_ORIGIN);
+	upload->arena = NULL;
+	upload->clusters = NULL;
+	upload->software = renderstate.software;
+
+	if (!renderstate.shaders && tessellation > max_mesh_tess && renderstate.object != SPHERE) {
+		regenerate_tiles(upload);
 	} else {
-		switch (renderstate.object) {
-			case TORUS:
-				object = createObject(parametricTorus, subdivs + 1, subdivs + 1, 1.0, 0.5);
+		cached = renderstate.meshCache && mesh_filename(filename, sizeof filename, tessellation);
+		if (cached && mapMeshFile(&upload->mapped, filename) == 0) {
+			upload->kind = GEOMETRY_FILE;
+			upload->clusters = geometry_clusters(&upload->mapped.mesh);
+		} else {
+			/* The grid's clusters may generate the torus into the scratch
+			 * memory too, so they're built before the grid is */
+			if (!mesh_is_surface())
+				upload->clusters = geometry_clusters(NULL);
+			upload->kind = GEOMETRY_MESH;
+			generate_mesh(&upload->mesh, tessellation);
+			if (cached && createMeshDirectory(MESH_DIRECTORY) == 0)
+				writeMeshFile(filename, &upload->mesh);
+			if (mesh_is_surface())
+				upload->clusters = geometry_clusters(&upload->mesh);
+			/* Without a render thread, nothing generates again before
+			 * display() uploads straight from the scratch memory */
+			if (render_threaded())
+				copy_to_arena(upload);
+		}
+	}
+
+	/* A build display() hasn't taken yet is superseded */
+	upload = (GeometryUpload*)mailboxPost(&uploads, upload);
+	if (upload)
+		free_geometry(upload);
+}
+
+/* Uploads the newest posted geometry, on the thread that owns the context */
+void upload_geometry()
+{
+	GeometryUpload* upload = (GeometryUpload*)mailboxTake(&uploads);
+
+	if (!upload)
+		return;
+	if (upload->kind == GEOMETRY_TILES) {
+		if (object) {
+			freeObject(object);
+			object = NULL;
+		}
+		setSoftMesh(soft, NULL);
+		/* Same surface at the same level: only its arguments (time) changed */
+		if (tiled && tiled->func == upload->func && tiled->quads == upload->quads) {
+			setTiledSurfaceParams(tiled, upload->params, upload->numParams);
+		} else {
+			if (tiled)
+				freeTiledSurface(tiled);
+			tiled = createTiledSurface(upload->func, upload->quads, upload->closed,
+					upload->params, upload->numParams);
+		}
+	} else {
+		if (tiled) {
+			freeTiledSurface(tiled);
+			tiled = NULL;
+		}
+		/* The previous object is rebuilt in place rather than freed */
+		object = uploadMesh(object, upload->kind == GEOMETRY_FILE ?
+				&upload->mapped.mesh : &upload->mesh);
+		setObjectClusters(object, upload->clusters);
+		/* Copied only when it will be drawn: [y] regenerates */
+		if (upload->software)
+			setSoftMesh(soft, upload->kind == GEOMETRY_FILE ?
+					&upload->mapped.mesh : &upload->mesh);
+		upload->clusters = NULL;
+	}
+	free_geometry(upload);
+}
+
+/* Hands the simulation state to display(), which may be on another thread */
+void publish_frame()
+{
+	FrameState frame;
+
+	frame.zoom = camera_zoom;
+	frame.heading = camera_heading;
+	frame.pitch = camera_pitch;
+	frame.renderstate = renderstate;
+	frame.tessellation = tessellation;
+	frame.time = time_s;
+	frame.shininess = material_shininess;
+	frame.benchRunning = bench.running;
+	frame.benchStep = bench.step;
+	frame.benchSteps = bench.numSteps;
+	frame.scratch = *objectScratchStats();
+
+	frame.sequence = ++frame_sequence;
+	if (input_sequence && __atomic_load_n(&drawn_sequence, __ATOMIC_ACQUIRE) >= input_sequence) {
+		input_stamp = 0.0;
+		input_sequence = 0;
+	}
+	if (input_stamp != 0.0 && !input_sequence)
+		input_sequence = frame.sequence;
+	frame.inputStamp = input_stamp;
+	frame.countOverdraw = bench.running && bench.frame < BENCH_WARMUP_FRAMES;
+	triplePublish(frames, &frame);
+}
+
+/* Input that changes what is drawn has arrived */
+void stamp_input()
+{
+	if (input_stamp == 0.0)
+		input_stamp = benchNow();
+}
+
+/* Scatters the point lights around the object, orbiting with time */
+void place_lights()
+{
+	unsigned int seed = 1; /* the same lights every run */
+	int i, c;
+
+	lights->numLights = current.renderstate.lights;
+	for (i = 0; i < lights->numLights; ++i) {
+		Light* light = &lights->lights[i];
+		float distance, angle, height, speed, brightest = 0.0f;
+
+		/* Small LCG so rand() sequences elsewhere are unaffected */
+#define LIGHT_RANDOM() ((seed = seed * 1103515245u + 12345u) >> 8 & 0xffff) / 65535.0f
+		distance = 0.5f + 1.5f * LIGHT_RANDOM();
+		angle = 6.2832f * LIGHT_RANDOM();
+		height = -0.8f + 1.6f * LIGHT_RANDOM();
+		speed = -0.5f + LIGHT_RANDOM();
+		light->radius = 0.4f + 0.4f * LIGHT_RANDOM();
+		for (c = 0; c < 3; ++c) {
+			light->color[c] = LIGHT_RANDOM();
+			brightest = max(brightest, light->color[c]);
+		}
+#undef LIGHT_RANDOM
+		for (c = 0; c < 3; ++c)
+			light->color[c] *= 0.6f / brightest;
+
+		angle += speed * current.time;
+		light->position.x = distance * cos(angle);
+		light->position.y = distance * sin(angle);
+		light->position.z = height;
+	}
+}
+
+/* Times generating each tessellation level against loading it from a file */
+void bench_geometry()
+{
+	const int repeats = 5;
+	char filename[256];
+	double start, generate_ms, load_ms;
+	Object* temp = NULL;
+	FILE* file;
+	Mesh mesh;
+	int tess, i, cached;
+
+	/* Meshes that can't be cached (the CPU wave, the icosphere) are still
+	 * timed generating, with no load_ms */
+	cached = mesh_filename(filename, sizeof filename, min_tess);
+	if (!cached)
+		printf("bench geometry: %s isn't cached as a mesh file, timing generation only\n",
+				object_names[renderstate.object]);
+	else if (createMeshDirectory(MESH_DIRECTORY) != 0) {
+		printf("bench geometry: can't create %s, timing generation only\n", MESH_DIRECTORY);
+		cached = 0;
+	}
+	file = benchOpen("geometry", "object,shaders,tessellation,vertices,generate_ms,load_ms");
+	if (!file)
+		return;
+
+	for (tess = min_tess; tess <= max_mesh_tess; ++tess)
+	{
+		generate_ms = 0.0;
+		for (i = 0; i < repeats; ++i)
+		{
+			start = benchNow();
+			generate_mesh(&mesh, tess);
+			temp = uploadMesh(temp, &mesh);
+			glFinish();
+			generate_ms += benchNow() - start;
+		}
+		fprintf(file, "%s,%d,%d,%d,%.3f,", object_names[renderstate.object],
+				renderstate.shaders, tess, mesh.numVertices, generate_ms / repeats);
+
+		mesh_filename(filename, sizeof filename, tess);
+		if (cached && writeMeshFile(filename, &mesh) != 0) {
+			printf("bench geometry: can't write %s, timing generation only\n", filename);
+			cached = 0;
+		}
+		if (!cached) {
+			fprintf(file, "\n");
+			continue;
+		}
+
+		load_ms = 0.0;
+		for (i = 0; i < repeats; ++i)
+		{
+			start = benchNow();
+			loadMeshFile(temp, filename);
+			glFinish();
+			load_ms += benchNow() - start;
+		}
+		fprintf(file, "%.3f\n", load_ms / repeats);
+	}
+
+	if (temp)
+		freeObject(temp);
+	fclose(file);
+}
+
+/* Distance from the origin to the closest point of triangle abc (Ericson) */
+double origin_distance(const double* a, const double* b, const double* c)
+{
+	double ab[3], ac[3], p[3];
+	double d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0;
+	double va, vb, vc, v, w;
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		ab[i] = b[i] - a[i];
+		ac[i] = c[i] - a[i];
+		d1 -= ab[i] * a[i]; d2 -= ac[i] * a[i];
+		d3 -= ab[i] * b[i]; d4 -= ac[i] * b[i];
+		d5 -= ab[i] * c[i]; d6 -= ac[i] * c[i];
+	}
+	vc = d1 * d4 - d3 * d2;
+	vb = d5 * d2 - d1 * d6;
+	va = d3 * d6 - d5 * d4;
+	if (d1 <= 0 && d2 <= 0) {
+		v = 0; w = 0;
+	} else if (d3 >= 0 && d4 <= d3) {
+		v = 1; w = 0;
+	} else if (d6 >= 0 && d5 <= d6) {
+		v = 0; w = 1;
+	} else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+		v = d1 / (d1 - d3); w = 0;
+	} else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+		v = 0; w = d2 / (d2 - d6);
+	} else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+		w = (d4 - d3) / ((d4 - d3) + (d5 - d6)); v = 1 - w;
+	} else {
+		v = vb / (va + vb + vc); w = vc / (va + vb + vc);
+	}
+	for (i = 0; i < 3; ++i)
+		p[i] = a[i] + ab[i] * v + ac[i] * w;
+	return sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+}
+
+/*
+Largest distance between a sphere mesh and the true sphere. Every vertex is
+on the sphere, so it is how far inside any triangle reaches. Triangles with
+two corners at the same point add nothing, and are counted instead: in
+joins if they repeat an index (a strip stitching its rows together), else
+in degenerate (distinct vertices collapsed together, eg. at a pole).
+*/
+double sphere_error(const Mesh* mesh, double radius, int* degenerate, int* joins)
+{
+	const int list = mesh->primitive == GL_TRIANGLES;
+	int triangles = list ? mesh->numIndices / 3 : mesh->numIndices - 2;
+	double corners[3][3], error = 0.0, gap;
+	const unsigned int* index;
+	int t, i, j;
+
+	*degenerate = 0;
+	*joins = 0;
+	for (t = 0; t < triangles; ++t) {
+		index = &mesh->indices[list ? t * 3 : t];
+		if (index[0] == index[1] || index[1] == index[2] || index[2] == index[0]) {
+			(*joins)++;
+			continue;
+		}
+		for (i = 0; i < 3; ++i) {
+			const vector_t* p = &mesh->vertices[index[i]].vert;
+			corners[i][0] = p->x;
+			corners[i][1] = p->y;
+			corners[i][2] = p->z;
+		}
+		for (i = 0; i < 3; ++i) {
+			j = (i + 1) % 3;
+			gap = fabs(corners[i][0] - corners[j][0]) + fabs(corners[i][1] - corners[j][1])
+				+ fabs(corners[i][2] - corners[j][2]);
+			if (gap < 1e-5 * radius)
 				break;
-			default:
-				assert(renderstate.object == WAVE);
-				object = createObject(parametricWave, subdivs + 1, subdivs + 1, 2.0, 2.0, time_s);
+		}
+		if (i < 3) {
+			(*degenerate)++;
+			continue;
+		}
+		error = fmax(error, radius - origin_distance(corners[0], corners[1], corners[2]));
+	}
+	return error;
+}
+
+/* Compares the UV and icosphere generators: vertices spent against error */
+void bench_sphere()
+{
+	const int repeats = 5;
+	double start, generate_ms, error;
+	FILE* file;
+	Mesh mesh;
+	int tess, ico, degenerate, joins, i;
+
+	file = benchOpen("sphere",
+			"generator,tessellation,vertices,triangles,degenerate,strip_joins,max_error,generate_ms");
+	if (!file)
+		return;
+
+	for (tess = min_tess; tess <= max_mesh_tess; ++tess)
+		for (ico = 0; ico <= 1; ++ico)
+		{
+			generate_ms = 0.0;
+			for (i = 0; i < repeats; ++i)
+			{
+				start = benchNow();
+				if (ico)
+					generateIcosphere(&mesh, sphere_level(tess), 1.0f);
+				else
+					generateMesh(&mesh, parametricSphere, (1 << tess) + 1, (1 << tess) + 1, 1.0);
+				generate_ms += benchNow() - start;
+			}
+			error = sphere_error(&mesh, 1.0, &degenerate, &joins);
+			fprintf(file, "%s,%d,%d,%d,%d,%d,%.3g,%.3f\n", ico ? "icosphere" : "uv", tess,
+					mesh.numVertices, ico ? mesh.numIndices / 3 : mesh.numIndices - 2,
+					degenerate, joins, error, generate_ms / repeats);
+		}
+	fclose(file);
+}
+
+/*
+Times the shader path's per pixel mesh at each tessellation level against
+the impostor, whose four vertices are the same at every level. The depth
+buffer is cleared before each draw, so neither gains from early depth
+rejection against itself.
+*/
+void bench_impostor()
+{
+	const int repeats = 20;
+	const RenderState saved = renderstate;
+	double start, mesh_ms, impostor_ms;
+	Object* temp = NULL;
+	ImpostorShape shape;
+	FrameBlock frame;
+	float major, minor;
+	FILE* file;
+	Mesh mesh;
+	int tess, i;
+
+	if (!programs_supported("bench impostor"))
+		return;
+	file = benchOpen("impostor", "object,tessellation,vertices,mesh_ms,impostor_ms");
+	if (!file)
+		return;
+
+	glPushMatrix();
+	glLoadIdentity();
+	glTranslatef(0, 0, -camera_zoom);
+	renderstate.shaders = 1;
+	renderstate.software = 0;
+	for (renderstate.object = 0; renderstate.object < OBJECT_MAX; ++renderstate.object)
+	{
+		if (!impostor_shape(renderstate.object, &shape, &major, &minor))
+			continue;
+
+		/* Both are lit per pixel, by the directional light only */
+		frame.object = renderstate.object;
+		frame.lightingModel = renderstate.specularMode;
+		frame.isLocalViewer = renderstate.lightModel;
+		frame.isPerPixelLighting = 1;
+		frame.time = 0;
+		frame.numLights = 0;
+		frame.viewport[0] = window_width;
+		frame.viewport[1] = window_height;
+		setFrameBlock(blocks, &frame);
+
+		glFinish();
+		start = benchNow();
+		for (i = 0; i < repeats; ++i)
+		{
+			glClear(GL_DEPTH_BUFFER_BIT);
+			drawImpostor(impostor, shape, major, minor);
+		}
+		glFinish();
+		impostor_ms = (benchNow() - start) / repeats;
+
+		for (tess = min_tess; tess <= max_mesh_tess; ++tess)
+		{
+			generate_mesh(&mesh, tess);
+			temp = uploadMesh(temp, &mesh);
+
+			glUseProgram(shader);
+			glUniform1i(uniform.pass, PASS_SHADE);
+
+			glFinish();
+			start = benchNow();
+			for (i = 0; i < repeats; ++i)
+			{
+				glClear(GL_DEPTH_BUFFER_BIT);
+				drawObject(temp);
+			}
+			glFinish();
+			mesh_ms = (benchNow() - start) / repeats;
+			glUseProgram(0);
+
+			fprintf(file, "%s,%d,%d,%.4f,%.4f\n", object_names[renderstate.object], tess,
+					temp->numVertices, mesh_ms, impostor_ms);
+		}
+	}
+	renderstate = saved;
+	glPopMatrix();
+
+	if (temp)
+		freeObject(temp);
+	fclose(file);
+}
+
+/* Column major rotation about y, uniform scale, then translation */
+void scene_transform(float* m, float x, float y, float z, float heading, float scale)
+{
+	float c = cos(heading) * scale;
+	float s = sin(heading) * scale;
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = c;      m[2] = -s;
+	m[5] = scale;
+	m[8] = s;      m[10] = c;
+	m[12] = x;     m[13] = y;     m[14] = z;
+	m[15] = 1.0f;
+}
+
+/* Fills the scene with a square grid of count randomly chosen, rotated meshes */
+void build_scene(int count)
+{
+	int side = (int)ceil(sqrt(count));
+	float m[16];
+	Mesh mesh;
+	int i, index;
+
+	/* Drawn either way: per object, or as one batch (see megabuffer.h) */
+	scene_mega = createMegaBuffer(SCENE_MEGA_VERTICES, SCENE_MEGA_INDICES);
+	generateMesh(&mesh, parametricTorus, 9, 9, 0.3, 0.15);
+	scene_meshes[0] = uploadMegaMesh(scene_mega, &mesh);
+	generateMesh(&mesh, parametricSphere, 9, 9, 0.4);
+	scene_meshes[1] = uploadMegaMesh(scene_mega, &mesh);
+	generateMesh(&mesh, parametricWave, 9, 9, 0.8, 0.8, 0.0);
+	scene_meshes[2] = uploadMegaMesh(scene_mega, &mesh);
+	for (i = 0; i < SCENE_MESHES; ++i)
+		assert(scene_meshes[i] && "SCENE_MEGA_VERTICES/INDICES too small");
+
+	srand(1); /* the same scene every run */
+	scene = createScene(count);
+	for (i = 0; i < count; ++i)
+	{
+		scene_transform(m,
+				(i % side - side / 2) * SCENE_SPACING, 0.0f,
+				(i / side - side / 2) * SCENE_SPACING,
+				rand() / (float)RAND_MAX * 6.28f, 0.5f + rand() / (float)RAND_MAX);
+		index = addSceneObject(scene, scene_meshes[rand() % SCENE_MESHES], m);
+		scene->objects[index].material = i % SCENE_MATERIALS;
+	}
+	updateScene(scene);
+	scene_queue = createRenderQueue(count);
+
+	/* Built once: don't keep the render thread's scratch memory around */
+	if (render_threaded())
+		freeObjectScratch();
+}
+
+void free_scene()
+{
+	int i;
+	if (!scene)
+		return;
+	freeScene(scene);
+	scene = NULL;
+	for (i = 0; i < SCENE_MESHES; ++i)
+		freeObject(scene_meshes[i]);
+	freeMegaBuffer(scene_mega);
+	scene_mega = NULL;
+	freeRenderQueue(scene_queue);
+	scene_queue = NULL;
+}
+
+/* The queue's callbacks: each is called only when its key field changes */
+void scene_set_pass(void* data, int pass)
+{
+	if (pass == SCENE_PASS_DEPTH) {
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	} else {
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		if (current.renderstate.depthPrepass) {
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
 		}
 	}
+}
 
-	//printf("done.\n");
-	fflush(stdout);
+void scene_set_program(void* data, int program)
+{
+	scene_program = program;
+	glUseProgram(program == SCENE_SHADER ? scene_shader : 0);
+}
+
+void scene_set_material(void* data, int material)
+{
+	const float* diffuse = scene_materials[material];
+	float ambient[4];
+	int i;
+
+	for (i = 0; i < 3; ++i)
+		ambient[i] = 0.5f * diffuse[i];
+	ambient[3] = 1.0f;
+	glMaterialfv(GL_FRONT, GL_AMBIENT, ambient);
+	glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse);
+	setMaterialBlock(blocks, ambient, diffuse, material_specular, current.shininess);
+}
+
+void scene_set_mesh(void* data, int mesh)
+{
+	bindObject(scene_meshes[mesh]);
+}
+
+void scene_draw(void* data, int index)
+{
+	const SceneObject* obj = &scene->objects[index];
+	int column;
+
+	if (scene_program == SCENE_SHADER) {
+		/* A constant attribute, as drawMegaBatch() does without indirect draws */
+		for (column = 0; column < 4; ++column)
+			glVertexAttrib4fv(scene_transform_attrib + column, obj->transform + column * 4);
+		drawBoundObject(obj->mesh);
+	} else {
+		glPushMatrix();
+		glMultMatrixf(obj->transform);
+		drawBoundObject(obj->mesh);
+		glPopMatrix();
+	}
+}
+
+static const RenderCallbacks scene_callbacks = {
+	scene_set_pass, scene_set_program, scene_set_material, scene_set_mesh, scene_draw
+};
+
+int scene_mesh_index(const Object* mesh)
+{
+	int i;
+	for (i = 0; i < SCENE_MESHES; ++i)
+		if (scene_meshes[i] == mesh)
+			return i;
+	return 0;
+}
+
+/*
+Queues every visible instance, keyed by pass, program, material, mesh and
+distance, then draws them sorted: each state is set once per run of
+instances sharing it, whatever order culling left them in.
+*/
+void draw_scene_queued()
+{
+	const RenderState* renderstate = &current.renderstate;
+	int program = renderstate->shaders ? SCENE_SHADER : SCENE_FIXED;
+	float modelview[16], depth;
+	int i, mesh;
+
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	beginRenderQueue(scene_queue);
+	for (i = 0; i < scene->numVisible; ++i)
+	{
+		const SceneObject* obj = &scene->objects[scene->visible[i]];
+		const float* t = obj->transform;
+
+		/* The instance's origin, from the near plane (0) to the far one (1) */
+		depth = -(modelview[2] * t[12] + modelview[6] * t[13] + modelview[10] * t[14] + modelview[14]);
+		depth = (depth - NEAR_PLANE) / (FAR_PLANE - NEAR_PLANE);
+		mesh = scene_mesh_index(obj->mesh);
+
+		/* Material doesn't matter to the depth pass: leave it 0 to keep runs long */
+		if (renderstate->depthPrepass)
+			submitDraw(scene_queue, renderKey(SCENE_PASS_DEPTH, program, 0, mesh, depth),
+					scene->visible[i]);
+		submitDraw(scene_queue, renderKey(SCENE_PASS_SHADE, program, obj->material, mesh, depth),
+				scene->visible[i]);
+	}
+	sortRenderQueue(scene_queue);
+
+	glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_LIGHTING_BIT);
+	executeRenderQueue(scene_queue, &scene_callbacks, NULL);
+	unbindObject();
+	glPopAttrib();
+
+	/* The shaders' material block back to the object's */
+	setMaterialBlock(blocks, material_ambient, material_diffuse, material_specular,
+			current.shininess);
+}
+
+/* Draws the visible instances, batched or through the render queue */
+void draw_scene(int batched)
+{
+	if (batched) {
+		glUseProgram(scene_shader);
+		drawSceneBatched(scene, scene_mega, scene_transform_attrib);
+	} else {
+		draw_scene_queued();
+	}
+	glUseProgram(0);
+}
+
+/* Every eighth instance bobs up and down, exercising BVH refits */
+void animate_scene()
+{
+	float m[16];
+	int i;
+	for (i = 0; i < scene->numObjects; i += 8)
+	{
+		memcpy(m, scene->objects[i].transform, sizeof m);
+		m[13] = 0.5f * sin(current.time + i);
+		moveSceneObject(scene, i, m);
+	}
+}
+
+/* Times culling, then drawing the scene both ways, from a ring of camera
+ * directions, at each of several instance counts */
+void bench_scene()
+{
+	const int repeats = 20;
+	double cull_ms, submit_ms, draw_ms, start;
+	FILE* file;
+	int count, heading, pitch, batched, calls, i;
+
+	file = benchOpen("scene", "objects,heading,pitch,batched,submitted,culled,nodes_visited,"
+			"draw_calls,cull_ms,submit_ms,draw_ms");
+	if (!file)
+		return;
+
+	/* From a sparse field to a dense one, the grid widening as it grows */
+	for (count = SCENE_OBJECTS / 16; count <= SCENE_OBJECTS * 4; count *= 4)
+	{
+		free_scene();
+		build_scene(count);
+		for (pitch = 0; pitch >= -60; pitch -= 30)
+			for (heading = 0; heading < 360; heading += 45)
+			{
+				Frustum frustum;
+
+				glPushMatrix();
+				glLoadIdentity();
+				glTranslatef(0, 0, -camera_zoom);
+				glRotatef(-pitch, 1, 0, 0);
+				glRotatef(-heading, 0, 1, 0);
+				frustumFromGL(&frustum);
+
+				cull_ms = 0.0;
+				for (i = 0; i < repeats; ++i)
+				{
+					cullScene(scene, &frustum);
+					cull_ms += scene->stats.cullMs;
+				}
+
+				/* Submission is CPU time to issue the draws, drawing waits for them */
+				for (batched = 0; batched <= blocks->supported; ++batched)
+				{
+					glFinish();
+					start = benchNow();
+					draw_scene(batched);
+					submit_ms = benchNow() - start;
+					glFinish();
+					draw_ms = benchNow() - start;
+					calls = batched ? scene_mega->stats.calls : scene_queue->stats.draws;
+
+					fprintf(file, "%d,%d,%d,%d,%d,%d,%d,%d,%.4f,%.4f,%.3f\n", scene->numObjects,
+							heading, pitch, batched, scene->stats.submitted, scene->stats.culled,
+							scene->stats.nodesVisited, calls, cull_ms / repeats, submit_ms, draw_ms);
+				}
+				glPopMatrix();
+			}
+	}
+	/* display() builds the usual scene again when it's next shown */
+	free_scene();
+	fclose(file);
+}
+
+void bench_apply(const BenchStep* step)
+{
+	renderstate.object = step->object;
+	renderstate.shaders = step->shaders;
+	renderstate.perPixel = step->perPixel;
+	renderstate.clusterCull = step->clusterCull;
+	renderstate.lights = step->lights;
+	renderstate.depthPrepass = step->depthPrepass;
+	renderstate.framesInFlight = step->framesInFlight;
+	renderstate.software = step->software;
+	renderstate.impostor = step->impostor;
+	tessellation = step->tessellation;
+	resetOverdrawCounter(overdraw_counter);
+	regenerate_geometry();
+}
+
+void bench_start()
+{
+	int object, shaders, perPixel, prepass, clusterCull, tess, count, inFlight;
+	BenchStep* step;
+
+	bench_geometry();
+	bench_scene();
+	bench_sphere();
+	bench_impostor();
+
+	bench.file = benchOpen("frames",
+			"object,software,shaders,per_pixel,depth_prepass,cluster_cull,lights,frames_in_flight,"
+			"tessellation,vertices,triangles,fragments_per_pixel,bin_ms,"
+			"frame_ms,frame_ms_min,frame_ms_max,"
+			"latency_ms_p50,latency_ms_p95,latency_ms_max,latency_timeouts,"
+			"gpu_bytes,gpu_peak,host_bytes,host_peak,host_allocs");
+	if (!bench.file)
+		return;
+	bench.latency = benchOpen("latency",
+			"object,software,shaders,per_pixel,depth_prepass,cluster_cull,lights,frames_in_flight,"
+			"tessellation,bucket_ms,frames");
+	if (!bench.latency) {
+		fclose(bench.file);
+		return;
+	}
+
+	/* Per pixel lighting only exists in the shader path, where the depth
+	 * pre-pass is measured. Clusters only exist for the torus, and tiles
+	 * replace them beyond max_mesh_tess. The sphere is never tiled. */
+	bench.numSteps = 0;
+	for (object = 0; object < OBJECT_MAX; ++object)
+		for (shaders = 0; shaders <= blocks->supported; ++shaders)
+			for (perPixel = 0; perPixel <= shaders; ++perPixel)
+				for (prepass = 0; prepass <= shaders; ++prepass)
+					for (clusterCull = 0; clusterCull <= (object == TORUS); ++clusterCull)
+						for (tess = min_tess; tess <= (shaders || clusterCull || object == SPHERE ?
+									max_mesh_tess : max_tess); ++tess)
+						{
+							assert(bench.numSteps < BENCH_MAX_STEPS);
+							step = &bench.steps[bench.numSteps++];
+							step->object = object;
+							step->shaders = shaders;
+							step->perPixel = perPixel;
+							step->depthPrepass = prepass;
+							step->clusterCull = clusterCull;
+							step->lights = 0;
+							step->framesInFlight = renderstate.framesInFlight;
+							step->tessellation = tess;
+							step->software = 0;
+							step->impostor = 0;
+						}
+
+	/* The software renderer against the rows above: lit per vertex
+	 * (fixed function) and per pixel (as the shaders) */
+	for (object = 0; object < OBJECT_MAX; ++object)
+		for (shaders = 0; shaders <= 1; ++shaders)
+			for (tess = min_tess; tess <= max_mesh_tess; ++tess)
+			{
+				assert(bench.numSteps < BENCH_MAX_STEPS);
+				step = &bench.steps[bench.numSteps++];
+				step->object = object;
+				step->shaders = shaders;
+				step->perPixel = shaders;
+				step->depthPrepass = 0;
+				step->clusterCull = 0;
+				step->lights = 0;
+				step->framesInFlight = renderstate.framesInFlight;
+				step->tessellation = tess;
+				step->software = 1;
+				step->impostor = 0;
+			}
+
+	/* Frame time against point light count, per pixel on a fixed mesh. This
+	 * and the latency sweep need the shaders. */
+	for (count = 1; blocks->supported && count <= LIGHT_MAX; count *= 2)
+	{
+		assert(bench.numSteps < BENCH_MAX_STEPS);
+		step = &bench.steps[bench.numSteps++];
+		step->object = TORUS;
+		step->shaders = 1;
+		step->perPixel = 1;
+		step->depthPrepass = 0;
+		step->clusterCull = 0;
+		step->lights = count;
+		step->framesInFlight = renderstate.framesInFlight;
+		step->tessellation = 8;
+		step->software = 0;
+		step->impostor = 0;
+	}
+
+	/* Latency against frames in flight, with the GPU kept busy */
+	for (inFlight = 1; blocks->supported && inFlight <= LATENCY_MAX_IN_FLIGHT; ++inFlight)
+	{
+		assert(bench.numSteps < BENCH_MAX_STEPS);
+		step = &bench.steps[bench.numSteps++];
+		step->object = TORUS;
+		step->shaders = 1;
+		step->perPixel = 1;
+		step->depthPrepass = 0;
+		step->clusterCull = 0;
+		step->lights = 256;
+		step->framesInFlight = inFlight;
+		step->tessellation = max_mesh_tess;
+		step->software = 0;
+		step->impostor = 0;
+	}
+
+	bench.saved.object = renderstate.object;
+	bench.saved.shaders = renderstate.shaders;
+	bench.saved.perPixel = renderstate.perPixel;
+	bench.saved.depthPrepass = renderstate.depthPrepass;
+	bench.saved.clusterCull = renderstate.clusterCull;
+	bench.saved.lights = renderstate.lights;
+	bench.saved.framesInFlight = renderstate.framesInFlight;
+	bench.saved.tessellation = tessellation;
+	bench.saved.software = renderstate.software;
+	bench.saved.impostor = renderstate.impostor;
+
+	bench.running = 1;
+	bench.step = 0;
+	bench.frame = 0;
+	benchTimerReset(&bench.timer);
+	bench_apply(&bench.steps[0]);
+	printf("Benchmark started, %d steps\n", bench.numSteps);
+}
+
+void bench_stop()
+{
+	fclose(bench.file);
+	fclose(bench.latency);
+	bench.file = NULL;
+	bench.latency = NULL;
+	bench.running = 0;
+	bench_apply(&bench.saved);
+	printf("Benchmark finished\n");
+}
+
+/* Called once per frame while the sweep runs */
+void bench_frame()
+{
+	ResourceStats mem;
+	const LatencyStats* latency;
+	const BenchStep* step;
+	double now = benchNow();
+	int i;
+
+	/* Every frame counts as input, as if the camera were being dragged */
+	stamp_input();
+
+	/* Skip warmup frames so the first measurement isn't the regeneration */
+	if (bench.frame == BENCH_WARMUP_FRAMES) {
+		bench.allocations = resStats().totalAllocations;
+		latencyReset();
+	}
+	if (bench.frame++ > BENCH_WARMUP_FRAMES)
+		benchTimerAdd(&bench.timer, now - bench.lastFrame);
+	bench.lastFrame = now;
+
+	if (bench.timer.frames < BENCH_FRAMES)
+		return;
+
+	step = &bench.steps[bench.step];
+	mem = resStats();
+	latency = latencyStats();
+	fprintf(bench.file, "%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,",
+			object_names[step->object], step->software, step->shaders, step->perPixel, step->depthPrepass,
+			step->clusterCull, step->lights, step->framesInFlight, step->tessellation,
+			geometry_vertices(), geometry_triangles(), overdrawPerPixel(overdraw_counter),
+			step->lights ? lights->stats.binMs : 0.0,
+			benchTimerMean(&bench.timer), bench.timer.min, bench.timer.max);
+	/* Left empty if no frame finished in time to be sampled */
+	if (latency->samples)
+		fprintf(bench.file, "%.1f,%.1f,%.3f,", latencyPercentile(0.5), latencyPercentile(0.95),
+				latency->max);
+	else
+		fprintf(bench.file, ",,,");
+	fprintf(bench.file, "%ld,%lu,%lu,%lu,%lu,%ld\n", latency->timeouts,
+			(unsigned long)mem.gpuBytes, (unsigned long)mem.gpuPeak,
+			(unsigned long)mem.hostBytes, (unsigned long)mem.hostPeak,
+			mem.totalAllocations - bench.allocations);
+	for (i = 0; i < LATENCY_BUCKETS; ++i)
+		if (latency->counts[i])
+			fprintf(bench.latency, "%s,%d,%d,%d,%d,%d,%d,%d,%d,%.1f,%ld\n",
+					object_names[step->object], step->software, step->shaders, step->perPixel,
+					step->depthPrepass, step->clusterCull, step->lights, step->framesInFlight, step->tessellation,
+					i * LATENCY_BUCKET_MS, latency->counts[i]);
+
+	if (++bench.step == bench.numSteps)
+	{
+		bench_stop();
+		return;
+	}
+	bench.frame = 0;
+	benchTimerReset(&bench.timer);
+	bench_apply(&bench.steps[bench.step]);
 }
 
 void init()
@@ -148,15 +1477,54 @@ void init()
 	char** argv = NULL;
 	glutInit(&argc, argv); /* NOTE: this hack will not work on windows */
 	glewInit();
+	latencyInit(2);
 
 	/* Load the shader */
-	shader = getShader("mesh-generation.vert", "shader.frag");
-
-	uniform.object = glGetUniformLocation(shader, "object");
-	uniform.lightingModel = glGetUniformLocation(shader, "lightingModel");
-	uniform.isLocalViewer = glGetUniformLocation(shader, "isLocalViewer");
-	uniform.isPerPixelLighting = glGetUniformLocation(shader, "isPerPixelLighting");
-	uniform.time = glGetUniformLocation(shader, "time");
+	shader = resTrackProgram(getShader("mesh-generation.vert", "shader.frag"), RES_ORIGIN);
+
+	uniform.lightData = glGetUniformLocation(shader, "lightData");
+	uniform.lightGrid = glGetUniformLocation(shader, "lightGrid");
+	uniform.lightIndex = glGetUniformLocation(shader, "lightIndex");
+	uniform.lightGridSize = glGetUniformLocation(shader, "lightGridSize");
+	uniform.lightDepth = glGetUniformLocation(shader, "lightDepth");
+	uniform.lightDataWidth = glGetUniformLocation(shader, "lightDataWidth");
+	uniform.lightIndexSize = glGetUniformLocation(shader, "lightIndexSize");
+	uniform.pass = glGetUniformLocation(shader, "pass");
+
+	scene_shader = resTrackProgram(getShader("scene.vert", "scene.frag"), RES_ORIGIN);
+	scene_transform_attrib = glGetAttribLocation(scene_shader, "instanceTransform");
+
+	/* Same vertex shader as the object, so generated surfaces match */
+	if (GLEW_EXT_geometry_shader4) {
+		normals_shader = resTrackProgram(getGeometryShader("mesh-generation.vert",
+				"normals.geom", "normals.frag", GL_POINTS, GL_LINE_STRIP, 2), RES_ORIGIN);
+		normals_length_uniform = glGetUniformLocation(normals_shader, "normalLength");
+	} else
+		printf("EXT_geometry_shader4 not supported: no normal overlay\n");
+
+	scaler = createResolutionScaler();
+	overdraw_counter = createOverdrawCounter();
+	impostor = createImpostor();
+
+	/* Every program reads the same blocks */
+	blocks = createUniformBlocks();
+	bindUniformBlocks(blocks, shader);
+	bindUniformBlocks(blocks, scene_shader);
+	bindUniformBlocks(blocks, normals_shader);
+	bindUniformBlocks(blocks, impostor->program);
+
+	/* The light system's layout never changes; textures go in units 0-2 */
+	lights = createLightSystem();
+	soft = createSoftRaster(lights->pool);
+	glUseProgram(shader);
+	glUniform1i(uniform.lightData, 0);
+	glUniform1i(uniform.lightGrid, 1);
+	glUniform1i(uniform.lightIndex, 2);
+	glUniform3f(uniform.lightGridSize, LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z);
+	glUniform2f(uniform.lightDepth, NEAR_PLANE, log(FAR_PLANE / NEAR_PLANE));
+	glUniform1f(uniform.lightDataWidth, LIGHT_MAX);
+	glUniform1f(uniform.lightIndexSize, LIGHT_INDEX_SIZE);
+	glUseProgram(0);
 
 	/* Lighting and colours */
 	glClearColor(0, 0, 0, 0);
@@ -193,21 +1561,38 @@ void init()
 	renderstate.lightModel = 1;
 	renderstate.shading = 1;
 	renderstate.animate = 0;
-
-
-	update_renderstate();
-
+	renderstate.meshCache = 0;
+	renderstate.clusterCull = 0;
+	renderstate.lights = 0;
+	renderstate.framesInFlight = latencyStats()->maxInFlight;
+	renderstate.dynamicResolution = 0;
+	renderstate.frameTarget = 16.7;
+	renderstate.depthPrepass = 0;
+	renderstate.overdraw = 0;
+	renderstate.megaBuffer = 0;
+	renderstate.software = 0;
+	renderstate.impostor = 0;
+	renderstate.normals = 0;
+	if (!blocks->supported)
+		printf("Fixed function only: [s], [1] and [q] are unavailable\n");
+
+	frames = createTripleBuffer(sizeof(FrameState));
 	regenerate_geometry();
+	publish_frame();
 }
 
 void reshape(int width, int height)
 {
 	glViewport(0, 0, width, height);
+	window_width = width;
+	window_height = height;
+	resizeResolutionScaler(scaler, width, height);
+	resizeSoftRaster(soft, width, height);
 
 	/* Reset the projection matrix */
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
-	gluPerspective(60.0, width / (double) height, 0.1, 100.0);
+	gluPerspective(60.0, width / (double) height, NEAR_PLANE, FAR_PLANE);
 	glMatrixMode(GL_MODELVIEW);
 }
 
@@ -260,43 +1645,363 @@ void draw_framerate(SDL_Surface *surface)
 
 void draw_osd(SDL_Surface *surface)
 {
-	char buffer[1024];
+	char buffer[2048];
+	char memory[256];
+	char generator[128];
+	char tiles[160];
+	char benchmark[32];
+	char scene_status[128];
+	char scene_batch[192];
+	char cluster_status[160];
+	char light_status[128];
+	char latency_status[160];
+	char resolution[128];
+	char overdraw[96];
+	char software[160];
+	char impostor_status[96];
+	char normals[64];
+	char uniform_blocks[128];
+	char histogram[LATENCY_BUCKETS + 1];
+	const LatencyStats* latency = latencyStats();
+	const RenderState* renderstate = &current.renderstate;
+	const ScratchStats* scratch = &current.scratch;
+
+	resFormatStats(memory, sizeof memory);
+	snprintf(generator, sizeof generator,
+			"scratch: %.2f MB, %ld grows, %ld reuses, %ld allocs total",
+			scratch->capacity / (1024.0 * 1024.0), scratch->grows, scratch->reuses,
+			resStats().totalAllocations);
+	if (renderstate->scene)
+		snprintf(scene_status, sizeof scene_status,
+				"%d objects, %d submitted, %d culled, cull %.3f ms",
+				scene->stats.objects, scene->stats.submitted, scene->stats.culled,
+				scene->stats.cullMs);
+	else
+		snprintf(scene_status, sizeof scene_status, "disabled");
+	if (renderstate->scene && renderstate->megaBuffer && scene_mega)
+		snprintf(scene_batch, sizeof scene_batch,
+				"%d draws in %d calls, encode %.3f submit %.3f ms%s",
+				scene_mega->stats.draws, scene_mega->stats.calls, scene_mega->stats.encodeMs,
+				scene_mega->stats.submitMs, scene_mega->indirect ? "" : " (no indirect draws)");
+	else if (renderstate->scene && scene_queue)
+		snprintf(scene_batch, sizeof scene_batch,
+				"disabled; queue: %d draws, %d state switches (%d pass, %d program, "
+				"%d material, %d mesh; %d unsorted), sort %.3f ms",
+				scene_queue->stats.draws, scene_queue->stats.switches,
+				scene_queue->stats.passSwitches, scene_queue->stats.programSwitches,
+				scene_queue->stats.materialSwitches, scene_queue->stats.meshSwitches,
+				scene_queue->stats.unsortedSwitches, scene_queue->stats.sortMs);
+	else
+		snprintf(scene_batch, sizeof scene_batch, "%s", renderstate->megaBuffer ? "enabled" : "disabled");
+	if (object && object->clusters) {
+		const ClusterStats* cs = &object->clusters->stats;
+		snprintf(cluster_status, sizeof cluster_status,
+				"%d/%d drawn (%d back, %d frustum), %d draws, %d/%d triangles",
+				cs->drawn, cs->clusters, cs->culledBackface, cs->culledFrustum,
+				cs->draws, cs->triangles, cs->totalTriangles);
+	} else
+		snprintf(cluster_status, sizeof cluster_status, "%s",
+				renderstate->clusterCull ? "enabled (torus only)" : "disabled");
+	if (renderstate->lights && renderstate->shaders && renderstate->perPixel)
+		snprintf(light_status, sizeof light_status,
+				"%d (binned in %.3f ms, %d refs, max %d per cluster)",
+				lights->stats.lights, lights->stats.binMs, lights->stats.references,
+				lights->stats.maxPerCluster);
+	else
+		snprintf(light_status, sizeof light_status, "%d%s", renderstate->lights,
+				renderstate->lights ? " (per pixel shaders only)" : "");
+	if (!scaler->supported)
+		snprintf(resolution, sizeof resolution, "not supported");
+	else if (renderstate->dynamicResolution)
+		snprintf(resolution, sizeof resolution, "%.0f%% (%dx%d), frame %.1f ms",
+				scaler->scale * 100.0f, scaler->renderWidth, scaler->renderHeight,
+				scaler->frameMs);
+	else
+		snprintf(resolution, sizeof resolution, "disabled");
+	if (renderstate->overdraw && overdraw_counter->covered)
+		snprintf(overdraw, sizeof overdraw, "%.2f shaded fragments per pixel (%u/%u)",
+				overdrawPerPixel(overdraw_counter), overdraw_counter->shaded,
+				overdraw_counter->covered);
+	else
+		snprintf(overdraw, sizeof overdraw, "%s", renderstate->overdraw ? "enabled" : "disabled");
+	if (renderstate->software)
+		snprintf(software, sizeof software,
+				"%d triangles (%d culled), %d tile refs, transform %.2f setup %.2f raster %.2f ms, %d threads",
+				soft->stats.triangles, soft->stats.culled, soft->stats.binned,
+				soft->stats.transformMs, soft->stats.setupMs, soft->stats.rasterMs,
+				soft->stats.threads);
+	else
+		snprintf(software, sizeof software, "disabled");
+	if (!normals_shader)
+		snprintf(normals, sizeof normals, "not supported");
+	else if (renderstate->normals && object && !renderstate->scene)
+		snprintf(normals, sizeof normals, "%d lines", object->numVertices);
+	else
+		snprintf(normals, sizeof normals, "%s",
+				renderstate->normals ? "enabled (meshes only)" : "disabled");
+	if (renderstate->impostor && renderstate->object != WAVE)
+		snprintf(impostor_status, sizeof impostor_status, "4 vertices%s",
+				impostor->fullWindow ? ", covering the window" : "");
+	else
+		snprintf(impostor_status, sizeof impostor_status, "%s",
+				renderstate->impostor ? "enabled (torus and sphere only)" : "disabled");
+	if (blocks->supported)
+		snprintf(uniform_blocks, sizeof uniform_blocks,
+				"uniform blocks: %d writes (%d bytes), %d unchanged",
+				blocks->stats.writes, blocks->stats.bytes, blocks->stats.skipped);
+	else
+		snprintf(uniform_blocks, sizeof uniform_blocks, "uniform blocks: not supported");
+	latencyFormatHistogram(histogram, sizeof histogram);
+	if (latency->samples)
+		snprintf(latency_status, sizeof latency_status,
+				"latency: p50 %.0f p95 %.0f max %.1f ms, %d in flight |%s| %.0f ms",
+				latencyPercentile(0.5), latencyPercentile(0.95), latency->max,
+				latency->inFlight, histogram, LATENCY_BUCKETS * LATENCY_BUCKET_MS);
+	else
+		snprintf(latency_status, sizeof latency_status, "latency: no input yet");
+	if (tiled)
+		snprintf(tiles, sizeof tiles,
+				"tiles: %d drawn of %d (%d coarser, %d frustum, %d back culled), %d/%d resident, "
+				"%d uploads, %d starved",
+				tiled->stats.visible, tiled->stats.tiles, tiled->stats.coarse,
+				tiled->stats.culledFrustum, tiled->stats.culledBackface, tiled->stats.resident,
+				tiled->numSlots, tiled->stats.uploads, tiled->stats.starved);
+	else
+		snprintf(tiles, sizeof tiles, "tiles: not tiled below tessellation %d", max_mesh_tess + 1);
+	if (current.benchRunning)
+		snprintf(benchmark, sizeof benchmark, "step %d/%d", current.benchStep + 1, current.benchSteps);
+	else
+		snprintf(benchmark, sizeof benchmark, "stopped");
+
 	snprintf(buffer, sizeof buffer,
 			"[a]   - wave animation: %s\n" //toggle wave animation
+			"[b]   - benchmark: %s\n"
+			"[c]   - mesh cache: %s\n" //load prebuilt meshes from MESH_DIRECTORY
+			"[d]   - dynamic resolution: %s\n" //scene offscreen, scaled to the target
+			"[e]   - scene: %s\n" //10k instances, BVH culled
 			"[f]   - shading: %s\n" //smooth/flat
-			"[g]   - model: %s\n" //torus, wave
+			"[g]   - model: %s\n" //torus, sphere, wave
 			"[H/h] - shininess: %d\n" //increase/decrease
+			"[I/i] - point lights: %s\n" //double/halve
+			"[J/j] - frames in flight: %d\n" //increase/decrease
 			"[l]   - lighting: %s\n" //toggle
 			"[m]   - specular mode: %s\n" //Blinn-Phong or Phong
 			"[n]   - normals: %s\n" //enabled/disabled
 			"[o]   - OSD option: %s\n" //cycle through
 			"[p]   - per pixel lighting: %s\n" //per vertex/per pixel
+			"[q]   - scene batching: %s\n" //one multi draw from shared buffers, or sorted draws
+			"[R/r] - frame target: %.1f ms\n" //for dynamic resolution
 			"[s]   - shaders: %s\n"
 			"[T/t] - tessellation: %d\n" //increase/decrease
+			"[u]   - cluster culling: %s\n" //back-facing/off-screen strip runs
 			"[v]   - local viewer: %s\n"
 			"[w]   - wireframe: %s\n" //enabled/disabled
-			"[k]   - light type: %s\n", //directional/point
-			renderstate.animate ? "enabled" : "disabled", // shaders, // wave animation
-			renderstate.shading ? "Smooth" : "Flat",   // shading
-			object_names[renderstate.object],   // model
-			(int) material_shininess,          // shininess
-			renderstate.lighting ? "enabled" : "disabled",
-			renderstate.specularMode ? "Phong" : "Blinn-Phong",
-			"todo", // normals
+			"[y]   - software renderer: %s\n" //CPU rasterizer, see softraster.h
+			"[x]   - depth pre-pass: %s\n"
+			"[z]   - overdraw: %s\n" //additive, counted with occlusion queries
+			"[k]   - light type: %s\n" //directional/point
+			"[1]   - impostors: %s\n" //ray cast torus and sphere, see impostor.h
+			"%s\n" //memory usage
+			"%s\n" //generator scratch
+			"%s\n" //tile streaming
+			"%s\n" //uniform buffer updates this frame
+			"%s\n", //motion-to-photon
+			renderstate->animate ? "enabled" : "disabled", // shaders, // wave animation
+			benchmark,
+			renderstate->meshCache ? "enabled" : "disabled",
+			resolution,
+			scene_status,
+			renderstate->shading ? "Smooth" : "Flat",   // shading
+			object_names[renderstate->object],   // model
+			(int) current.shininess,          // shininess
+			light_status,
+			renderstate->framesInFlight,
+			renderstate->lighting ? "enabled" : "disabled",
+			renderstate->specularMode ? "Phong" : "Blinn-Phong",
+			normals,
 			"enabled", // OSD option
-			renderstate.perPixel ? "enabled" : "disabled", // lighting mode
+			renderstate->perPixel ? "enabled" : "disabled", // lighting mode
+			scene_batch,
+			renderstate->frameTarget,
 			/* shaders */
-			renderstate.shaders ? "enabled" : "disabled", // shaders
-			tessellation,
-			renderstate.lightModel ? "enabled" : "disabled", // local viewer
+			renderstate->shaders ? "enabled" : "disabled", // shaders
+			current.tessellation,
+			cluster_status,
+			renderstate->lightModel ? "enabled" : "disabled", // local viewer
 			/* wireframe */
-			renderstate.wireframe ? "enabled" : "disabled",
-			renderstate.lightType ? "directional" : "point"); // lighting mode
+			renderstate->wireframe ? "enabled" : "disabled",
+			software,
+			renderstate->depthPrepass ? "enabled" : "disabled",
+			overdraw,
+			renderstate->lightType ? "directional" : "point", // lighting mode
+			impostor_status,
+			memory,
+			generator,
+			tiles,
+			uniform_blocks,
+			latency_status);
 	draw_text(surface, buffer, 0, 30);
 }
 
+/* Draws the object on the CPU with the state the GL path would use */
+void draw_software()
+{
+	const RenderState* renderstate = &current.renderstate;
+	SoftParams params;
+
+	softParamsFromGL(&params);
+	/* The shaders light regardless of GL_LIGHTING; lightingModel 0 is Phong */
+	params.lighting = renderstate->shaders || renderstate->lighting;
+	params.perPixel = renderstate->shaders && renderstate->perPixel;
+	params.phong = renderstate->shaders && renderstate->specularMode == 0;
+	drawSoft(soft, &params);
+	presentSoft(soft);
+}
+
+/*
+Draws the object's normals with one point per vertex, each expanded into a
+line on the GPU. The shader path's buffers hold a grid, which the same
+vertex shader turns into the surface; any other mesh already is the
+surface, and the shader's sphere case passes it through as it is.
+*/
+void draw_normals()
+{
+	if (!normals_shader || !object)
+		return;
+	/* The frame block says what the vertex shader makes of the mesh */
+	glUseProgram(normals_shader);
+	glUniform1f(normals_length_uniform, NORMAL_LENGTH);
+	drawNormals(object);
+	glUseProgram(0);
+}
+
+/* The object itself, clustered or whole */
+void draw_surface(const Frustum* frustum)
+{
+	if (object->clusters)
+		drawClusters(object, frustum);
+	else
+		drawObject(object);
+}
+
+/* Selects the shader's pass, when the shader is in use */
+void set_pass(int pass)
+{
+	if (current.renderstate.shaders)
+		glUniform1i(uniform.pass, pass);
+}
+
+/*
+Draws the object, with the optional depth pre-pass: depth only first, then
+shaded only where the depth matches, so hidden layers are never lit. Both
+passes use the same program, so the generated positions match exactly.
+Overdraw mode adds a constant per shaded fragment instead of lighting it.
+*/
+void draw_object_passes(const Frustum* frustum)
+{
+	int counting;
+
+	collectOverdraw(overdraw_counter);
+	counting = (current.renderstate.overdraw || current.countOverdraw)
+			&& !overdraw_counter->pending;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_CURRENT_BIT);
+	if (current.renderstate.depthPrepass) {
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDisable(GL_LIGHTING);
+		set_pass(PASS_DEPTH);
+		draw_surface(frustum);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		if (current.renderstate.lighting)
+			glEnable(GL_LIGHTING);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
+	if (current.renderstate.overdraw) {
+		glDisable(GL_LIGHTING);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glColor3f(0.15f, 0.06f, 0.02f); /* as in shader.frag */
+		set_pass(PASS_OVERDRAW);
+	} else {
+		set_pass(PASS_SHADE);
+	}
+	if (counting)
+		beginShadedCount(overdraw_counter);
+	draw_surface(frustum);
+
+	/* The finished depth, once more, gives the covered pixels */
+	if (counting) {
+		endShadedCount();
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+		set_pass(PASS_DEPTH);
+		beginCoveredCount(overdraw_counter);
+		draw_surface(frustum);
+		endCoveredCount(overdraw_counter);
+	}
+	set_pass(PASS_SHADE);
+	glPopAttrib();
+}
+
+/*
+Fills the frame block from the current frame. object is what the vertex
+shader should make of the object's buffers: the shader path's hold a
+grid, the others already hold the surface.
+*/
+void set_frame_block(int scaled)
+{
+	const RenderState* renderstate = &current.renderstate;
+	FrameBlock frame;
+
+	frame.object = renderstate->shaders && !renderstate->software ? renderstate->object : SPHERE;
+	frame.lightingModel = renderstate->specularMode;
+	frame.isLocalViewer = renderstate->lightModel;
+	frame.isPerPixelLighting = renderstate->perPixel;
+	frame.time = current.time;
+	frame.numLights = renderstate->shaders && renderstate->perPixel ? renderstate->lights : 0;
+	frame.viewport[0] = scaled ? scaler->renderWidth : window_width;
+	frame.viewport[1] = scaled ? scaler->renderHeight : window_height;
+	setFrameBlock(blocks, &frame);
+}
+
 void display(SDL_Surface *surface)
 {
+	Frustum frustum;
+	ImpostorShape shape;
+	float major, minor;
+	int fresh, scaled;
+
+	/* Take the newest simulation state and geometry */
+	current = *(const FrameState*)tripleLatest(frames, &fresh);
+	resetBlockStats(blocks);
+	if (fresh) {
+		__atomic_store_n(&drawn_sequence, current.sequence, __ATOMIC_RELEASE);
+		apply_renderstate(&current);
+		latencySetMaxInFlight(current.renderstate.framesInFlight);
+		if (current.inputStamp != 0.0 && current.inputStamp != drawn_stamp)
+			latencyAttach(current.inputStamp);
+		drawn_stamp = current.inputStamp;
+	}
+	upload_geometry();
+	if (current.renderstate.scene) {
+		if (!scene)
+			build_scene(SCENE_OBJECTS);
+		if (current.renderstate.animate)
+			animate_scene();
+	}
+
+	/* The scene goes offscreen at reduced size, the overlays don't. The
+	 * software renderer always draws at window size. */
+	scaled = current.renderstate.dynamicResolution && scaler->supported
+		&& !current.renderstate.software;
+	if (scaled)
+		beginScaledFrame(scaler, current.renderstate.frameTarget);
+	else
+		resetResolutionScaler(scaler);
+
 	/* Clear the colour and depth buffer */
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -306,41 +2011,73 @@ void display(SDL_Surface *surface)
 
 	/* Set the light position (gets multiplied by the modelview matrix) */
 	//glLightfv(GL_LIGHT0, GL_POSITION, light0_position);
-	if (renderstate.lightType)
+	if (current.renderstate.lightType)
 		glLightfv(GL_LIGHT0, GL_POSITION, light0_directional);
 	else
 		glLightfv(GL_LIGHT0, GL_POSITION, light0_point);
+	/* The modelview is the identity, so that is the eye space position */
+	setLightBlock(blocks, current.renderstate.lightType ? light0_directional : light0_point,
+			light0_default_ambient, light0_default_diffuse, light0_default_specular,
+			scene_default_ambient);
 
 	/* Camera transformation - called later so it is static */
-	glTranslatef(0, 0, -camera_zoom);
-	glRotatef(-camera_pitch, 1, 0, 0);
-	glRotatef(-camera_heading, 0, 1, 0);
+	glTranslatef(0, 0, -current.zoom);
+	glRotatef(-current.pitch, 1, 0, 0);
+	glRotatef(-current.heading, 0, 1, 0);
 
 
+	/* Everything the programs read per frame, written at most once */
+	set_frame_block(scaled);
+
 	/*Turn on Shaders if applicable*/
-	if (renderstate.shaders) {
+	if (current.renderstate.shaders) {
 		glUseProgram(shader); /* Use our shader for future rendering */
-
-		glUniform1i(uniform.object, renderstate.object);
-		glUniform1i(uniform.lightingModel, renderstate.specularMode);
-		glUniform1i(uniform.isLocalViewer, renderstate.lightModel);
-		glUniform1i(uniform.isPerPixelLighting, renderstate.perPixel);
-		glUniform1f(uniform.time, time_s);
+		glUniform1i(uniform.pass, PASS_SHADE);
+
+		/* Lights are binned for the camera alone: the object has no transform */
+		if (current.renderstate.perPixel && current.renderstate.lights > 0) {
+			float modelview[16], projection[16];
+			glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+			glGetFloatv(GL_PROJECTION_MATRIX, projection);
+			place_lights();
+			updateLights(lights, modelview, projection, NEAR_PLANE, FAR_PLANE);
+			bindLights(lights, 0);
+		}
 	}
 
 	/* Draw the scene */
-	drawObject(object);
-	//drawNormals(object);
+	if (current.renderstate.scene) {
+		frustumFromGL(&frustum);
+		cullScene(scene, &frustum);
+		draw_scene(current.renderstate.megaBuffer);
+	} else if (current.renderstate.impostor
+			&& impostor_shape(current.renderstate.object, &shape, &major, &minor)) {
+		drawImpostor(impostor, shape, major, minor);
+	} else if (current.renderstate.software) {
+		glUseProgram(0);
+		draw_software();
+	} else if (tiled) {
+		frustumFromGL(&frustum);
+		drawTiledSurface(tiled, &frustum);
+	} else if (object) {
+		frustumFromGL(&frustum);
+		draw_object_passes(&frustum);
+	}
+	if (current.renderstate.normals && !current.renderstate.scene)
+		draw_normals();
 
 	/* turn shaders off */
 	glUseProgram(0);
 
+	if (scaled)
+		endScaledFrame(scaler);
+
 	/*drawAxes once shader is turned off*/
 	drawAxes(0,0,0,2);
 
 	/* Draw framerate */
 	draw_framerate(surface);
-	if (renderstate.osd) draw_osd(surface);
+	if (current.renderstate.osd) draw_osd(surface);
 
 	CHECKERROR;
 }
@@ -348,14 +2085,20 @@ void display(SDL_Surface *surface)
 void update(int milliseconds)
 {
 	static long time_ms = 0;
+	if (bench.running)
+		bench_frame();
 	if (renderstate.animate &&
-			renderstate.object == WAVE) {
+			(renderstate.object == WAVE || renderstate.scene || renderstate.lights)) {
 		time_ms += milliseconds;
 		time_s = (double) time_ms / 1000.0f;
-		if (renderstate.shaders == 0) {
+		/* The scene animates in display(). Don't build waves faster than
+		 * they are uploaded: the last one is still waiting. */
+		if (!renderstate.scene && renderstate.object == WAVE && mesh_is_surface()
+				&& !mailboxPending(&uploads)) {
 			regenerate_geometry();
 		}
 	}
+	publish_frame();
 }
 
 void set_mousestate(unsigned char button, int state)
@@ -379,6 +2122,7 @@ void event(SDL_Event *event)
 	{
 	case SDL_KEYDOWN:
 		key_state[event->key.keysym.sym] = 1;
+		stamp_input();
 
 		/* Handle non-state keys */
 		switch (event->key.keysym.sym)
@@ -390,20 +2134,106 @@ void event(SDL_Event *event)
 			renderstate.animate = !renderstate.animate;
 			printf("Wave Animate %i\n", renderstate.animate);
 			break;
+		case SDLK_b:
+			/* The sweep drives display() directly, one frame per step */
+			if (render_threaded()) {
+				printf("The benchmark only runs without --threaded\n");
+				break;
+			}
+			if (bench.running)
+				bench_stop();
+			else
+				bench_start();
+			break;
+		case SDLK_c:
+			renderstate.meshCache = !renderstate.meshCache;
+			printf("Mesh cache %i\n", renderstate.meshCache);
+			regenerate_geometry();
+			break;
 		case SDLK_g:
 			renderstate.object = (renderstate.object + 1) % OBJECT_MAX;
 			printf("Object %s\n", object_names[renderstate.object]);
 			regenerate_geometry();
 			break;
 		case SDLK_s:
+			if (!renderstate.shaders && !programs_supported("Shaders"))
+				break;
 			renderstate.shaders = !renderstate.shaders;
+			/* The shader path generates its surface from one mesh */
+			if (renderstate.shaders)
+				tessellation = min(tessellation, max_mesh_tess);
 			regenerate_geometry();
 			printf("Using Shaders %i\n", renderstate.shaders);
 			break;
+		case SDLK_i:
+			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+				renderstate.lights = renderstate.lights ? min(renderstate.lights * 2, LIGHT_MAX) : 1;
+			else
+				renderstate.lights /= 2;
+			printf("Point lights %i\n", renderstate.lights);
+			break;
+		case SDLK_j:
+			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+				renderstate.framesInFlight = min(renderstate.framesInFlight + 1, LATENCY_MAX_IN_FLIGHT);
+			else
+				renderstate.framesInFlight = max(renderstate.framesInFlight - 1, 1);
+			printf("Frames in flight %i\n", renderstate.framesInFlight);
+			break;
+		case SDLK_u:
+			renderstate.clusterCull = !renderstate.clusterCull;
+			printf("Cluster culling %i\n", renderstate.clusterCull);
+			regenerate_geometry();
+			break;
+		case SDLK_d:
+			renderstate.dynamicResolution = !renderstate.dynamicResolution;
+			printf("Dynamic resolution %i\n", renderstate.dynamicResolution);
+			break;
+		case SDLK_r:
+			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+				renderstate.frameTarget += 1.0f;
+			else
+				renderstate.frameTarget = max(renderstate.frameTarget - 1.0f, 1.0f);
+			printf("Frame target %.1f ms\n", renderstate.frameTarget);
+			break;
+		case SDLK_x:
+			renderstate.depthPrepass = !renderstate.depthPrepass;
+			printf("Depth pre-pass %i\n", renderstate.depthPrepass);
+			break;
+		case SDLK_z:
+			renderstate.overdraw = !renderstate.overdraw;
+			printf("Overdraw %i\n", renderstate.overdraw);
+			break;
+		case SDLK_e:
+			renderstate.scene = !renderstate.scene;
+			printf("Scene %i\n", renderstate.scene);
+			break;
+		case SDLK_y:
+			renderstate.software = !renderstate.software;
+			/* Meshes only: tiles are GL */
+			if (renderstate.software)
+				tessellation = min(tessellation, max_mesh_tess);
+			regenerate_geometry();
+			printf("Software renderer %i\n", renderstate.software);
+			break;
+		case SDLK_n:
+			renderstate.normals = !renderstate.normals;
+			printf("Normals %i\n", renderstate.normals);
+			break;
+		case SDLK_1:
+			if (!renderstate.impostor && !programs_supported("Impostors"))
+				break;
+			renderstate.impostor = !renderstate.impostor;
+			printf("Impostors %i\n", renderstate.impostor);
+			break;
+		case SDLK_q:
+			if (!renderstate.megaBuffer && !programs_supported("Scene batching"))
+				break;
+			renderstate.megaBuffer = !renderstate.megaBuffer;
+			printf("Scene batching %i\n", renderstate.megaBuffer);
+			break;
 		case SDLK_f:
 			renderstate.shading = !renderstate.shading;
 			printf("Changed shading mode %i\n", renderstate.shading);
-			update_renderstate();
 			break;
 		case SDLK_h:
 			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
@@ -412,7 +2242,6 @@ void event(SDL_Event *event)
 				{
 					printf("keypress\n");
 					material_shininess += 16;
-					glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
 					printf("shininess: %f\n", material_shininess);
 				}
 			}
@@ -422,7 +2251,6 @@ void event(SDL_Event *event)
 				{
 					printf("keypress\n");
 					material_shininess -= 16;
-					glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
 					printf("shininess: %f\n", material_shininess);
 				}
 			}
@@ -430,22 +2258,18 @@ void event(SDL_Event *event)
 		case SDLK_k:
 			renderstate.lightType = !renderstate.lightType;
 			printf("Light Mode %i\n", renderstate.lightType);
-			update_renderstate();
 			break;
 		case SDLK_l:
 			renderstate.lighting = !renderstate.lighting;
 			printf("Lighting %i\n", renderstate.lighting);
-			update_renderstate();
 			break;
 		case SDLK_m:
 			renderstate.specularMode = !renderstate.specularMode;
 			printf("Specular Mode %i\n", renderstate.specularMode);
-			update_renderstate();
 			break;
 		case SDLK_o:
 			renderstate.osd = !renderstate.osd;
 			printf("OSD %i\n", renderstate.osd);
-			update_renderstate();
 			break;
 		case SDLK_p:
 			renderstate.perPixel = !renderstate.perPixel;
@@ -454,7 +2278,7 @@ void event(SDL_Event *event)
 		case SDLK_t:
 			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
 			{
-				if (tessellation < max_tess)
+				if (tessellation < (renderstate.shaders || renderstate.software ? max_mesh_tess : max_tess))
 				{
 					++tessellation;
 					regenerate_geometry();
@@ -472,12 +2296,10 @@ void event(SDL_Event *event)
 		case SDLK_v:
 			renderstate.lightModel = !renderstate.lightModel;
 			printf("Local Viewer %i\n", renderstate.lightModel);
-			update_renderstate();
 			break;
 		case SDLK_w:
 			renderstate.wireframe = !renderstate.wireframe;
 			printf("Wireframe %i\n", renderstate.wireframe);
-			update_renderstate();
 			break;
 		default:
 			break;
@@ -503,6 +2325,8 @@ void event(SDL_Event *event)
 			first_mousemotion = 0;
 			break;
 		}
+		if (mouse1_down || mouse2_down)
+			stamp_input();
 		if (mouse1_down)
 		{
 			/* Only move the camera if the mouse is down*/
@@ -521,10 +2345,40 @@ void event(SDL_Event *event)
 
 void cleanup()
 {
-	/* Delete the shader */
-	glDeleteProgram(shader);
-
-	/* Free object data */
+	GeometryUpload* upload;
+	int i;
+
+	if (bench.running)
+		bench_stop();
+
+	/* Delete the shaders */
+	resDeleteProgram(shader);
+	resDeleteProgram(scene_shader);
+	resDeleteProgram(normals_shader);
+
+	/* Free object data, including any upload display() never took */
+	upload = (GeometryUpload*)mailboxTake(&uploads);
+	if (upload)
+		free_geometry(upload);
+	freeTripleBuffer(frames);
 	if (object)
 		freeObject(object);
+	object = NULL;
+	if (tiled)
+		freeTiledSurface(tiled);
+	tiled = NULL;
+	free_scene();
+	freeSoftRaster(soft); /* before the light system, whose job pool it uses */
+	freeLightSystem(lights);
+	latencyFree();
+	freeResolutionScaler(scaler);
+	freeOverdrawCounter(overdraw_counter);
+	freeImpostor(impostor);
+	freeUniformBlocks(blocks);
+	freeObjectScratch();
+	for (i = 0; i < 2; ++i)
+		resFree(upload_arenas[i].data);
+
+	/* Anything still registered now was never released */
+	resReportLeaks();
 }
@@ -0,0 +1,55 @@
+/* bench.c */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <time.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+double benchNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+FILE* benchOpen(const char* name, const char* header)
+{
+	char filename[256];
+	FILE* file;
+
+	snprintf(filename, sizeof filename, "bench-%s.csv", name);
+	file = fopen(filename, "w");
+	if (!file)
+	{
+		printf("Error opening %s for writing\n", filename);
+		return NULL;
+	}
+	fprintf(file, "%s\n", header);
+	printf("Writing benchmark results to %s\n", filename);
+	return file;
+}
+
+void benchTimerReset(BenchTimer* timer)
+{
+	timer->frames = 0;
+	timer->total = 0.0;
+	timer->min = 0.0;
+	timer->max = 0.0;
+}
+
+void benchTimerAdd(BenchTimer* timer, double ms)
+{
+	if (timer->frames == 0 || ms < timer->min)
+		timer->min = ms;
+	if (timer->frames == 0 || ms > timer->max)
+		timer->max = ms;
+	timer->total += ms;
+	timer->frames++;
+}
+
+double benchTimerMean(const BenchTimer* timer)
+{
+	return timer->frames ? timer->total / timer->frames : 0.0;
+}
@@ -0,0 +1,29 @@
+/* bench.h */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+/* Milliseconds from a monotonic clock, with sub-millisecond resolution */
+double benchNow();
+
+/*
+Opens bench-<name>.csv for writing and writes the header line.
+Returns NULL (after printing why) if the file cannot be created.
+*/
+FILE* benchOpen(const char* name, const char* header);
+
+/* Accumulates frame times for one benchmark step */
+typedef struct {
+	int frames;
+	double total;
+	double min;
+	double max;
+} BenchTimer;
+
+void benchTimerReset(BenchTimer* timer);
+void benchTimerAdd(BenchTimer* timer, double ms);
+double benchTimerMean(const BenchTimer* timer);
+
+#endif
@@ -0,0 +1,143 @@
+/* blocks.c */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "blocks.h"
+#include "resources.h"
+
+static const char* blockNames[BLOCK_COUNT] = { "Frame", "Light", "Material" };
+
+UniformBlocks* createUniformBlocks()
+{
+	UniformBlocks* blocks = (UniformBlocks*)resMalloc(sizeof(UniformBlocks), RES_ORIGIN);
+	GLint alignment;
+	GLsizeiptr total = 0;
+	int i;
+
+	memset(blocks, 0, sizeof(UniformBlocks));
+	blocks->supported = GLEW_ARB_uniform_buffer_object;
+	if (!blocks->supported)
+	{
+		printf("ARB_uniform_buffer_object not supported: the lighting shaders need it\n");
+		return blocks;
+	}
+
+	/* Each range starts where the implementation allows a binding to */
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	blocks->sizes[BLOCK_FRAME] = sizeof(FrameBlock);
+	blocks->sizes[BLOCK_LIGHT] = sizeof(LightBlock);
+	blocks->sizes[BLOCK_MATERIAL] = sizeof(MaterialBlock);
+	for (i = 0; i < BLOCK_COUNT; ++i)
+	{
+		blocks->offsets[i] = total;
+		total += (blocks->sizes[i] + alignment - 1) / alignment * alignment;
+	}
+
+	blocks->buffer = resGenBuffer(RES_ORIGIN);
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks->buffer);
+	resBufferData(GL_UNIFORM_BUFFER, blocks->buffer, total, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	/* Indexed bindings are global state: set once, never rebound */
+	for (i = 0; i < BLOCK_COUNT; ++i)
+		glBindBufferRange(GL_UNIFORM_BUFFER, i, blocks->buffer, blocks->offsets[i], blocks->sizes[i]);
+	return blocks;
+}
+
+void freeUniformBlocks(UniformBlocks* blocks)
+{
+	if (blocks->buffer)
+		resDeleteBuffer(blocks->buffer);
+	resFree(blocks);
+}
+
+void bindUniformBlocks(UniformBlocks* blocks, GLuint program)
+{
+	GLuint index;
+	int i;
+
+	if (!blocks->supported || !program)
+		return;
+	for (i = 0; i < BLOCK_COUNT; ++i)
+	{
+		index = glGetUniformBlockIndex(program, blockNames[i]);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, i);
+	}
+}
+
+/* Writes one block's range if data differs from copy, its last contents */
+static void updateBlock(UniformBlocks* blocks, int block, void* copy, const void* data)
+{
+	size_t size = blocks->sizes[block];
+
+	if (!blocks->supported)
+		return;
+	if (blocks->written[block] && memcmp(copy, data, size) == 0)
+	{
+		blocks->stats.skipped++;
+		return;
+	}
+	memcpy(copy, data, size);
+	blocks->written[block] = 1;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks->buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, blocks->offsets[block], size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	blocks->stats.writes++;
+	blocks->stats.bytes += size;
+}
+
+void setFrameBlock(UniformBlocks* blocks, const FrameBlock* frame)
+{
+	updateBlock(blocks, BLOCK_FRAME, &blocks->frame, frame);
+}
+
+void setLightBlock(UniformBlocks* blocks, const float* position, const float* ambient,
+		const float* diffuse, const float* specular, const float* sceneAmbient)
+{
+	LightBlock light;
+	float length;
+	int i;
+
+	memset(&light, 0, sizeof light);
+	memcpy(light.position, position, sizeof light.position);
+	memcpy(light.ambient, ambient, sizeof light.ambient);
+	memcpy(light.diffuse, diffuse, sizeof light.diffuse);
+	memcpy(light.specular, specular, sizeof light.specular);
+	memcpy(light.sceneAmbient, sceneAmbient, sizeof light.sceneAmbient);
+
+	/* As GL derives gl_LightSource[0].halfVector: the light's direction plus (0, 0, 1) */
+	length = sqrtf(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+	for (i = 0; i < 3; ++i)
+		light.halfVector[i] = position[i] / length + (i == 2);
+	length = sqrtf(light.halfVector[0] * light.halfVector[0]
+			+ light.halfVector[1] * light.halfVector[1] + light.halfVector[2] * light.halfVector[2]);
+	for (i = 0; i < 3; ++i)
+		light.halfVector[i] /= length;
+
+	updateBlock(blocks, BLOCK_LIGHT, &blocks->light, &light);
+}
+
+void setMaterialBlock(UniformBlocks* blocks, const float* ambient, const float* diffuse,
+		const float* specular, float shininess)
+{
+	MaterialBlock material;
+
+	memset(&material, 0, sizeof material);
+	memcpy(material.ambient, ambient, sizeof material.ambient);
+	memcpy(material.diffuse, diffuse, sizeof material.diffuse);
+	memcpy(material.specular, specular, sizeof material.specular);
+	material.shininess = shininess;
+
+	updateBlock(blocks, BLOCK_MATERIAL, &blocks->material, &material);
+}
+
+void resetBlockStats(UniformBlocks* blocks)
+{
+	memset(&blocks->stats, 0, sizeof(BlockStats));
+}
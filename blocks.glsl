@@ -0,0 +1,37 @@
+// blocks.glsl
+// uniform blocks shared by every program, each at its own binding point
+// (see blocks.h, whose structs match these member for member). Included
+// after #version 120 and GL_ARB_uniform_buffer_object. std140 has no
+// instance names here, so light and material members carry a prefix.
+
+// changes every frame, or with the render state
+layout(std140) uniform Frame {
+	int object;              // what mesh-generation.vert makes of the mesh:
+	                         // 0 = torus, 2 = wave, both from a grid;
+	                         // 1 = sphere, or any mesh that is already the
+	                         // surface, passed through as it is
+	int lightingModel;       // 0 = phong, 1 = blinn-phong
+	bool isLocalViewer;
+	bool isPerPixelLighting;
+	float time;
+	int numLights;           // clustered point lights, per pixel only
+	vec2 viewport;
+};
+
+// GL_LIGHT0, with the fixed function defaults
+layout(std140) uniform Light {
+	vec4 lightPosition;      // eye space
+	vec4 lightHalfVector;
+	vec4 lightAmbient;
+	vec4 lightDiffuse;
+	vec4 lightSpecular;
+	vec4 sceneAmbient;       // GL_LIGHT_MODEL_AMBIENT
+};
+
+// the front material
+layout(std140) uniform Material {
+	vec4 materialAmbient;
+	vec4 materialDiffuse;
+	vec4 materialSpecular;
+	float materialShininess;
+};
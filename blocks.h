@@ -0,0 +1,95 @@
+/* blocks.h */
+
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+/* For vertex buffer objects */
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+
+/*
+The uniform blocks declared in blocks.glsl, in one buffer, each range
+bound once to its own binding point. Programs only need their blocks
+pointed at those points (bindUniformBlocks()), then every program sees
+the same data with no glUniform calls.
+
+Each set*Block() compares against what was last written and, only if it
+differs, writes that block's range with a single glBufferSubData. Light and
+material change only with the keys; the frame block with time.
+
+The structs follow std140: vec4s first, ints, bools and floats 4 bytes,
+vec2 8 aligned, so there is no padding the compiler could add or skip.
+Needs ARB_uniform_buffer_object; without it blocks->supported is 0 and
+the lighting shaders don't compile.
+*/
+enum {
+	BLOCK_FRAME,       /* binding points */
+	BLOCK_LIGHT,
+	BLOCK_MATERIAL,
+	BLOCK_COUNT
+};
+
+typedef struct {
+	GLint object;
+	GLint lightingModel;
+	GLint isLocalViewer;
+	GLint isPerPixelLighting;
+	GLfloat time;
+	GLint numLights;
+	GLfloat viewport[2];
+} FrameBlock;
+
+typedef struct {
+	GLfloat position[4];
+	GLfloat halfVector[4];
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat sceneAmbient[4];
+} LightBlock;
+
+typedef struct {
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat shininess;
+	GLfloat padding[3];  /* to a whole vec4, and always 0 */
+} MaterialBlock;
+
+typedef struct {
+	int writes;          /* since resetBlockStats() */
+	int skipped;         /* sets that matched the last write */
+	int bytes;
+} BlockStats;
+
+typedef struct {
+	int supported;
+	GLuint buffer;
+	GLintptr offsets[BLOCK_COUNT];
+	GLsizeiptr sizes[BLOCK_COUNT];
+	int written[BLOCK_COUNT]; /* the copies below are valid */
+	FrameBlock frame;    /* as last written */
+	LightBlock light;
+	MaterialBlock material;
+	BlockStats stats;
+} UniformBlocks;
+
+UniformBlocks* createUniformBlocks();
+void freeUniformBlocks(UniformBlocks* blocks);
+
+/* Points the program's blocks, whichever of them it uses, at the shared ones */
+void bindUniformBlocks(UniformBlocks* blocks, GLuint program);
+
+void setFrameBlock(UniformBlocks* blocks, const FrameBlock* frame);
+
+/* position is eye space; the half vector is made from it, for a viewer at infinity */
+void setLightBlock(UniformBlocks* blocks, const float* position, const float* ambient,
+		const float* diffuse, const float* specular, const float* sceneAmbient);
+
+void setMaterialBlock(UniformBlocks* blocks, const float* ambient, const float* diffuse,
+		const float* specular, float shininess);
+
+void resetBlockStats(UniformBlocks* blocks);
+
+#endif
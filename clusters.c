@@ -0,0 +1,95 @@
+/* clusters.c */
+
+#include <assert.h>
+
+#include "clusters.h"
+#include "resources.h"
+
+ClusterSet* buildClusters(const Mesh* mesh)
+{
+	int numTriangles = mesh->numIndices - 2;
+	ClusterSet* set;
+	int i;
+
+	assert(mesh->primitive == GL_TRIANGLE_STRIP);
+	set = (ClusterSet*)resMalloc(sizeof(ClusterSet), RES_ORIGIN);
+	set->numClusters = (numTriangles + CLUSTER_TRIANGLES - 1) / CLUSTER_TRIANGLES;
+	set->clusters = (Cluster*)resMalloc(sizeof(Cluster) * set->numClusters, RES_ORIGIN);
+	set->counts = (GLsizei*)resMalloc(sizeof(GLsizei) * set->numClusters, RES_ORIGIN);
+	set->offsets = (const GLvoid**)resMalloc(sizeof(GLvoid*) * set->numClusters, RES_ORIGIN);
+
+	/* CLUSTER_TRIANGLES is even, so every run starts with the strip's parity */
+	for (i = 0; i < set->numClusters; ++i)
+	{
+		Cluster* c = &set->clusters[i];
+		int triangles = numTriangles - i * CLUSTER_TRIANGLES;
+		if (triangles > CLUSTER_TRIANGLES)
+			triangles = CLUSTER_TRIANGLES;
+		c->first = i * CLUSTER_TRIANGLES;
+		c->count = triangles + 2;
+		boundsFromStrip(&c->bounds, mesh->vertices, mesh->indices, sizeof(unsigned int), c->first, c->count);
+	}
+
+	set->stats.clusters = set->numClusters;
+	set->stats.totalTriangles = numTriangles;
+	return set;
+}
+
+void freeClusters(ClusterSet* set)
+{
+	resFree(set->clusters);
+	resFree(set->counts);
+	resFree(set->offsets);
+	resFree(set);
+}
+
+void setObjectClusters(Object* obj, ClusterSet* set)
+{
+	if (obj->clusters)
+		freeClusters(obj->clusters);
+	obj->clusters = set;
+}
+
+void drawClusters(Object* obj, const Frustum* frustum)
+{
+	ClusterSet* set = obj->clusters;
+	ClusterStats* stats = &set->stats;
+	int i, draws = 0, end = -1;
+
+	assert(set);
+	stats->drawn = stats->culledFrustum = stats->culledBackface = 0;
+	stats->triangles = 0;
+
+	for (i = 0; i < set->numClusters; ++i)
+	{
+		const Cluster* c = &set->clusters[i];
+		if (boundsBackfacing(&c->bounds, frustum->eye))
+		{
+			stats->culledBackface++;
+			continue;
+		}
+		if (!sphereInFrustum(frustum, c->bounds.center, c->bounds.radius))
+		{
+			stats->culledFrustum++;
+			continue;
+		}
+		stats->drawn++;
+
+		/* Neighbouring runs overlap by two indices, so extend the last draw */
+		if (draws > 0 && end == c->first + 2)
+			set->counts[draws - 1] += c->count - 2;
+		else
+		{
+			set->counts[draws] = c->count;
+			set->offsets[draws] = (const GLvoid*)(sizeof(unsigned int) * c->first);
+			draws++;
+		}
+		end = c->first + c->count;
+	}
+
+	for (i = 0; i < draws; ++i)
+		stats->triangles += set->counts[i] - 2;
+	stats->draws = draws;
+
+	drawObjectRanges(obj, set->counts, set->offsets, draws);
+}
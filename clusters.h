@@ -0,0 +1,56 @@
+/* clusters.h */
+
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include "objects.h"
+#include "cull.h"
+
+/*
+A mesh's triangle strip cut into runs of CLUSTER_TRIANGLES triangles,
+each with bounds and a normal cone. Runs start on even strip positions so
+every triangle keeps the winding it has in the full strip. Each frame the
+clusters facing away from the eye or outside the frustum are dropped and
+the neighbouring survivors are merged into as few draws as possible.
+Only valid for closed surfaces.
+*/
+#define CLUSTER_TRIANGLES 128
+
+typedef struct {
+	int clusters;
+	int drawn;
+	int culledFrustum;
+	int culledBackface;
+	int draws;      /* ranges after merging neighbours */
+	int triangles;  /* strip triangles submitted, including degenerates */
+	int totalTriangles;
+} ClusterStats;
+
+typedef struct {
+	Bounds bounds;
+	int first;
+	int count;
+} Cluster;
+
+typedef struct ClusterSet {
+	Cluster* clusters;
+	int numClusters;
+	GLsizei* counts;         /* glMultiDrawElements arguments, allocated once */
+	const GLvoid** offsets;
+	ClusterStats stats;
+} ClusterSet;
+
+/*
+Computes clusters from mesh, which must have the same strip as the object
+it is attached to (its positions may differ, eg. shader generated ones).
+*/
+ClusterSet* buildClusters(const Mesh* mesh);
+void freeClusters(ClusterSet* set);
+
+/* Replaces obj's clusters (NULL to remove them), freeing the old set */
+void setObjectClusters(Object* obj, ClusterSet* set);
+
+/* Draws obj's clusters that may be visible from frustum (in object space) */
+void drawClusters(Object* obj, const Frustum* frustum);
+
+#endif
@@ -0,0 +1,271 @@
+/* cull.c */
+
+#include <math.h>
+#include <float.h>
+
+#include "cull.h"
+
+static vector_t vec(float x, float y, float z)
+{
+	vector_t r;
+	r.x = x;
+	r.y = y;
+	r.z = z;
+	return r;
+}
+
+static vector_t sub(vector_t a, vector_t b)
+{
+	return vec(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static float dot(vector_t a, vector_t b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static vector_t cross(vector_t a, vector_t b)
+{
+	return vec(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float length(vector_t a)
+{
+	return sqrtf(dot(a, a));
+}
+
+void frustumFromMatrices(Frustum* frustum, const float* mv, const float* p)
+{
+	float m[16];
+	float len;
+	int i, j, k;
+
+	/* m = p * mv, column major */
+	for (i = 0; i < 4; ++i)
+		for (j = 0; j < 4; ++j)
+		{
+			m[j * 4 + i] = 0.0f;
+			for (k = 0; k < 4; ++k)
+				m[j * 4 + i] += p[k * 4 + i] * mv[j * 4 + k];
+		}
+
+	/* Gribb/Hartmann: each plane is row 3 plus or minus row 0, 1 or 2 */
+	for (i = 0; i < 6; ++i)
+	{
+		float sign = (i & 1) ? -1.0f : 1.0f;
+		int row = i / 2;
+		for (j = 0; j < 4; ++j)
+			frustum->planes[i][j] = m[j * 4 + 3] + sign * m[j * 4 + row];
+		len = sqrtf(frustum->planes[i][0] * frustum->planes[i][0]
+				+ frustum->planes[i][1] * frustum->planes[i][1]
+				+ frustum->planes[i][2] * frustum->planes[i][2]);
+		for (j = 0; j < 4; ++j)
+			frustum->planes[i][j] /= len;
+	}
+
+	/* Eye is the inverse of the (rotation + translation) modelview */
+	frustum->eye.x = -(mv[0] * mv[12] + mv[1] * mv[13] + mv[2] * mv[14]);
+	frustum->eye.y = -(mv[4] * mv[12] + mv[5] * mv[13] + mv[6] * mv[14]);
+	frustum->eye.z = -(mv[8] * mv[12] + mv[9] * mv[13] + mv[10] * mv[14]);
+}
+
+void frustumFromGL(Frustum* frustum)
+{
+	float modelview[16];
+	float projection[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	frustumFromMatrices(frustum, modelview, projection);
+}
+
+int sphereInFrustum(const Frustum* frustum, vector_t c, float radius)
+{
+	int i;
+	for (i = 0; i < 6; ++i)
+	{
+		const float* p = frustum->planes[i];
+		if (p[0] * c.x + p[1] * c.y + p[2] * c.z + p[3] < -radius)
+			return 0;
+	}
+	return 1;
+}
+
+int boxInFrustum(const Frustum* frustum, vector_t min, vector_t max)
+{
+	int i;
+	for (i = 0; i < 6; ++i)
+	{
+		/* Test the corner furthest along the plane normal */
+		const float* p = frustum->planes[i];
+		float x = p[0] > 0.0f ? max.x : min.x;
+		float y = p[1] > 0.0f ? max.y : min.y;
+		float z = p[2] > 0.0f ? max.z : min.z;
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f)
+			return 0;
+	}
+	return 1;
+}
+
+int classifyBox(const Frustum* frustum, vector_t min, vector_t max)
+{
+	int i, result = CULL_INSIDE;
+	for (i = 0; i < 6; ++i)
+	{
+		/* Furthest corner along the normal decides outside, nearest inside */
+		const float* p = frustum->planes[i];
+		float far = p[0] * (p[0] > 0.0f ? max.x : min.x)
+			+ p[1] * (p[1] > 0.0f ? max.y : min.y)
+			+ p[2] * (p[2] > 0.0f ? max.z : min.z) + p[3];
+		float near = p[0] * (p[0] > 0.0f ? min.x : max.x)
+			+ p[1] * (p[1] > 0.0f ? min.y : max.y)
+			+ p[2] * (p[2] > 0.0f ? min.z : max.z) + p[3];
+		if (far < 0.0f)
+			return CULL_OUTSIDE;
+		if (near < 0.0f)
+			result = CULL_INTERSECT;
+	}
+	return result;
+}
+
+int boundsBackfacing(const Bounds* bounds, vector_t eye)
+{
+	vector_t d;
+	float dist, cosTheta, sinTheta;
+
+	if (bounds->coneCos <= 0.0f)
+		return 0;
+
+	/* The nearest any normal in the cone gets to facing the eye is
+	 * theta + alpha, where theta is the angle from the axis to the eye
+	 * direction. Every face is behind the eye if even that normal's face,
+	 * moved anywhere within the sphere, stays facing away. */
+	d = sub(bounds->center, eye);
+	dist = length(d);
+	if (dist <= bounds->radius)
+		return 0;
+	cosTheta = dot(bounds->coneAxis, d) / dist;
+	sinTheta = sqrtf(fmaxf(0.0f, 1.0f - cosTheta * cosTheta));
+	return dist * (cosTheta * bounds->coneCos - sinTheta * bounds->coneSin) > bounds->radius;
+}
+
+static void coneFromAxis(Bounds* bounds, vector_t axis, float minCos, float margin)
+{
+	float len = length(axis);
+	float angle;
+
+	if (len < FLT_EPSILON)
+	{
+		bounds->coneAxis = vec(0.0f, 0.0f, 1.0f);
+		bounds->coneCos = -1.0f;
+		bounds->coneSin = 0.0f;
+		return;
+	}
+	bounds->coneAxis = vec(axis.x / len, axis.y / len, axis.z / len);
+	angle = acosf(fmaxf(-1.0f, fminf(1.0f, minCos))) + margin;
+	bounds->coneCos = cosf(angle);
+	bounds->coneSin = sinf(angle);
+}
+
+static unsigned int fetch(const void* indices, int indexSize, int i)
+{
+	if (indexSize == 2)
+		return ((const unsigned short*)indices)[i];
+	return ((const unsigned int*)indices)[i];
+}
+
+void boundsFromStrip(Bounds* bounds, const vertex_t* vertices,
+		const void* indices, int indexSize, int first, int count)
+{
+	vector_t lo = vec(FLT_MAX, FLT_MAX, FLT_MAX);
+	vector_t hi = vec(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	vector_t axis = vec(0.0f, 0.0f, 0.0f);
+	vector_t n, d;
+	float len, minCos, r2, maxR2 = 0.0f;
+	int i, k;
+
+	/* Sphere around the box of every referenced vertex */
+	for (i = first; i < first + count; ++i)
+	{
+		vector_t p = vertices[fetch(indices, indexSize, i)].vert;
+		lo = vec(fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z));
+		hi = vec(fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z));
+	}
+	bounds->center = vec((lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f);
+	for (i = first; i < first + count; ++i)
+	{
+		d = sub(vertices[fetch(indices, indexSize, i)].vert, bounds->center);
+		r2 = dot(d, d);
+		if (r2 > maxR2)
+			maxR2 = r2;
+	}
+	bounds->radius = sqrtf(maxR2);
+
+	/* Two passes over the face normals: average for the axis, then the
+	 * widest deviation from it */
+	for (k = 0; k < 2; ++k)
+	{
+		minCos = 1.0f;
+		for (i = first; i + 2 < first + count; ++i)
+		{
+			const vertex_t* a = &vertices[fetch(indices, indexSize, i)];
+			const vertex_t* b = &vertices[fetch(indices, indexSize, i + 1)];
+			const vertex_t* c = &vertices[fetch(indices, indexSize, i + 2)];
+			n = cross(sub(b->vert, a->vert), sub(c->vert, a->vert));
+			len = length(n);
+			if (len < FLT_EPSILON)
+				continue; /* degenerate */
+			if (dot(n, a->norm) + dot(n, b->norm) + dot(n, c->norm) < 0.0f)
+				len = -len;
+			n = vec(n.x / len, n.y / len, n.z / len);
+			if (k == 0)
+				axis = vec(axis.x + n.x, axis.y + n.y, axis.z + n.z);
+			else
+				minCos = fminf(minCos, dot(bounds->coneAxis, n));
+		}
+		if (k == 0)
+		{
+			coneFromAxis(bounds, axis, 1.0f, 0.0f);
+			if (bounds->coneCos < 0.0f)
+				return;
+		}
+	}
+	coneFromAxis(bounds, bounds->coneAxis, minCos, 0.0f);
+}
+
+void boundsFromSamples(Bounds* bounds, const vertex_t* samples, int count,
+		float spacing, float angle)
+{
+	vector_t lo = vec(FLT_MAX, FLT_MAX, FLT_MAX);
+	vector_t hi = vec(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	vector_t axis = vec(0.0f, 0.0f, 0.0f);
+	vector_t d;
+	float r2, maxR2 = 0.0f, minCos = 1.0f;
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		vector_t p = samples[i].vert;
+		vector_t n = samples[i].norm;
+		lo = vec(fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z));
+		hi = vec(fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z));
+		axis = vec(axis.x + n.x, axis.y + n.y, axis.z + n.z);
+	}
+	bounds->center = vec((lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f);
+	for (i = 0; i < count; ++i)
+	{
+		d = sub(samples[i].vert, bounds->center);
+		r2 = dot(d, d);
+		if (r2 > maxR2)
+			maxR2 = r2;
+	}
+
+	/* The surface between samples can bulge out by up to a sample spacing */
+	bounds->radius = sqrtf(maxR2) + spacing;
+
+	coneFromAxis(bounds, axis, 1.0f, 0.0f);
+	if (bounds->coneCos < 0.0f)
+		return;
+	for (i = 0; i < count; ++i)
+		minCos = fminf(minCos, dot(bounds->coneAxis, samples[i].norm));
+	coneFromAxis(bounds, bounds->coneAxis, minCos, angle);
+}
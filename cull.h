@@ -0,0 +1,65 @@
+/* cull.h */
+
+#ifndef CULL_H
+#define CULL_H
+
+#include "objects.h"
+
+/* View frustum and eye position, in the space of the current modelview */
+typedef struct {
+	float planes[6][4]; /* normalised, pointing inwards */
+	vector_t eye;
+} Frustum;
+
+/*
+Bounding sphere plus a cone containing every face normal. A cone with
+coneCos <= 0 (90 degrees or wider) can never be entirely back facing.
+*/
+typedef struct {
+	vector_t center;
+	float radius;
+	vector_t coneAxis;
+	float coneCos;
+	float coneSin;
+} Bounds;
+
+/* Builds the frustum from column major GL matrices (camera must be rigid) */
+void frustumFromMatrices(Frustum* frustum, const float* modelview, const float* projection);
+
+/* Builds the frustum from the current GL modelview and projection matrices */
+void frustumFromGL(Frustum* frustum);
+
+enum {
+	CULL_OUTSIDE,
+	CULL_INTERSECT,
+	CULL_INSIDE
+};
+
+int sphereInFrustum(const Frustum* frustum, vector_t center, float radius);
+int boxInFrustum(const Frustum* frustum, vector_t min, vector_t max);
+
+/* As boxInFrustum, but distinguishes boxes entirely inside (CULL_INSIDE) */
+int classifyBox(const Frustum* frustum, vector_t min, vector_t max);
+
+/*
+True if every face inside bounds points away from eye, ie. on a closed
+surface the whole set is hidden behind the front faces.
+*/
+int boundsBackfacing(const Bounds* bounds, vector_t eye);
+
+/*
+Computes bounds of the triangle strip indices[first .. first + count).
+indexSize is sizeof the index type: 2 or 4 bytes. Face normals are
+oriented to agree with the vertex normals.
+*/
+void boundsFromStrip(Bounds* bounds, const vertex_t* vertices,
+		const void* indices, int indexSize, int first, int count);
+
+/*
+Conservative bounds from a set of surface samples (positions and unit
+normals) spaced at most spacing apart and angle radians apart.
+*/
+void boundsFromSamples(Bounds* bounds, const vertex_t* samples, int count,
+		float spacing, float angle);
+
+#endif
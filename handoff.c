@@ -0,0 +1,66 @@
+/* handoff.c */
+
+#include <string.h>
+
+#include "handoff.h"
+#include "resources.h"
+
+#define TRIPLE_FRESH 4
+
+TripleBuffer* createTripleBuffer(size_t size)
+{
+	TripleBuffer* buffer = (TripleBuffer*)resMalloc(sizeof(TripleBuffer), RES_ORIGIN);
+	buffer->slots = (char*)resMalloc(size * 3, RES_ORIGIN);
+	memset(buffer->slots, 0, size * 3);
+	buffer->size = size;
+	buffer->write = 0;
+	buffer->middle = 1;
+	buffer->read = 2;
+	return buffer;
+}
+
+void freeTripleBuffer(TripleBuffer* buffer)
+{
+	resFree(buffer->slots);
+	resFree(buffer);
+}
+
+void triplePublish(TripleBuffer* buffer, const void* data)
+{
+	int old;
+	memcpy(buffer->slots + buffer->write * buffer->size, data, buffer->size);
+
+	/* Release: the copy above is visible before the slot changes hands */
+	old = __atomic_exchange_n(&buffer->middle, buffer->write | TRIPLE_FRESH, __ATOMIC_ACQ_REL);
+	buffer->write = old & ~TRIPLE_FRESH;
+}
+
+const void* tripleLatest(TripleBuffer* buffer, int* fresh)
+{
+	int old;
+	*fresh = 0;
+	if (__atomic_load_n(&buffer->middle, __ATOMIC_ACQUIRE) & TRIPLE_FRESH)
+	{
+		old = __atomic_exchange_n(&buffer->middle, buffer->read, __ATOMIC_ACQ_REL);
+		buffer->read = old & ~TRIPLE_FRESH;
+		*fresh = 1;
+	}
+	return buffer->slots + buffer->read * buffer->size;
+}
+
+void* mailboxPost(Mailbox* box, void* item)
+{
+	return __atomic_exchange_n(&box->item, item, __ATOMIC_ACQ_REL);
+}
+
+void* mailboxTake(Mailbox* box)
+{
+	if (!__atomic_load_n(&box->item, __ATOMIC_ACQUIRE))
+		return NULL;
+	return __atomic_exchange_n(&box->item, NULL, __ATOMIC_ACQ_REL);
+}
+
+int mailboxPending(Mailbox* box)
+{
+	return __atomic_load_n(&box->item, __ATOMIC_ACQUIRE) != NULL;
+}
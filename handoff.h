@@ -0,0 +1,51 @@
+/* handoff.h */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+
+/*
+Lock-free handoff from the simulation (main) thread to the render thread.
+Each structure has exactly one producer and one consumer.
+
+TripleBuffer: the producer publishes a copy of its state whenever it
+likes; the consumer always reads the newest complete copy. Neither side
+ever waits for the other.
+
+Mailbox: a single slot where a newer item replaces one not yet taken. The
+producer gets the replaced item back to free. Used for geometry uploads,
+where only the newest build matters.
+*/
+typedef struct {
+	char* slots;
+	size_t size;
+	int write;  /* producer's slot */
+	int read;   /* consumer's slot */
+	int middle; /* last published slot, | TRIPLE_FRESH until taken */
+} TripleBuffer;
+
+typedef struct {
+	void* item;
+} Mailbox;
+
+TripleBuffer* createTripleBuffer(size_t size);
+void freeTripleBuffer(TripleBuffer* buffer);
+
+/* Producer: copies data (size bytes) into the buffer and publishes it */
+void triplePublish(TripleBuffer* buffer, const void* data);
+
+/* Consumer: the newest published copy; fresh is set if it wasn't seen before */
+const void* tripleLatest(TripleBuffer* buffer, int* fresh);
+
+/* Producer: returns the item that was replaced, or NULL */
+void* mailboxPost(Mailbox* box, void* item);
+
+/* Consumer: returns the newest item, or NULL if nothing new. The producer
+ * may call it too, to withdraw an item not yet taken. */
+void* mailboxTake(Mailbox* box);
+
+/* Producer: non-zero while the last item posted hasn't been taken */
+int mailboxPending(Mailbox* box);
+
+#endif
@@ -0,0 +1,131 @@
+/* impostor.c */
+
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "impostor.h"
+#include "shaders.h"
+#include "resources.h"
+
+/* Keeps the quad clear of the near plane */
+#define NEAR_MARGIN 1.01f
+
+Impostor* createImpostor()
+{
+	Impostor* impostor = (Impostor*)resMalloc(sizeof(Impostor), RES_ORIGIN);
+	impostor->program = resTrackProgram(getShader("impostor.vert", "impostor.frag"), RES_ORIGIN);
+	impostor->uniform.shape = glGetUniformLocation(impostor->program, "shape");
+	impostor->uniform.radii = glGetUniformLocation(impostor->program, "radii");
+	impostor->fullWindow = 0;
+	return impostor;
+}
+
+void freeImpostor(Impostor* impostor)
+{
+	resDeleteProgram(impostor->program);
+	resFree(impostor);
+}
+
+float impostorBounds(ImpostorShape shape, float major, float minor)
+{
+	return shape == IMPOSTOR_TORUS ? major + minor : major;
+}
+
+static void normalize3(float* v)
+{
+	float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	v[0] /= length;
+	v[1] /= length;
+	v[2] /= length;
+}
+
+/* The near plane, just past the near clip distance, at the window's corners */
+static void windowQuad(Impostor* impostor, const float* projection)
+{
+	static const float corners[4][2] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+	float depth = NEAR_MARGIN * projection[14] / (projection[10] - 1.0f);
+	int i;
+
+	for (i = 0; i < 4; ++i)
+	{
+		impostor->quad[i][0] = (corners[i][0] + projection[8]) * depth / projection[0];
+		impostor->quad[i][1] = (corners[i][1] + projection[9]) * depth / projection[5];
+		impostor->quad[i][2] = -depth;
+	}
+	impostor->fullWindow = 1;
+}
+
+void impostorQuad(Impostor* impostor, const float* modelview, const float* projection, float radius)
+{
+	static const float signs[4][2] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+	float near = projection[14] / (projection[10] - 1.0f);
+	float center[3], u[3], v[3], distance, half;
+	int i, j;
+
+	center[0] = modelview[12];
+	center[1] = modelview[13];
+	center[2] = modelview[14];
+	distance = sqrtf(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+	if (distance <= radius * NEAR_MARGIN)
+	{
+		windowQuad(impostor, projection);
+		return;
+	}
+
+	/* The sphere subtends asin(radius / distance) from the eye; at the
+	 * center's distance that cone is a circle this wide */
+	half = radius * distance / sqrtf(distance * distance - radius * radius);
+
+	/* Any two axes perpendicular to the line of sight */
+	if (fabsf(center[1]) < 0.9f * distance)
+	{
+		u[0] = -center[2]; u[1] = 0.0f; u[2] = center[0];      /* line x (0, 1, 0) */
+	}
+	else
+	{
+		u[0] = 0.0f; u[1] = center[2]; u[2] = -center[1];      /* line x (1, 0, 0) */
+	}
+	normalize3(u);
+	v[0] = center[1] * u[2] - center[2] * u[1];
+	v[1] = center[2] * u[0] - center[0] * u[2];
+	v[2] = center[0] * u[1] - center[1] * u[0];
+	normalize3(v);
+
+	for (i = 0; i < 4; ++i)
+	{
+		for (j = 0; j < 3; ++j)
+			impostor->quad[i][j] = center[j] + half * (signs[i][0] * u[j] + signs[i][1] * v[j]);
+		if (impostor->quad[i][2] > -near * NEAR_MARGIN)
+		{
+			windowQuad(impostor, projection);
+			return;
+		}
+	}
+	impostor->fullWindow = 0;
+}
+
+void drawImpostor(Impostor* impostor, ImpostorShape shape, float major, float minor)
+{
+	float modelview[16], projection[16];
+	int i;
+
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	impostorQuad(impostor, modelview, projection, impostorBounds(shape, major, minor));
+
+	glUseProgram(impostor->program);
+	glUniform1i(impostor->uniform.shape, shape);
+	glUniform2f(impostor->uniform.radii, major, minor);
+
+	/* Every covered pixel is cast, even in wireframe */
+	glPushAttrib(GL_POLYGON_BIT);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glBegin(GL_QUADS);
+		for (i = 0; i < 4; ++i)
+			glVertex3fv(impostor->quad[i]);
+	glEnd();
+	glPopAttrib();
+
+	glUseProgram(0);
+}
@@ -0,0 +1,205 @@
+// impostor.frag
+// ray casts the object the quad covers: a sphere (quadratic) or a torus
+// about z (quartic), in object space. Writes the hit's depth, so it
+// composites with everything else, and lights it per pixel as shader.frag
+// does with its single directional light.
+
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+#include "blocks.glsl"
+
+/* shape, numbered as mesh-generation.vert's objects:
+ *  0 = torus
+ *  1 = sphere
+ */
+uniform int shape;
+
+uniform vec2 radii; // torus major, minor; sphere radius, unused
+
+varying vec3 ray;
+
+float cubeRoot(float x)
+{
+	return sign(x) * pow(abs(x), 1.0 / 3.0);
+}
+
+// largest real root of x^3 + a x^2 + b x + c
+float cubicRoot(float a, float b, float c)
+{
+	float p = b - a * a / 3.0;
+	float q = 2.0 * a * a * a / 27.0 - a * b / 3.0 + c;
+	float h = q * q / 4.0 + p * p * p / 27.0;
+	float x;
+
+	if (h >= 0.0) {
+		h = sqrt(h);
+		x = cubeRoot(-q / 2.0 + h) + cubeRoot(-q / 2.0 - h);
+	} else {
+		// three real roots: trigonometric, the first is the largest
+		float m = sqrt(-p / 3.0);
+		x = 2.0 * m * cos(acos(clamp(-q / (2.0 * m * m * m), -1.0, 1.0)) / 3.0);
+	}
+	x -= a / 3.0;
+
+	// one Newton step recovers what cancellation lost
+	float df = (3.0 * x + 2.0 * a) * x + b;
+	if (df != 0.0)
+		x -= (((x + a) * x + b) * x + c) / df;
+	return x;
+}
+
+// t if it is in front and nearer than best (negative for none yet)
+float nearer(float best, float t)
+{
+	return t > 0.0 && (best < 0.0 || t < best) ? t : best;
+}
+
+// roots of y^2 + b y + c, shifted by s, folded into best
+float quadraticRoots(float best, float b, float c, float s)
+{
+	float h = b * b / 4.0 - c;
+	if (h < 0.0)
+		return best;
+	h = sqrt(h);
+	best = nearer(best, -b / 2.0 - h - s);
+	return nearer(best, -b / 2.0 + h - s);
+}
+
+// smallest positive root of t^4 + c3 t^3 + c2 t^2 + c1 t + c0, or -1 (Ferrari)
+float quarticRoot(float c3, float c2, float c1, float c0)
+{
+	// t = y - s removes the cubic term: y^4 + p y^2 + q y + r
+	float s = c3 / 4.0;
+	float p = c2 - 6.0 * s * s;
+	float q = c1 - 2.0 * c2 * s + 8.0 * s * s * s;
+	float r = c0 - c1 * s + c2 * s * s - 3.0 * s * s * s * s;
+
+	// the resolvent's root m >= 0 splits it into two quadratics:
+	// (y^2 + p/2 + m)^2 = (w y - u)^2 with w = sqrt(2 m), u = q / (2 w).
+	// u is taken from m^2 + p m + p^2/4 - r = u^2 instead, which stays
+	// exact as m and q go to 0 together
+	float m = max(cubicRoot(p, p * p / 4.0 - r, -q * q / 8.0), 0.0);
+	float w = sqrt(2.0 * m);
+	float u = sign(q) * sqrt(max((p / 2.0 + m) * (p / 2.0 + m) - r, 0.0));
+
+	float t = -1.0;
+	t = quadraticRoots(t, -w, p / 2.0 + m + u, s);
+	t = quadraticRoots(t,  w, p / 2.0 + m - u, s);
+	if (t < 0.0)
+		return t;
+
+	// polish against the original polynomial
+	for (int i = 0; i < 2; ++i) {
+		float f = (((t + c3) * t + c2) * t + c1) * t + c0;
+		float df = ((4.0 * t + 3.0 * c3) * t + 2.0 * c2) * t + c1;
+		if (df != 0.0)
+			t -= f / df;
+	}
+	return t;
+}
+
+// distance along the unit ray o + t d to a sphere at the origin, or -1
+float sphereHit(vec3 o, vec3 d, float radius)
+{
+	float b = dot(o, d);
+	float h = b * b - dot(o, o) + radius * radius;
+	if (h < 0.0)
+		return -1.0;
+	h = sqrt(h);
+	return -b - h > 0.0 ? -b - h : -b + h;
+}
+
+// distance along the unit ray o + t d to a torus about z, or -1
+float torusHit(vec3 o, vec3 d, float major, float minor)
+{
+	// start near the bounding sphere, keeping the coefficients small. The
+	// outer equator touches it, so a little before, or rounding could put
+	// those hits behind the start
+	float b = dot(o, d);
+	float h = b * b - dot(o, o) + (major + minor) * (major + minor);
+	if (h < 0.0 || -b + sqrt(h) < 0.0)
+		return -1.0;
+	float start = max(-b - sqrt(h) - minor, 0.0);
+	o += start * d;
+
+	// (|p|^2 + R^2 - r^2)^2 = 4 R^2 (x^2 + y^2) along p = o + t d
+	float k = 4.0 * major * major;
+	float a = dot(o, d);
+	float e = dot(o, o) + major * major - minor * minor;
+	float t = quarticRoot(
+			4.0 * a,
+			4.0 * a * a + 2.0 * e - k * (d.x * d.x + d.y * d.y),
+			4.0 * a * e - 2.0 * k * (o.x * d.x + o.y * d.y),
+			e * e - k * (o.x * o.x + o.y * o.y));
+	return t < 0.0 ? t : start + t;
+}
+
+void main(void)
+{
+	const int Torus  = 0;
+
+	const int Phong = 0;
+
+	// the camera and the ray in object space; the modelview doesn't scale,
+	// so distances are the same in both
+	vec3 origin = vec3(gl_ModelViewMatrixInverse * vec4(0.0, 0.0, 0.0, 1.0));
+	vec3 direction = normalize(vec3(gl_ModelViewMatrixInverse * vec4(ray, 0.0)));
+
+	float t = shape == Torus ?
+		torusHit(origin, direction, radii.x, radii.y) :
+		sphereHit(origin, direction, radii.x);
+	if (t < 0.0)
+		discard;
+
+	vec3 hit = origin + t * direction;
+	vec3 normal = shape == Torus ?
+		hit - radii.x * normalize(vec3(hit.xy, 0.0)) :
+		hit;
+	normal = normalize(gl_NormalMatrix * normal);
+
+	// eye space, then window depth as the rasterizer would have made it
+	vec3 position = normalize(ray) * t;
+	vec4 clip = gl_ProjectionMatrix * vec4(position, 1.0);
+	gl_FragDepth = 0.5 * (gl_DepthRange.diff * clip.z / clip.w
+			+ gl_DepthRange.near + gl_DepthRange.far);
+
+	vec3 eye = isLocalViewer ? normalize(position) : vec3(0.0, 0.0, -1.0);
+
+	vec4 color = vec4(0.0);
+
+	// already transformed into eye space coordinates by modelview matrix
+	vec3 light = normalize(vec3(lightPosition));
+
+	// compute diffuse scalar
+	float NdotL = max(dot(normal, light), 0.0);
+
+	// add global and light ambient
+	color += materialAmbient * (sceneAmbient + lightAmbient);
+
+	if (NdotL > 0.0)
+	{
+		// add diffuse component
+		color += NdotL * materialDiffuse * lightDiffuse;
+
+		// add specular color depending on light model
+		if (lightingModel == Phong) {
+
+			// calculate reflection vector
+			vec3 reflection = reflect(light, normal);
+			float RdotE = max(dot(reflection, eye), 0.0);
+
+			color += pow(RdotE, materialShininess) *
+				lightSpecular * materialSpecular;
+
+		} else /* lightingModel == BlinnPhong */ {
+
+			float NdotHV = max(dot(normal, lightHalfVector.xyz), 0.0);
+			color += materialSpecular * lightSpecular *
+				pow(NdotHV, materialShininess);
+
+		}
+	}
+
+	gl_FragColor = color;
+}
@@ -0,0 +1,59 @@
+/* impostor.h */
+
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+/* For vertex buffer objects */
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+
+/*
+Draws a torus or sphere with no mesh: one quad covering the object's
+bounding sphere on screen, and a fragment shader (impostor.frag) that
+intersects each pixel's ray with the surface itself, solving the sphere's
+quadratic or the torus's quartic. Silhouettes are exact at any distance,
+for four vertices, and gl_FragDepth is written so the result depth tests
+against everything else.
+
+The object sits at the modelview's origin, with no scale; the torus is
+the one parametricTorus() makes, about z. Lighting is shader.frag's
+directional light, per pixel, from the light, material and frame uniform
+blocks (blocks.h); point lights aren't applied.
+
+The quad is perpendicular to the line of sight to the object and sized so
+the cone of rays through it holds the whole sphere. When the camera is
+inside the bounding sphere, or the quad would cross the near plane, it
+covers the window instead.
+*/
+typedef enum {
+	IMPOSTOR_TORUS,   /* numbered as impostor.frag's shape uniform */
+	IMPOSTOR_SPHERE
+} ImpostorShape;
+
+typedef struct {
+	GLuint program;
+	struct {
+		GLint shape;
+		GLint radii;
+	} uniform;
+	float quad[4][3];  /* eye space corners of the last quad */
+	int fullWindow;    /* the last quad covered the window */
+} Impostor;
+
+Impostor* createImpostor();
+void freeImpostor(Impostor* impostor);
+
+/*
+Uses the current modelview and projection, and the uniform blocks as last
+set. minor is ignored for the sphere. Leaves no program bound.
+*/
+void drawImpostor(Impostor* impostor, ImpostorShape shape, float major, float minor);
+
+/* The radius of the sphere holding the shape */
+float impostorBounds(ImpostorShape shape, float major, float minor);
+
+/* Fills impostor->quad for a bounding sphere at the modelview's origin */
+void impostorQuad(Impostor* impostor, const float* modelview, const float* projection, float radius);
+
+#endif
@@ -0,0 +1,11 @@
+// impostor vertex shader
+// the quad is built on the CPU already in eye space (see impostor.h), the
+// modelview matrix is left as the object's so impostor.frag can invert it
+
+varying vec3 ray; // eye space point on the quad, the ray passes through it
+
+void main(void)
+{
+	ray = gl_Vertex.xyz;
+	gl_Position = gl_ProjectionMatrix * gl_Vertex;
+}
@@ -0,0 +1,115 @@
+/* jobs.c */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <unistd.h>
+#include <SDL/SDL.h>
+
+#include "jobs.h"
+#include "resources.h"
+
+struct JobPool {
+	SDL_Thread* threads[JOB_MAX_THREADS];
+	int numThreads;
+	SDL_sem* start;   /* posted once per worker for each batch */
+	SDL_sem* done;    /* posted by each worker when the batch runs dry */
+	SDL_mutex* lock;  /* guards next */
+	JobFunc func;
+	void* data;
+	int count;
+	int next;
+	int quit;
+};
+
+/* Takes jobs until none are left. Jobs are coarse, so a mutex is cheap enough. */
+static void work(JobPool* pool)
+{
+	int index;
+	for (;;)
+	{
+		SDL_LockMutex(pool->lock);
+		index = pool->next++;
+		SDL_UnlockMutex(pool->lock);
+		if (index >= pool->count)
+			return;
+		pool->func(pool->data, index);
+	}
+}
+
+static int worker(void* data)
+{
+	JobPool* pool = (JobPool*)data;
+	for (;;)
+	{
+		SDL_SemWait(pool->start);
+		if (pool->quit)
+			return 0;
+		work(pool);
+		SDL_SemPost(pool->done);
+	}
+}
+
+JobPool* createJobPool(int threads)
+{
+	JobPool* pool = (JobPool*)resMalloc(sizeof(JobPool), RES_ORIGIN);
+	int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+#endif
+	if (threads < 0)
+		threads = 0;
+	if (threads > JOB_MAX_THREADS)
+		threads = JOB_MAX_THREADS;
+
+	pool->start = SDL_CreateSemaphore(0);
+	pool->done = SDL_CreateSemaphore(0);
+	pool->lock = SDL_CreateMutex();
+	pool->count = pool->next = 0;
+	pool->quit = 0;
+	pool->numThreads = 0;
+	for (i = 0; i < threads; ++i)
+	{
+		pool->threads[i] = SDL_CreateThread(worker, pool);
+		if (!pool->threads[i])
+			break;
+		pool->numThreads++;
+	}
+	return pool;
+}
+
+void freeJobPool(JobPool* pool)
+{
+	int i;
+	pool->quit = 1;
+	for (i = 0; i < pool->numThreads; ++i)
+		SDL_SemPost(pool->start);
+	for (i = 0; i < pool->numThreads; ++i)
+		SDL_WaitThread(pool->threads[i], NULL);
+	SDL_DestroySemaphore(pool->start);
+	SDL_DestroySemaphore(pool->done);
+	SDL_DestroyMutex(pool->lock);
+	resFree(pool);
+}
+
+void runJobs(JobPool* pool, JobFunc func, void* data, int count)
+{
+	int i;
+
+	/* The semaphores order these writes before the workers read them */
+	pool->func = func;
+	pool->data = data;
+	pool->count = count;
+	pool->next = 0;
+	for (i = 0; i < pool->numThreads; ++i)
+		SDL_SemPost(pool->start);
+	work(pool);
+	for (i = 0; i < pool->numThreads; ++i)
+		SDL_SemWait(pool->done);
+}
+
+int jobPoolThreads(const JobPool* pool)
+{
+	return pool->numThreads + 1;
+}
@@ -0,0 +1,28 @@
+/* jobs.h */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+/*
+A fixed pool of worker threads for data parallel loops. runJobs() calls
+func(data, i) for every i in [0, count), spread over the workers and the
+calling thread, and returns once all of them have finished. Jobs must not
+touch GL, which isn't thread safe. The resource registry is, but each call
+takes its lock, serialising the workers: allocate before runJobs().
+*/
+#define JOB_MAX_THREADS 16
+
+typedef void (*JobFunc)(void* data, int index);
+
+typedef struct JobPool JobPool;
+
+/* threads is the number of workers besides the caller, 0 for one per extra CPU */
+JobPool* createJobPool(int threads);
+void freeJobPool(JobPool* pool);
+
+void runJobs(JobPool* pool, JobFunc func, void* data, int count);
+
+/* Workers plus the calling thread */
+int jobPoolThreads(const JobPool* pool);
+
+#endif
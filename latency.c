@@ -0,0 +1,179 @@
+/* latency.c */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "latency.h"
+#include "bench.h"
+
+#define WAIT_TIMEOUT_NS 1000000000ull /* give up on a frame after a second */
+
+/* Frames swapped but not yet finished, oldest first */
+typedef struct {
+	GLsync fence;
+	double stamp; /* 0: the frame reflected no new input */
+} Pending;
+
+static Pending pending[LATENCY_MAX_IN_FLIGHT + 1];
+static int numPending = 0;
+static int hasSync = 0;
+static double frameStamp = 0.0;
+static LatencyStats stats;
+
+void latencyInit(int maxInFlight)
+{
+	hasSync = GLEW_ARB_sync;
+	if (!hasSync)
+		printf("ARB_sync not supported: latency is measured with glFinish\n");
+	latencySetMaxInFlight(maxInFlight);
+	latencyReset();
+}
+
+void latencyFree()
+{
+	int i;
+	for (i = 0; i < numPending; ++i)
+		glDeleteSync(pending[i].fence);
+	numPending = 0;
+	stats.inFlight = 0;
+}
+
+void latencySetMaxInFlight(int maxInFlight)
+{
+	if (maxInFlight < 1)
+		maxInFlight = 1;
+	if (maxInFlight > LATENCY_MAX_IN_FLIGHT)
+		maxInFlight = LATENCY_MAX_IN_FLIGHT;
+	stats.maxInFlight = maxInFlight;
+}
+
+void latencyAttach(double stamp)
+{
+	/* Several inputs in one frame: the oldest waited longest */
+	if (frameStamp == 0.0 || stamp < frameStamp)
+		frameStamp = stamp;
+}
+
+static void addSample(double ms)
+{
+	int bucket = (int)(ms / LATENCY_BUCKET_MS);
+	if (bucket < 0)
+		bucket = 0;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	stats.counts[bucket]++;
+	if (stats.samples == 0 || ms < stats.min)
+		stats.min = ms;
+	if (stats.samples == 0 || ms > stats.max)
+		stats.max = ms;
+	stats.samples++;
+	stats.total += ms;
+}
+
+/* Retires the oldest pending frame, finished unless its wait timed out */
+static void retire(double now, int finished)
+{
+	if (pending[0].stamp != 0.0)
+	{
+		if (finished)
+			addSample(now - pending[0].stamp);
+		else
+			stats.timeouts++;
+	}
+	glDeleteSync(pending[0].fence);
+	memmove(pending, pending + 1, sizeof(Pending) * --numPending);
+}
+
+void latencySwapped()
+{
+	GLenum status;
+	double start;
+
+	if (!hasSync)
+	{
+		glFinish();
+		if (frameStamp != 0.0)
+			addSample(benchNow() - frameStamp);
+		frameStamp = 0.0;
+		return;
+	}
+
+	pending[numPending].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pending[numPending].stamp = frameStamp;
+	numPending++;
+	frameStamp = 0.0;
+
+	/* Whatever has finished since the last swap */
+	while (numPending > 0)
+	{
+		status = glClientWaitSync(pending[0].fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		retire(benchNow(), 1);
+	}
+
+	/* Don't start another frame until one of the limit has finished */
+	start = benchNow();
+	while (numPending >= stats.maxInFlight)
+	{
+		status = glClientWaitSync(pending[0].fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT_NS);
+		retire(benchNow(), status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED);
+	}
+	stats.waitMs += benchNow() - start;
+	stats.inFlight = numPending;
+}
+
+void latencyReset()
+{
+	memset(stats.counts, 0, sizeof stats.counts);
+	stats.samples = 0;
+	stats.min = 0.0;
+	stats.max = 0.0;
+	stats.total = 0.0;
+	stats.timeouts = 0;
+	stats.waitMs = 0.0;
+}
+
+const LatencyStats* latencyStats()
+{
+	return &stats;
+}
+
+double latencyPercentile(double p)
+{
+	long target = (long)(p * stats.samples + 0.5), seen = 0;
+	int i;
+
+	if (stats.samples == 0)
+		return 0.0;
+
+	for (i = 0; i < LATENCY_BUCKETS - 1; ++i)
+	{
+		seen += stats.counts[i];
+		if (seen >= target)
+			return (i + 1) * LATENCY_BUCKET_MS;
+	}
+	return stats.max;
+}
+
+void latencyFormatHistogram(char* buffer, size_t size)
+{
+	const char ramp[] = " .:-=+*#%@";
+	const int levels = sizeof ramp - 2;
+	long most = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; ++i)
+		if (stats.counts[i] > most)
+			most = stats.counts[i];
+	for (i = 0; i < LATENCY_BUCKETS && i + 1 < (int)size; ++i)
+	{
+		/* Any sample at all shows, however rare */
+		int level = most ? (int)((stats.counts[i] * levels + most - 1) / most) : 0;
+		buffer[i] = ramp[level];
+	}
+	if (size > 0)
+		buffer[i] = '\0';
+}
@@ -0,0 +1,65 @@
+/* latency.h */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+
+/*
+Motion-to-photon latency: the time from an input event arriving to the
+first frame that reflects it being finished by the GPU.
+
+The frame being drawn is given the input's benchNow() stamp with
+latencyAttach(). After the buffers are swapped, latencySwapped() puts a
+fence sync behind the frame. Fences are polled after every swap, so a
+sample can read up to one frame late unless frames in flight is 1.
+
+The same fences bound how far the CPU may run ahead of the GPU: once
+maxInFlight frames are unfinished, latencySwapped() waits for the oldest.
+Fewer frames in flight trade throughput for latency. A frame that still
+isn't finished after a second's wait is given up on: it's counted in
+timeouts, not sampled.
+
+Without ARB_sync every frame is finished with glFinish instead.
+*/
+#define LATENCY_MAX_IN_FLIGHT 4
+#define LATENCY_BUCKETS 32
+#define LATENCY_BUCKET_MS 2.0 /* the last bucket holds everything above */
+
+typedef struct {
+	long counts[LATENCY_BUCKETS];
+	long samples;
+	double min;
+	double max;
+	double total;
+	long timeouts;   /* frames given up on, not in the samples */
+	int inFlight;    /* frames swapped but not finished */
+	int maxInFlight;
+	double waitMs;   /* time spent waiting on the limit since reset */
+} LatencyStats;
+
+/* Call once the GL context exists */
+void latencyInit(int maxInFlight);
+void latencyFree();
+
+void latencySetMaxInFlight(int maxInFlight);
+
+/* The frame being drawn reflects input that arrived at stamp (benchNow()) */
+void latencyAttach(double stamp);
+
+/* Call straight after swapping buffers, on the thread that drew the frame */
+void latencySwapped();
+
+/* Clears the histogram, eg. between benchmark steps */
+void latencyReset();
+
+const LatencyStats* latencyStats();
+
+/* Upper edge of the bucket holding fraction p (0-1) of the samples, or 0
+ * if there are none */
+double latencyPercentile(double p);
+
+/* The histogram as one character per bucket, for the OSD */
+void latencyFormatHistogram(char* buffer, size_t size);
+
+#endif
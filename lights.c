@@ -0,0 +1,273 @@
+/* lights.c */
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "lights.h"
+#include "resources.h"
+#include "bench.h"
+
+#define GRID_TILES (LIGHT_GRID_X * LIGHT_GRID_Y)
+
+/* Lights overlapping one depth slice, padded to a multiple of four */
+struct LightSlice {
+	float x[LIGHT_MAX + 3];
+	float y[LIGHT_MAX + 3];
+	float z[LIGHT_MAX + 3];
+	float r2[LIGHT_MAX + 3];
+	int index[LIGHT_MAX + 3];
+	int count;
+	int refs;
+	int maxPerCluster;
+	int overflow;
+};
+
+static GLuint createTexture(GLint internalFormat, int width, int height,
+		GLenum format, size_t texelSize)
+{
+	GLuint texture = resGenTexture(RES_ORIGIN);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	resTexImage2D(texture, internalFormat, width, height, format, GL_FLOAT, NULL, texelSize);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+LightSystem* createLightSystem()
+{
+	LightSystem* system = (LightSystem*)resMalloc(sizeof(LightSystem), RES_ORIGIN);
+	memset(system, 0, sizeof(LightSystem));
+
+	system->lightData = (float*)resMalloc(sizeof(float) * 4 * LIGHT_MAX * 2, RES_ORIGIN);
+	system->grid = (float*)resMalloc(sizeof(float) * 2 * GRID_TILES * LIGHT_GRID_Z, RES_ORIGIN);
+	system->indices = (float*)resMalloc(sizeof(float) * LIGHT_INDEX_SIZE * LIGHT_INDEX_SIZE, RES_ORIGIN);
+	system->sliceRefs = (float*)resMalloc(sizeof(float) * LIGHT_SLICE_REFS * LIGHT_GRID_Z, RES_ORIGIN);
+	system->slices = (LightSlice*)resMalloc(sizeof(LightSlice) * LIGHT_GRID_Z, RES_ORIGIN);
+	memset(system->lightData, 0, sizeof(float) * 4 * LIGHT_MAX * 2);
+	system->pool = createJobPool(0);
+
+	system->lightTexture = createTexture(GL_RGBA32F_ARB, LIGHT_MAX, 2, GL_RGBA, sizeof(float) * 4);
+	system->gridTexture = createTexture(GL_LUMINANCE_ALPHA32F_ARB, GRID_TILES, LIGHT_GRID_Z,
+			GL_LUMINANCE_ALPHA, sizeof(float) * 2);
+	system->indexTexture = createTexture(GL_LUMINANCE32F_ARB, LIGHT_INDEX_SIZE, LIGHT_INDEX_SIZE,
+			GL_LUMINANCE, sizeof(float));
+	return system;
+}
+
+void freeLightSystem(LightSystem* system)
+{
+	freeJobPool(system->pool);
+	resDeleteTexture(system->lightTexture);
+	resDeleteTexture(system->gridTexture);
+	resDeleteTexture(system->indexTexture);
+	resFree(system->lightData);
+	resFree(system->grid);
+	resFree(system->indices);
+	resFree(system->sliceRefs);
+	resFree(system->slices);
+	resFree(system);
+}
+
+/* Eye space depth (positive) of the near side of slice z */
+static float sliceDepth(const LightSystem* system, int z)
+{
+	return system->near * powf(system->far / system->near, (float)z / LIGHT_GRID_Z);
+}
+
+/* Appends to refs the candidates whose sphere touches the box lo-hi */
+static int binCluster(LightSlice* slice, const float* lo, const float* hi, float* refs, int space)
+{
+	int i, count = 0;
+#ifdef __SSE__
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 loX = _mm_set1_ps(lo[0]), hiX = _mm_set1_ps(hi[0]);
+	const __m128 loY = _mm_set1_ps(lo[1]), hiY = _mm_set1_ps(hi[1]);
+	const __m128 loZ = _mm_set1_ps(lo[2]), hiZ = _mm_set1_ps(hi[2]);
+
+	for (i = 0; i < slice->count; i += 4)
+	{
+		/* Distance from each centre to the box, per axis */
+		__m128 x = _mm_loadu_ps(slice->x + i);
+		__m128 y = _mm_loadu_ps(slice->y + i);
+		__m128 z = _mm_loadu_ps(slice->z + i);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(loX, x), _mm_sub_ps(x, hiX)), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(loY, y), _mm_sub_ps(y, hiY)), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(loZ, z), _mm_sub_ps(z, hiZ)), zero);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_loadu_ps(slice->r2 + i)));
+		int lane;
+		for (lane = 0; mask; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1))
+				continue;
+			if (count == space)
+			{
+				slice->overflow++;
+				continue;
+			}
+			refs[count++] = (float)slice->index[i + lane];
+		}
+	}
+#else
+	for (i = 0; i < slice->count; ++i)
+	{
+		float dx = fmaxf(fmaxf(lo[0] - slice->x[i], slice->x[i] - hi[0]), 0.0f);
+		float dy = fmaxf(fmaxf(lo[1] - slice->y[i], slice->y[i] - hi[1]), 0.0f);
+		float dz = fmaxf(fmaxf(lo[2] - slice->z[i], slice->z[i] - hi[2]), 0.0f);
+		if (dx * dx + dy * dy + dz * dz > slice->r2[i])
+			continue;
+		if (count == space)
+		{
+			slice->overflow++;
+			continue;
+		}
+		refs[count++] = (float)slice->index[i];
+	}
+#endif
+	return count;
+}
+
+/* Job: bins every cluster of depth slice z into its own part of sliceRefs */
+static void binSlice(void* data, int z)
+{
+	LightSystem* system = (LightSystem*)data;
+	LightSlice* slice = &system->slices[z];
+	float* refs = system->sliceRefs + z * LIGHT_SLICE_REFS;
+	float* grid = system->grid + z * GRID_TILES * 2;
+	float dn = sliceDepth(system, z);
+	float df = sliceDepth(system, z + 1);
+	float lo[3], hi[3];
+	int i, x, y, count;
+
+	/* Lights whose depth range overlaps the slice */
+	slice->count = slice->refs = slice->maxPerCluster = slice->overflow = 0;
+	for (i = 0; i < system->numLights; ++i)
+	{
+		const float* light = system->lightData + i * 4;
+		float depth = -light[2];
+		if (depth + light[3] < dn || depth - light[3] > df)
+			continue;
+		slice->x[slice->count] = light[0];
+		slice->y[slice->count] = light[1];
+		slice->z[slice->count] = light[2];
+		slice->r2[slice->count] = light[3] * light[3];
+		slice->index[slice->count] = i;
+		slice->count++;
+	}
+	for (i = slice->count; i & 3; ++i)
+	{
+		slice->x[i] = slice->y[i] = slice->z[i] = 0.0f;
+		slice->r2[i] = -1.0f; /* never within range */
+		slice->index[i] = 0;
+	}
+
+	lo[2] = -df;
+	hi[2] = -dn;
+	for (y = 0; y < LIGHT_GRID_Y; ++y)
+	{
+		/* Tile edges in NDC scale with depth; take the box over the slice */
+		float y0 = -1.0f + 2.0f * y / LIGHT_GRID_Y;
+		float y1 = -1.0f + 2.0f * (y + 1) / LIGHT_GRID_Y;
+		lo[1] = fminf(y0 * dn, y0 * df) / system->projY;
+		hi[1] = fmaxf(y1 * dn, y1 * df) / system->projY;
+		for (x = 0; x < LIGHT_GRID_X; ++x)
+		{
+			float x0 = -1.0f + 2.0f * x / LIGHT_GRID_X;
+			float x1 = -1.0f + 2.0f * (x + 1) / LIGHT_GRID_X;
+			lo[0] = fminf(x0 * dn, x0 * df) / system->projX;
+			hi[0] = fmaxf(x1 * dn, x1 * df) / system->projX;
+
+			count = slice->count ? binCluster(slice, lo, hi, refs + slice->refs,
+					LIGHT_SLICE_REFS - slice->refs) : 0;
+			grid[(y * LIGHT_GRID_X + x) * 2] = (float)slice->refs;
+			grid[(y * LIGHT_GRID_X + x) * 2 + 1] = (float)count;
+			slice->refs += count;
+			if (count > slice->maxPerCluster)
+				slice->maxPerCluster = count;
+		}
+	}
+}
+
+void updateLights(LightSystem* system, const float* mv, const float* p,
+		float near, float far)
+{
+	double start = benchNow();
+	LightStats* stats = &system->stats;
+	int i, z, base, rows;
+
+	system->projX = p[0];
+	system->projY = p[5];
+	system->near = near;
+	system->far = far;
+
+	/* Eye space positions and colours, as the shader reads them */
+	for (i = 0; i < system->numLights; ++i)
+	{
+		const Light* light = &system->lights[i];
+		const vector_t* w = &light->position;
+		float* eye = system->lightData + i * 4;
+		float* color = system->lightData + (LIGHT_MAX + i) * 4;
+		eye[0] = mv[0] * w->x + mv[4] * w->y + mv[8] * w->z + mv[12];
+		eye[1] = mv[1] * w->x + mv[5] * w->y + mv[9] * w->z + mv[13];
+		eye[2] = mv[2] * w->x + mv[6] * w->y + mv[10] * w->z + mv[14];
+		eye[3] = light->radius;
+		color[0] = light->color[0];
+		color[1] = light->color[1];
+		color[2] = light->color[2];
+	}
+
+	runJobs(system->pool, binSlice, system, LIGHT_GRID_Z);
+
+	/* Gather the slices' lists into one and make the offsets absolute */
+	stats->maxPerCluster = stats->overflow = 0;
+	for (z = 0, base = 0; z < LIGHT_GRID_Z; ++z)
+	{
+		const LightSlice* slice = &system->slices[z];
+		float* grid = system->grid + z * GRID_TILES * 2;
+		memcpy(system->indices + base, system->sliceRefs + z * LIGHT_SLICE_REFS,
+				sizeof(float) * slice->refs);
+		for (i = 0; i < GRID_TILES; ++i)
+			grid[i * 2] += (float)base;
+		base += slice->refs;
+		stats->overflow += slice->overflow;
+		if (slice->maxPerCluster > stats->maxPerCluster)
+			stats->maxPerCluster = slice->maxPerCluster;
+	}
+	stats->lights = system->numLights;
+	stats->references = base;
+
+	glBindTexture(GL_TEXTURE_2D, system->lightTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_MAX, 2, GL_RGBA, GL_FLOAT, system->lightData);
+	glBindTexture(GL_TEXTURE_2D, system->gridTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GRID_TILES, LIGHT_GRID_Z,
+			GL_LUMINANCE_ALPHA, GL_FLOAT, system->grid);
+	/* Only the index rows in use */
+	rows = (base + LIGHT_INDEX_SIZE - 1) / LIGHT_INDEX_SIZE;
+	if (rows > 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, system->indexTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_INDEX_SIZE, rows,
+				GL_LUMINANCE, GL_FLOAT, system->indices);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	stats->binMs = benchNow() - start;
+}
+
+void bindLights(const LightSystem* system, int unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, system->lightTexture);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_2D, system->gridTexture);
+	glActiveTexture(GL_TEXTURE0 + unit + 2);
+	glBindTexture(GL_TEXTURE_2D, system->indexTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,82 @@
+/* lights.h */
+
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "objects.h"
+#include "jobs.h"
+
+/*
+Clustered forward lighting. The view frustum is cut into a grid of
+LIGHT_GRID_X x LIGHT_GRID_Y screen tiles by LIGHT_GRID_Z depth slices,
+spaced exponentially between the near and far planes. Each frame every
+point light is binned into the clusters its sphere touches, and shader.frag
+loops over only the lights listed for the fragment's cluster.
+
+The binning runs one depth slice per job; each job tests four lights at a
+time against its clusters with SSE. The results go to the GPU as float
+textures (GL 2 has no buffer textures):
+	lightData:  LIGHT_MAX x 2 RGBA, eye space position + radius, colour
+	lightGrid:  (LIGHT_GRID_X * LIGHT_GRID_Y) x LIGHT_GRID_Z, offset + count
+	lightIndex: LIGHT_INDEX_SIZE squared, light indices for every cluster
+The cluster boxes assume a symmetric perspective projection.
+*/
+#define LIGHT_MAX 1024
+#define LIGHT_GRID_X 16
+#define LIGHT_GRID_Y 8
+#define LIGHT_GRID_Z 16
+#define LIGHT_INDEX_SIZE 512
+#define LIGHT_SLICE_REFS (LIGHT_INDEX_SIZE * LIGHT_INDEX_SIZE / LIGHT_GRID_Z)
+
+typedef struct {
+	vector_t position; /* world space */
+	float radius;      /* no contribution beyond this distance */
+	float color[3];
+} Light;
+
+typedef struct {
+	int lights;
+	int references;    /* light indices over all clusters */
+	int maxPerCluster;
+	int overflow;      /* references dropped because a slice was full */
+	double binMs;      /* CPU time of the last updateLights */
+} LightStats;
+
+typedef struct LightSlice LightSlice;
+
+typedef struct {
+	Light lights[LIGHT_MAX];
+	int numLights;
+
+	/* Camera of the last update */
+	float projX, projY;    /* projection scale, P[0] and P[5] */
+	float near, far;
+
+	float* lightData;      /* texture contents, see above */
+	float* grid;
+	float* indices;
+	float* sliceRefs;      /* LIGHT_SLICE_REFS per slice, gathered into indices */
+	LightSlice* slices;    /* per job candidate lists */
+	JobPool* pool;         /* shared with the software renderer */
+
+	GLuint lightTexture;
+	GLuint gridTexture;
+	GLuint indexTexture;
+
+	LightStats stats;
+} LightSystem;
+
+LightSystem* createLightSystem();
+void freeLightSystem(LightSystem* system);
+
+/*
+Bins the first numLights lights for the camera given by the column major
+modelview (world to eye) and projection matrices, and uploads the textures.
+*/
+void updateLights(LightSystem* system, const float* modelview, const float* projection,
+		float near, float far);
+
+/* Binds lightData, lightGrid and lightIndex to texture units unit, unit + 1, unit + 2 */
+void bindLights(const LightSystem* system, int unit);
+
+#endif
@@ -0,0 +1,302 @@
+/* megabuffer.c */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "megabuffer.h"
+#include "resources.h"
+#include "bench.h"
+
+static void initHeap(MegaHeap* heap, int capacity)
+{
+	heap->capacity = capacity;
+	heap->used = 0;
+	heap->maxFree = 16;
+	heap->free = (MegaBlock*)resMalloc(sizeof(MegaBlock) * heap->maxFree, RES_ORIGIN);
+	heap->free[0].offset = 0;
+	heap->free[0].size = capacity;
+	heap->numFree = 1;
+}
+
+/* Returns the offset, or -1 */
+static int heapAlloc(MegaHeap* heap, int size)
+{
+	int i, offset;
+
+	for (i = 0; i < heap->numFree; ++i)
+	{
+		MegaBlock* block = &heap->free[i];
+		if (block->size < size)
+			continue;
+		offset = block->offset;
+		block->offset += size;
+		block->size -= size;
+		if (block->size == 0)
+			memmove(block, block + 1, sizeof(MegaBlock) * (--heap->numFree - i));
+		heap->used += size;
+		return offset;
+	}
+	return -1;
+}
+
+/* Inserts the range in order, merging it with free neighbours */
+static void heapFree(MegaHeap* heap, int offset, int size)
+{
+	MegaBlock* prev;
+	MegaBlock* next;
+	int i;
+
+	heap->used -= size;
+	for (i = 0; i < heap->numFree && heap->free[i].offset < offset; ++i)
+		;
+	prev = i > 0 ? &heap->free[i - 1] : NULL;
+	next = i < heap->numFree ? &heap->free[i] : NULL;
+	assert(!prev || prev->offset + prev->size <= offset);
+	assert(!next || offset + size <= next->offset);
+
+	if (prev && prev->offset + prev->size == offset)
+	{
+		prev->size += size;
+		if (next && offset + size == next->offset)
+		{
+			prev->size += next->size;
+			memmove(next, next + 1, sizeof(MegaBlock) * (--heap->numFree - i));
+		}
+		return;
+	}
+	if (next && offset + size == next->offset)
+	{
+		next->offset = offset;
+		next->size += size;
+		return;
+	}
+
+	if (heap->numFree == heap->maxFree)
+	{
+		heap->maxFree *= 2;
+		heap->free = (MegaBlock*)resRealloc(heap->free, sizeof(MegaBlock) * heap->maxFree, RES_ORIGIN);
+	}
+	memmove(&heap->free[i + 1], &heap->free[i], sizeof(MegaBlock) * (heap->numFree - i));
+	heap->free[i].offset = offset;
+	heap->free[i].size = size;
+	heap->numFree++;
+}
+
+static void growBatch(MegaBuffer* mega, int count)
+{
+	if (count <= mega->maxCommands)
+		return;
+	while (mega->maxCommands < count)
+		mega->maxCommands *= 2;
+	mega->commands = (MegaCommand*)resRealloc(mega->commands,
+			sizeof(MegaCommand) * mega->maxCommands, RES_ORIGIN);
+	mega->transforms = (float*)resRealloc(mega->transforms,
+			sizeof(float) * 16 * mega->maxCommands, RES_ORIGIN);
+}
+
+MegaBuffer* createMegaBuffer(int vertices, int indices)
+{
+	MegaBuffer* mega = (MegaBuffer*)resMalloc(sizeof(MegaBuffer), RES_ORIGIN);
+
+	mega->vertexBuffer = resGenBuffer(RES_ORIGIN);
+	glBindBuffer(GL_ARRAY_BUFFER, mega->vertexBuffer);
+	resBufferData(GL_ARRAY_BUFFER, mega->vertexBuffer,
+			sizeof(vertex_t) * vertices, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	mega->elementBuffer = resGenBuffer(RES_ORIGIN);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mega->elementBuffer);
+	resBufferData(GL_ELEMENT_ARRAY_BUFFER, mega->elementBuffer,
+			sizeof(unsigned int) * indices, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	initHeap(&mega->vertices, vertices);
+	initHeap(&mega->indices, indices);
+
+	/* baseInstance picks the transform, which needs instanced arrays too */
+	mega->indirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance
+			&& GLEW_ARB_instanced_arrays;
+	if (!mega->indirect)
+		printf("ARB_multi_draw_indirect not supported: batches use one draw per object\n");
+	mega->commandBuffer = resGenBuffer(RES_ORIGIN);
+	mega->instanceBuffer = resGenBuffer(RES_ORIGIN);
+	mega->maxCommands = MEGA_MIN_BATCH;
+	mega->commands = (MegaCommand*)resMalloc(sizeof(MegaCommand) * mega->maxCommands, RES_ORIGIN);
+	mega->transforms = (float*)resMalloc(sizeof(float) * 16 * mega->maxCommands, RES_ORIGIN);
+	mega->numCommands = 0;
+	memset(&mega->stats, 0, sizeof(MegaStats));
+	return mega;
+}
+
+void freeMegaBuffer(MegaBuffer* mega)
+{
+	assert(mega->vertices.used == 0 && mega->indices.used == 0);
+	resDeleteBuffer(mega->vertexBuffer);
+	resDeleteBuffer(mega->elementBuffer);
+	resDeleteBuffer(mega->commandBuffer);
+	resDeleteBuffer(mega->instanceBuffer);
+	resFree(mega->vertices.free);
+	resFree(mega->indices.free);
+	resFree(mega->commands);
+	resFree(mega->transforms);
+	resFree(mega);
+}
+
+Object* uploadMegaMesh(MegaBuffer* mega, const Mesh* mesh)
+{
+	Object* obj;
+	unsigned int* indices;
+	int firstVertex, firstIndex, i;
+
+	/* A batch is a single multi draw, so every mesh must be a strip */
+	assert(mesh->primitive == GL_TRIANGLE_STRIP);
+	firstVertex = heapAlloc(&mega->vertices, mesh->numVertices);
+	if (firstVertex < 0)
+		return NULL;
+	firstIndex = heapAlloc(&mega->indices, mesh->numIndices);
+	if (firstIndex < 0)
+	{
+		heapFree(&mega->vertices, firstVertex, mesh->numVertices);
+		return NULL;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, mega->vertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertex_t) * firstVertex,
+			sizeof(vertex_t) * mesh->numVertices, mesh->vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	/* Rebased here once, so draws never need a base vertex */
+	indices = (unsigned int*)resMalloc(sizeof(unsigned int) * mesh->numIndices, RES_ORIGIN);
+	for (i = 0; i < mesh->numIndices; ++i)
+		indices[i] = mesh->indices[i] + firstVertex;
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mega->elementBuffer);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * firstIndex,
+			sizeof(unsigned int) * mesh->numIndices, indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	resFree(indices);
+
+	obj = (Object*)resMalloc(sizeof(Object), RES_ORIGIN);
+	obj->vertexBuffer = mega->vertexBuffer;
+	obj->elementBuffer = mega->elementBuffer;
+	obj->numVertices = mesh->numVertices;
+	obj->numElements = mesh->numIndices;
+	obj->primitive = mesh->primitive;
+	obj->clusters = NULL;
+	obj->mega = mega;
+	obj->firstVertex = firstVertex;
+	obj->firstIndex = firstIndex;
+	meshBounds(mesh, &obj->boundsMin, &obj->boundsMax);
+	return obj;
+}
+
+void releaseMegaObject(MegaBuffer* mega, Object* obj)
+{
+	heapFree(&mega->vertices, obj->firstVertex, obj->numVertices);
+	heapFree(&mega->indices, obj->firstIndex, obj->numElements);
+}
+
+void beginMegaBatch(MegaBuffer* mega)
+{
+	mega->numCommands = 0;
+	mega->batchStart = benchNow();
+}
+
+void addMegaDraw(MegaBuffer* mega, const Object* obj, const float* transform)
+{
+	MegaCommand* command;
+
+	assert(obj->mega == mega);
+	growBatch(mega, mega->numCommands + 1);
+	command = &mega->commands[mega->numCommands];
+	command->count = obj->numElements;
+	command->instanceCount = 1;
+	command->firstIndex = obj->firstIndex;
+	command->baseVertex = 0;
+	command->baseInstance = mega->numCommands;
+	memcpy(&mega->transforms[mega->numCommands * 16], transform, sizeof(float) * 16);
+	mega->numCommands++;
+}
+
+/* The mat4 attribute takes four consecutive locations, one per column */
+static void setTransformArrays(GLint attrib, int enable)
+{
+	int column;
+	for (column = 0; column < 4; ++column)
+	{
+		if (enable)
+		{
+			glEnableVertexAttribArray(attrib + column);
+			glVertexAttribPointer(attrib + column, 4, GL_FLOAT, GL_FALSE,
+					sizeof(float) * 16, (void*)(sizeof(float) * 4 * column));
+			glVertexAttribDivisorARB(attrib + column, 1);
+		}
+		else
+		{
+			glVertexAttribDivisorARB(attrib + column, 0);
+			glDisableVertexAttribArray(attrib + column);
+		}
+	}
+}
+
+void drawMegaBatch(MegaBuffer* mega, GLint transformAttrib)
+{
+	int i, column;
+	double start = benchNow();
+
+	mega->stats.encodeMs = start - mega->batchStart;
+	mega->stats.draws = mega->numCommands;
+	mega->stats.calls = 0;
+	if (mega->numCommands == 0)
+	{
+		mega->stats.submitMs = 0.0;
+		return;
+	}
+
+	/* Bound once for the whole batch */
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, mega->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mega->elementBuffer);
+	glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)0);
+	glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
+
+	if (mega->indirect)
+	{
+		/* Orphaned each frame so the driver never waits on the last one */
+		glBindBuffer(GL_ARRAY_BUFFER, mega->instanceBuffer);
+		resBufferData(GL_ARRAY_BUFFER, mega->instanceBuffer,
+				sizeof(float) * 16 * mega->numCommands, mega->transforms, GL_STREAM_DRAW);
+		setTransformArrays(transformAttrib, 1);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mega->commandBuffer);
+		resBufferData(GL_DRAW_INDIRECT_BUFFER, mega->commandBuffer,
+				sizeof(MegaCommand) * mega->numCommands, mega->commands, GL_STREAM_DRAW);
+		glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_INT, (void*)0,
+				mega->numCommands, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		mega->stats.calls = 1;
+
+		setTransformArrays(transformAttrib, 0);
+	}
+	else
+	{
+		for (i = 0; i < mega->numCommands; ++i)
+		{
+			const MegaCommand* command = &mega->commands[i];
+			for (column = 0; column < 4; ++column)
+				glVertexAttrib4fv(transformAttrib + column, &mega->transforms[i * 16 + column * 4]);
+			glDrawElements(GL_TRIANGLE_STRIP, command->count, GL_UNSIGNED_INT,
+					(void*)(sizeof(unsigned int) * command->firstIndex));
+		}
+		mega->stats.calls = mega->numCommands;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	mega->stats.submitMs = benchNow() - start;
+}
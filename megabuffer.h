@@ -0,0 +1,95 @@
+/* megabuffer.h */
+
+#ifndef MEGABUFFER_H
+#define MEGABUFFER_H
+
+#include "objects.h"
+
+/*
+One vertex buffer and one index buffer shared by many small meshes, so
+drawing different meshes needs no rebinding. Each buffer is handed out by
+a first fit free list; freed ranges merge with free neighbours straight
+away, so the free list never holds two adjacent blocks.
+
+Objects made by uploadMegaMesh() are ordinary Objects whose buffers are
+the shared ones: drawObject() and freeObject() work on them as usual.
+Their indices are stored with firstVertex already added, so every draw
+uses a base vertex of 0 and needs nothing beyond GL 2.
+
+A batch draws a list of (object, transform) pairs at once:
+
+	beginMegaBatch(mega);
+	addMegaDraw(mega, object, transform); ...
+	drawMegaBatch(mega, transformAttrib);
+
+The transforms go to a per instance vertex attribute (a mat4, see
+scene.vert). With ARB_multi_draw_indirect the whole batch is one
+glMultiDrawElementsIndirect, each command selecting its transform with
+baseInstance. Without it, the transform is set as a constant attribute
+before each glDrawElements, still with no rebinding.
+*/
+#define MEGA_MIN_BATCH 256
+
+typedef struct {
+	int offset, size;
+} MegaBlock;
+
+/* First fit allocator over [0, capacity) in elements */
+typedef struct {
+	int capacity;
+	int used;
+	MegaBlock* free;     /* sorted by offset, never adjacent */
+	int numFree;
+	int maxFree;
+} MegaHeap;
+
+/* Layout fixed by the indirect draw extension */
+typedef struct {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+} MegaCommand;
+
+typedef struct {
+	int draws;      /* objects in the last batch */
+	int calls;      /* GL draw calls it took */
+	double encodeMs;
+	double submitMs;
+} MegaStats;
+
+typedef struct MegaBuffer {
+	GLuint vertexBuffer;
+	GLuint elementBuffer;
+	MegaHeap vertices;
+	MegaHeap indices;
+
+	int indirect;          /* multi draw indirect is supported */
+	GLuint commandBuffer;
+	GLuint instanceBuffer;
+	MegaCommand* commands; /* the batch being built */
+	float* transforms;     /* 16 per command */
+	int numCommands;
+	int maxCommands;
+	double batchStart;
+
+	MegaStats stats;
+} MegaBuffer;
+
+MegaBuffer* createMegaBuffer(int vertices, int indices);
+
+/* Every object allocated from it must have been freed */
+void freeMegaBuffer(MegaBuffer* mega);
+
+/* Triangle strips only. Returns NULL if either buffer has no free range large enough */
+Object* uploadMegaMesh(MegaBuffer* mega, const Mesh* mesh);
+
+/* Called by freeObject() */
+void releaseMegaObject(MegaBuffer* mega, Object* obj);
+
+void beginMegaBatch(MegaBuffer* mega);
+void addMegaDraw(MegaBuffer* mega, const Object* obj, const float* transform);
+void drawMegaBatch(MegaBuffer* mega, GLint transformAttrib);
+
+#endif
@@ -1,22 +1,16 @@
 // vertex shader for per-pixel lighting
 // assumes single directional light
 
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+#include "blocks.glsl"
+
 #define M_PI 3.1415926535897932384626433832795
 
 varying vec3 eye;
 varying vec3 normal;
-
-/* objects:
- *  0 = torus
- *  1 = wave
- */
-uniform int object;
-
-/* lighting model:
- *  0 = phong
- *  1 = blinn-phong
- */
-uniform int lightingModel;
+varying vec3 position; // eye space, for clustered lights
 
 /* light type:
  *  0 = point
@@ -24,15 +18,14 @@ uniform int lightingModel;
  */
 uniform bool lightType;
 
-uniform bool isLocalViewer;
-uniform bool isPerPixelLighting;
-
-uniform float time;
+/* pass: 0 = shade, otherwise only the position matters (see shader.frag) */
+uniform int pass;
 
 void main(void) {
 
-	const int Torus = 0;
-	const int Wave  = 1;
+	const int Torus  = 0;
+	const int Sphere = 1;
+	const int Wave   = 2;
 
 	const int Phong = 0;
 	const int BlinnPhong = 1;
@@ -58,6 +51,11 @@ void main(void) {
 				r * sin(v),
 				1);
 
+	} else if (object == Sphere) {
+
+		normal = gl_Normal;
+		vertex = gl_Vertex;
+
 	} else /* object == Wave */ {
 
 		const float Width     = 2.0;
@@ -89,27 +87,28 @@ void main(void) {
 	}
 
 	// set eye and normal vectors
+	position = vec3(gl_ModelViewMatrix * vertex);
 	eye = isLocalViewer ? normalize(vec3(gl_ModelViewMatrix * vertex)) : vec3(0.0, 0.0, -1.0);
 	normal = normalize(vec3(gl_NormalMatrix * normal));
 
 	// if vertex lit, set vertex color
-	if (!isPerPixelLighting) {
+	if (!isPerPixelLighting && pass == 0) {
 
 		vec4 color = vec4(0.0);
 
 		// unit vector in direction of light, light source position/direction
 		// already transformed into eye space coordinates by modelview matrix
-		vec3 light = normalize(vec3(gl_LightSource[0].position));
+		vec3 light = normalize(vec3(lightPosition));
 
 		// compute diffuse scalar
 		float NdotL = max(dot(normal, light), 0.0);
 
 		// add global and light ambient
-		color += gl_FrontMaterial.ambient * (gl_LightModel.ambient + gl_LightSource[0].ambient);
+		color += materialAmbient * (sceneAmbient + lightAmbient);
 
 		if (NdotL > 0.0) {
 			// add diffuse component
-			color += NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse;
+			color += NdotL * materialDiffuse * lightDiffuse;
 
 			// add specular color depending on light model
 			if (lightingModel == Phong) {
@@ -118,14 +117,14 @@ void main(void) {
 				vec3 reflection = reflect(light, normal);
 				float RdotE = max(dot(reflection, eye), 0.0);
 
-				color += pow(RdotE, gl_FrontMaterial.shininess) *
-					gl_LightSource[0].specular * gl_FrontMaterial.specular;
+				color += pow(RdotE, materialShininess) *
+					lightSpecular * materialSpecular;
 
 			} else /* lightingModel == BlinnPhong */ {
 
-				float NdotHV = max(dot(normal, gl_LightSource[0].halfVector.xyz), 0.0);
-				color += gl_FrontMaterial.specular * gl_LightSource[0].specular *
-					pow(NdotHV, gl_FrontMaterial.shininess);
+				float NdotHV = max(dot(normal, lightHalfVector.xyz), 0.0);
+				color += materialSpecular * lightSpecular *
+					pow(NdotHV, materialShininess);
 
 			}
 		}
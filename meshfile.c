@@ -0,0 +1,239 @@
+/* meshfile.c */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "meshfile.h"
+
+static uint64_t alignUp(uint64_t offset)
+{
+	return (offset + MESH_FILE_ALIGN - 1) & ~(uint64_t)(MESH_FILE_ALIGN - 1);
+}
+
+/* FNV-1a over 32 bit words. Both blocks are whole numbers of words. */
+static uint64_t checksum(uint64_t hash, const void* data, size_t bytes)
+{
+	const uint32_t* word = (const uint32_t*)data;
+	const uint32_t* end = word + bytes / sizeof(uint32_t);
+	for (; word < end; ++word)
+	{
+		hash ^= *word;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t meshChecksum(const void* vertices, size_t vertexBytes, const void* indices, size_t indexBytes)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = checksum(hash, vertices, vertexBytes);
+	return checksum(hash, indices, indexBytes);
+}
+
+/*
+Files whose checksum is already known to match, this run: written by
+writeMeshFile() or verified once by mapMeshFile(). Hashing every page of a
+large mesh on each map would cost more than the upload it precedes. A
+rewrite with different contents changes the header's checksum, so it's
+verified again.
+*/
+#define VERIFIED_FILES 64
+
+typedef struct {
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	uint64_t checksum;
+} VerifiedFile;
+
+static VerifiedFile verified[VERIFIED_FILES];
+static int numVerified = 0;
+static int nextVerified = 0; /* replaced first once the table is full */
+
+static VerifiedFile* findVerified(const struct stat* st, uint64_t checksum)
+{
+	int i;
+	for (i = 0; i < numVerified; ++i)
+		if (verified[i].device == st->st_dev && verified[i].inode == st->st_ino
+				&& verified[i].size == st->st_size && verified[i].checksum == checksum)
+			return &verified[i];
+	return NULL;
+}
+
+static void addVerified(const struct stat* st, uint64_t checksum)
+{
+	VerifiedFile* file = findVerified(st, checksum);
+	if (file)
+		return;
+	if (numVerified < VERIFIED_FILES)
+		file = &verified[numVerified++];
+	else
+	{
+		file = &verified[nextVerified];
+		nextVerified = (nextVerified + 1) % VERIFIED_FILES;
+	}
+	file->device = st->st_dev;
+	file->inode = st->st_ino;
+	file->size = st->st_size;
+	file->checksum = checksum;
+}
+
+static int writePadded(FILE* file, const void* data, size_t bytes, uint64_t end)
+{
+	static const char zeros[MESH_FILE_ALIGN];
+	long pos;
+	if (fwrite(data, 1, bytes, file) != bytes)
+		return 1;
+	pos = ftell(file);
+	if (pos < 0 || (uint64_t)pos > end)
+		return 1;
+	return fwrite(zeros, 1, end - pos, file) != end - pos;
+}
+
+int createMeshDirectory(const char* directory)
+{
+	if (mkdir(directory, 0755) == 0 || errno == EEXIST)
+		return 0;
+	printf("Error creating mesh directory %s\n", directory);
+	return 1;
+}
+
+int writeMeshFile(const char* filename, const Mesh* mesh)
+{
+	MeshFileHeader header;
+	size_t vertexBytes = sizeof(vertex_t) * mesh->numVertices;
+	size_t indexBytes = sizeof(unsigned int) * mesh->numIndices;
+	struct stat st;
+	FILE* file;
+	int error;
+
+	assert(mesh->primitive == GL_TRIANGLE_STRIP);
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, MESH_FILE_MAGIC, 4);
+	header.version = MESH_FILE_VERSION;
+	header.headerSize = sizeof(MeshFileHeader);
+	header.vertexSize = sizeof(vertex_t);
+	header.numVertices = mesh->numVertices;
+	header.numIndices = mesh->numIndices;
+	header.vertexOffset = alignUp(sizeof(MeshFileHeader));
+	header.indexOffset = alignUp(header.vertexOffset + vertexBytes);
+	header.fileSize = header.indexOffset + indexBytes;
+	header.checksum = meshChecksum(mesh->vertices, vertexBytes, mesh->indices, indexBytes);
+
+	file = fopen(filename, "wb");
+	if (!file)
+	{
+		printf("Error writing mesh %s\n", filename);
+		return 1;
+	}
+	error = writePadded(file, &header, sizeof header, header.vertexOffset)
+		|| writePadded(file, mesh->vertices, vertexBytes, header.indexOffset)
+		|| fwrite(mesh->indices, 1, indexBytes, file) != indexBytes;
+	error = fflush(file) || error;
+	/* The checksum was just taken from the data itself */
+	if (!error && fstat(fileno(file), &st) == 0)
+		addVerified(&st, header.checksum);
+	error = fclose(file) || error;
+	if (error)
+	{
+		printf("Error writing mesh %s\n", filename);
+		remove(filename);
+	}
+	return error;
+}
+
+static const char* validate(const MeshFileHeader* header, uint64_t size)
+{
+	if (size < sizeof(MeshFileHeader) || memcmp(header->magic, MESH_FILE_MAGIC, 4) != 0)
+		return "not a mesh file";
+	if (header->version != MESH_FILE_VERSION)
+		return "unsupported version";
+	if (header->headerSize != sizeof(MeshFileHeader) || header->vertexSize != sizeof(vertex_t))
+		return "incompatible layout";
+	if (header->fileSize != size
+			|| header->vertexOffset % MESH_FILE_ALIGN || header->indexOffset % MESH_FILE_ALIGN
+			|| header->vertexOffset + sizeof(vertex_t) * (uint64_t)header->numVertices > header->indexOffset
+			|| header->indexOffset + sizeof(unsigned int) * (uint64_t)header->numIndices > size)
+		return "truncated or corrupt";
+	return NULL;
+}
+
+int mapMeshFile(MappedMesh* mapped, const char* filename)
+{
+	struct stat st;
+	const MeshFileHeader* header;
+	const char* error;
+	char* data;
+	Mesh* mesh = &mapped->mesh;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MeshFileHeader))
+	{
+		close(fd);
+		printf("Error loading mesh %s: not a mesh file\n", filename);
+		return -1;
+	}
+	data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("Error mapping mesh %s\n", filename);
+		return -1;
+	}
+
+	header = (const MeshFileHeader*)data;
+	error = validate(header, st.st_size);
+
+	/* The blocks are used in place: GL copies straight out of the mapping */
+	mesh->vertices = (vertex_t*)(data + (error ? 0 : header->vertexOffset));
+	mesh->indices = (unsigned int*)(data + (error ? 0 : header->indexOffset));
+	mesh->numVertices = header->numVertices;
+	mesh->numIndices = header->numIndices;
+	mesh->primitive = GL_TRIANGLE_STRIP;
+	if (!error && !findVerified(&st, header->checksum))
+	{
+		if (meshChecksum(mesh->vertices, sizeof(vertex_t) * mesh->numVertices,
+					mesh->indices, sizeof(unsigned int) * mesh->numIndices) != header->checksum)
+			error = "checksum mismatch";
+		else
+			addVerified(&st, header->checksum);
+	}
+
+	if (error)
+	{
+		printf("Error loading mesh %s: %s\n", filename, error);
+		munmap(data, st.st_size);
+		return -1;
+	}
+	mapped->data = data;
+	mapped->size = st.st_size;
+	return 0;
+}
+
+void unmapMeshFile(MappedMesh* mapped)
+{
+	munmap(mapped->data, mapped->size);
+	mapped->data = NULL;
+}
+
+Object* loadMeshFile(Object* obj, const char* filename)
+{
+	MappedMesh mapped;
+
+	if (mapMeshFile(&mapped, filename) != 0)
+		return NULL;
+	obj = uploadMesh(obj, &mapped.mesh);
+	unmapMeshFile(&mapped);
+	return obj;
+}
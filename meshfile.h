@@ -0,0 +1,66 @@
+/* meshfile.h */
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <stdint.h>
+
+#include "objects.h"
+
+/*
+Binary mesh file. A fixed header followed by the vertex and index blocks,
+each starting on a page boundary so a mapping of the file can be handed
+straight to glBufferData. All values are in host byte order; files are a
+cache for this machine, not an interchange format. Only triangle strips
+are stored.
+
+	offset 0            MeshFileHeader
+	vertexOffset        numVertices * vertex_t
+	indexOffset         numIndices * unsigned int
+*/
+#define MESH_FILE_MAGIC "RTRM"
+#define MESH_FILE_VERSION 1
+#define MESH_FILE_ALIGN 4096
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t headerSize;   /* sizeof(MeshFileHeader) */
+	uint32_t vertexSize;   /* sizeof(vertex_t) */
+	uint32_t numVertices;
+	uint32_t numIndices;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t fileSize;
+	uint64_t checksum;     /* over the vertex then index block */
+} MeshFileHeader;
+
+/* A validated file mapping; mesh points into it */
+typedef struct {
+	Mesh mesh;
+	void* data;
+	size_t size;
+} MappedMesh;
+
+/* Creates directory for mesh files if it doesn't exist. Returns 0 on success. */
+int createMeshDirectory(const char* directory);
+
+/* Returns 0 on success */
+int writeMeshFile(const char* filename, const Mesh* mesh);
+
+/*
+Maps filename and uploads it into obj (created if obj is NULL).
+Returns NULL, leaving obj untouched, if the file is missing or invalid.
+*/
+Object* loadMeshFile(Object* obj, const char* filename);
+
+/*
+The two halves of loadMeshFile, for mapping on one thread and uploading
+on another. Returns 0 on success; mapped->mesh is valid until unmapped.
+The checksum is only verified the first time a file is mapped in a run,
+and not at all for a file this run wrote. Call from one thread only.
+*/
+int mapMeshFile(MappedMesh* mapped, const char* filename);
+void unmapMeshFile(MappedMesh* mapped);
+
+#endif
@@ -0,0 +1,7 @@
+// normals.frag
+// the overlay's lines, in one colour
+
+void main(void)
+{
+	gl_FragColor = vec4(1.0, 1.0, 0.0, 1.0);
+}
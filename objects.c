@@ -6,7 +6,12 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <SDL/SDL.h>
+
 #include "objects.h"
+#include "resources.h"
+#include "clusters.h"
+#include "megabuffer.h"
 
 vertex_t parametricSphere(float u, float v, va_list* args)
 {
@@ -112,9 +117,85 @@ void drawAxes(float x,float y,float z,float length)
 	glEnable(GL_DEPTH_TEST);
 }
 
-Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
+/* Scratch arena for mesh temporaries, reused across regenerations and
+ * only ever grown to the largest mesh built so far. One per thread, so the
+ * render thread can build meshes while the main thread generates. */
+#define SCRATCH_THREADS 4
+
+typedef struct {
+	Uint32 owner; /* SDL_ThreadID() of the thread using it, 0 if free; atomic */
+	char* data;
+	size_t used;
+	ScratchStats stats;
+} Scratch;
+
+static Scratch scratches[SCRATCH_THREADS];
+
+/* The calling thread's arena, claimed the first time it's asked for */
+static Scratch* threadScratch()
 {
-	va_list args;
+	Uint32 self = SDL_ThreadID();
+	Uint32 expected;
+	int i;
+
+	for (i = 0; i < SCRATCH_THREADS; ++i)
+		if (__atomic_load_n(&scratches[i].owner, __ATOMIC_ACQUIRE) == self)
+			return &scratches[i];
+	for (i = 0; i < SCRATCH_THREADS; ++i)
+	{
+		expected = 0;
+		if (__atomic_compare_exchange_n(&scratches[i].owner, &expected, self, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return &scratches[i];
+	}
+	assert(!"more threads generating meshes than SCRATCH_THREADS");
+	return NULL;
+}
+
+static Scratch* scratchReserve(size_t size)
+{
+	Scratch* scratch = threadScratch();
+	scratch->used = 0;
+	if (size <= scratch->stats.capacity)
+	{
+		scratch->stats.reuses++;
+		return scratch;
+	}
+	/* Nothing in the arena outlives a generation: start a fresh block
+	 * rather than have resRealloc() copy the stale contents over */
+	resFree(scratch->data);
+	scratch->data = (char*)resMalloc(size, RES_ORIGIN);
+	scratch->stats.capacity = size;
+	scratch->stats.grows++;
+	return scratch;
+}
+
+static void* scratchAlloc(Scratch* scratch, size_t size)
+{
+	void* ptr = scratch->data + scratch->used;
+	scratch->used += (size + 15) & ~(size_t)15;
+	assert(scratch->used <= scratch->stats.capacity);
+	return ptr;
+}
+
+const ScratchStats* objectScratchStats()
+{
+	return &threadScratch()->stats;
+}
+
+void freeObjectScratch()
+{
+	Scratch* scratch = threadScratch();
+	resFree(scratch->data);
+	memset(scratch, 0, sizeof(Scratch));
+	/* Released for another thread to claim */
+	__atomic_store_n(&scratch->owner, 0, __ATOMIC_RELEASE);
+}
+
+static void generateMeshv(Mesh* mesh, ParametricObjFunc paramObjFunc, int x, int y, va_list args)
+{
+	va_list vertexArgs;
+	Scratch* scratch;
 	unsigned int i, j;
 	float u, v;
 	int ci = 0; /* current index */
@@ -122,14 +203,15 @@ Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
 	unsigned int* indices;
 	int numVertices;
 	int numIndices;
-	Object* obj;
 #define INDEX(I, J) ((I)*y + (J))
 
 	/* Initialize data */
 	numVertices = x * y;
 	numIndices = (y-1) * (x * 2 + 2);
-	vertices = (vertex_t*)malloc(sizeof(vertex_t) * numVertices);
-	indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
+	scratch = scratchReserve(((sizeof(vertex_t) * numVertices + 15) & ~(size_t)15) +
+			((sizeof(unsigned int) * numIndices + 15) & ~(size_t)15));
+	vertices = (vertex_t*)scratchAlloc(scratch, sizeof(vertex_t) * numVertices);
+	indices = (unsigned int*)scratchAlloc(scratch, sizeof(unsigned int) * numIndices);
 
 	/* Construct vertex data */
 	for (i = 0; i < x; ++i)
@@ -138,8 +220,9 @@ Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
 		for (j = 0; j < y; ++j)
 		{
 			v = j/(float)(y-1);
-			va_start(args, y);
-			vertices[INDEX(i, j)] = paramObjFunc(u, v, &args);
+			va_copy(vertexArgs, args);
+			vertices[INDEX(i, j)] = paramObjFunc(u, v, &vertexArgs);
+			va_end(vertexArgs);
 		}
 	}
 
@@ -154,46 +237,254 @@ Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
 		}
 		indices[ci++] = INDEX(i-1, j+1);
 	}
+#undef INDEX
 
 	/* Double check the loops populated the data correctly */
 	assert(ci == numIndices);
 
+	mesh->vertices = vertices;
+	mesh->indices = indices;
+	mesh->numVertices = numVertices;
+	mesh->numIndices = numIndices;
+	mesh->primitive = GL_TRIANGLE_STRIP;
+}
+
+void generateMesh(Mesh* mesh, ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	va_start(args, y);
+	generateMeshv(mesh, paramObjFunc, x, y, args);
+	va_end(args);
+}
+
+/* Open addressed map from an edge (its end points, lowest first) to its midpoint */
+typedef struct {
+	unsigned long long* keys;
+	unsigned int* values;
+	unsigned int mask;
+} MidpointCache;
+
+#define NO_EDGE (~0ULL)
+
+/* Power of two slots for edges entries, keeping it at most half full */
+static int cacheSlots(int edges)
+{
+	int slots;
+	for (slots = 16; slots < edges * 2; slots *= 2)
+		;
+	return slots;
+}
+
+static unsigned int midpoint(MidpointCache* cache, vertex_t* vertices, int* numVertices,
+		unsigned int a, unsigned int b, float radius)
+{
+	unsigned long long key;
+	unsigned int slot;
+	vector_t n;
+	float length;
+
+	key = a < b ? (unsigned long long)a << 32 | b : (unsigned long long)b << 32 | a;
+	slot = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & cache->mask;
+	while (cache->keys[slot] != NO_EDGE)
+	{
+		if (cache->keys[slot] == key)
+			return cache->values[slot];
+		slot = (slot + 1) & cache->mask;
+	}
+
+	/* New midpoint, pushed out onto the sphere */
+	n.x = vertices[a].norm.x + vertices[b].norm.x;
+	n.y = vertices[a].norm.y + vertices[b].norm.y;
+	n.z = vertices[a].norm.z + vertices[b].norm.z;
+	length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+	n.x /= length;
+	n.y /= length;
+	n.z /= length;
+	vertices[*numVertices].norm = n;
+	vertices[*numVertices].vert.x = n.x * radius;
+	vertices[*numVertices].vert.y = n.y * radius;
+	vertices[*numVertices].vert.z = n.z * radius;
+
+	cache->keys[slot] = key;
+	cache->values[slot] = (*numVertices)++;
+	return cache->values[slot];
+}
+
+void generateIcosphere(Mesh* mesh, int level, float radius)
+{
+	static const float t = 1.61803398874989f; /* golden ratio */
+	static const float corners[12][3] = {
+		{-1,  t,  0}, { 1,  t,  0}, {-1, -t,  0}, { 1, -t,  0},
+		{ 0, -1,  t}, { 0,  1,  t}, { 0, -1, -t}, { 0,  1, -t},
+		{ t,  0, -1}, { t,  0,  1}, {-t,  0, -1}, {-t,  0,  1}};
+	static const unsigned int faces[20][3] = {
+		{0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+		{1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+		{3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+		{4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}};
+	MidpointCache cache;
+	Scratch* scratch;
+	unsigned int* buffers[2];
+	unsigned int* src;
+	unsigned int* dst;
+	vertex_t* vertices;
+	int numVertices, numIndices, numTriangles, numSource;
+	int slots, i, k;
+	float length;
+
+	assert(level >= 0 && level <= 12);
+	numVertices = 10 * (1 << (2 * level)) + 2;
+	numIndices = 60 * (1 << (2 * level));
+	numSource = level > 0 ? numIndices / 4 : 60;
+
+	/* The cache is sized for the last split, whose source has 30 * 4^(level - 1) edges */
+	slots = cacheSlots(level > 0 ? numIndices / 8 : 1);
+
+	scratch = scratchReserve(((sizeof(vertex_t) * numVertices + 15) & ~(size_t)15) +
+			((sizeof(unsigned int) * numIndices + 15) & ~(size_t)15) +
+			((sizeof(unsigned int) * numSource + 15) & ~(size_t)15) +
+			((sizeof(unsigned long long) * slots + 15) & ~(size_t)15) +
+			((sizeof(unsigned int) * slots + 15) & ~(size_t)15));
+	vertices = (vertex_t*)scratchAlloc(scratch, sizeof(vertex_t) * numVertices);
+
+	/* Levels alternate between the two index buffers, ending in the mesh's */
+	buffers[0] = (unsigned int*)scratchAlloc(scratch, sizeof(unsigned int) * numIndices);
+	buffers[1] = (unsigned int*)scratchAlloc(scratch, sizeof(unsigned int) * numSource);
+	cache.keys = (unsigned long long*)scratchAlloc(scratch, sizeof(unsigned long long) * slots);
+	cache.values = (unsigned int*)scratchAlloc(scratch, sizeof(unsigned int) * slots);
+
+	for (i = 0; i < 12; ++i)
+	{
+		length = sqrtf(1.0f + t * t);
+		vertices[i].norm.x = corners[i][0] / length;
+		vertices[i].norm.y = corners[i][1] / length;
+		vertices[i].norm.z = corners[i][2] / length;
+		vertices[i].vert.x = vertices[i].norm.x * radius;
+		vertices[i].vert.y = vertices[i].norm.y * radius;
+		vertices[i].vert.z = vertices[i].norm.z * radius;
+	}
+	src = buffers[level & 1];
+	memcpy(src, faces, sizeof faces);
+	numVertices = 12;
+	numTriangles = 20;
+
+	/* Each triangle becomes four, sharing the new midpoints with its neighbours */
+	for (k = 1; k <= level; ++k)
+	{
+		dst = buffers[(level - k) & 1];
+		slots = cacheSlots(numTriangles * 3 / 2);
+		cache.mask = slots - 1;
+		memset(cache.keys, 0xff, sizeof(unsigned long long) * slots);
+		for (i = 0; i < numTriangles; ++i)
+		{
+			unsigned int a = src[i * 3], b = src[i * 3 + 1], c = src[i * 3 + 2];
+			unsigned int ab = midpoint(&cache, vertices, &numVertices, a, b, radius);
+			unsigned int bc = midpoint(&cache, vertices, &numVertices, b, c, radius);
+			unsigned int ca = midpoint(&cache, vertices, &numVertices, c, a, radius);
+			unsigned int* out = &dst[i * 12];
+			out[0] = a;  out[1] = ab;  out[2] = ca;
+			out[3] = ab; out[4] = b;   out[5] = bc;
+			out[6] = ca; out[7] = bc;  out[8] = c;
+			out[9] = ab; out[10] = bc; out[11] = ca;
+		}
+		numTriangles *= 4;
+		src = dst;
+	}
+
+	/* Double check the counts match the closed form */
+	assert(src == buffers[0]);
+	assert(numVertices == 10 * (1 << (2 * level)) + 2);
+	assert(numTriangles * 3 == numIndices);
+
+	mesh->vertices = vertices;
+	mesh->indices = buffers[0];
+	mesh->numVertices = numVertices;
+	mesh->numIndices = numIndices;
+	mesh->primitive = GL_TRIANGLES;
+}
+
+void meshBounds(const Mesh* mesh, vector_t* lo, vector_t* hi)
+{
+	int i;
+	*lo = *hi = mesh->vertices[0].vert;
+	for (i = 1; i < mesh->numVertices; ++i)
+	{
+		const vector_t* p = &mesh->vertices[i].vert;
+		lo->x = fminf(lo->x, p->x); hi->x = fmaxf(hi->x, p->x);
+		lo->y = fminf(lo->y, p->y); hi->y = fmaxf(hi->y, p->y);
+		lo->z = fminf(lo->z, p->z); hi->z = fmaxf(hi->z, p->z);
+	}
+}
+
+Object* uploadMesh(Object* obj, const Mesh* mesh)
+{
 	/* Create VBOs */
-	obj = (Object*)malloc(sizeof(Object));
-	glGenBuffers(1, &obj->vertexBuffer);
-	glGenBuffers(1, &obj->elementBuffer);
+	if (!obj)
+	{
+		obj = (Object*)resMalloc(sizeof(Object), RES_ORIGIN);
+		obj->vertexBuffer = resGenBuffer(RES_ORIGIN);
+		obj->elementBuffer = resGenBuffer(RES_ORIGIN);
+		obj->clusters = NULL;
+		obj->mega = NULL;
+		obj->firstVertex = 0;
+		obj->firstIndex = 0;
+	}
+	assert(!obj->mega && "shared buffer objects can't be resized");
 
 	/* Buffer the vertex data */
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * numVertices, vertices, GL_STATIC_DRAW);
+	resBufferData(GL_ARRAY_BUFFER, obj->vertexBuffer,
+			sizeof(vertex_t) * mesh->numVertices, mesh->vertices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	/* Buffer the index data */
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numIndices, indices, GL_STATIC_DRAW);
+	resBufferData(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer,
+			sizeof(unsigned int) * mesh->numIndices, mesh->indices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	/* Cleanup and return the object struct */
-	obj->numVertices = numVertices;
-	obj->numElements = numIndices;
-	free(vertices);
-	free(indices);
+	obj->numVertices = mesh->numVertices;
+	obj->numElements = mesh->numIndices;
+	obj->primitive = mesh->primitive;
+	meshBounds(mesh, &obj->boundsMin, &obj->boundsMax);
 	return obj;
 }
 
-void drawObject(Object* obj)
+Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	Mesh mesh;
+
+	va_start(args, y);
+	generateMeshv(&mesh, paramObjFunc, x, y, args);
+	va_end(args);
+	return uploadMesh(NULL, &mesh);
+}
+
+Object* rebuildObject(Object* obj, ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	Mesh mesh;
+
+	va_start(args, y);
+	generateMeshv(&mesh, paramObjFunc, x, y, args);
+	va_end(args);
+	return uploadMesh(obj, &mesh);
+}
+
+void bindObject(Object* obj)
 {
 	/* Enable vertex arrays and bind VBOs */
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_NORMAL_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
-
-	/* Draw object */
 	glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)0);
 	glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
-	glDrawElements(GL_TRIANGLE_STRIP, obj->numElements, GL_UNSIGNED_INT, (void*)0);
+}
 
+void unbindObject()
+{
 	/* Unbind/disable arrays. could also push/pop enables */
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -201,33 +492,56 @@ void drawObject(Object* obj)
 	glDisableClientState(GL_NORMAL_ARRAY);
 }
 
+void drawBoundObject(Object* obj)
+{
+	glDrawElements(obj->primitive, obj->numElements, GL_UNSIGNED_INT,
+			(void*)(sizeof(unsigned int) * obj->firstIndex));
+}
+
+void drawObject(Object* obj)
+{
+	bindObject(obj);
+	drawBoundObject(obj);
+	unbindObject();
+}
+
+void drawObjectRanges(Object* obj, const GLsizei* counts, const GLvoid** offsets, int count)
+{
+	if (count == 0)
+		return;
+	bindObject(obj);
+	glMultiDrawElements(GL_TRIANGLE_STRIP, counts, GL_UNSIGNED_INT, offsets, count);
+	unbindObject();
+}
+
 void drawNormals(Object* obj)
 {
 	/* Enable vertex arrays and bind VBOs */
 	glEnableClientState(GL_VERTEX_ARRAY);
-	//glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
-	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
 
-	/* Draw object */
-	glVertexPointer(3, GL_FLOAT, 0, (void *) 0);
-	//glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
-	//glDrawArray(GL_LINES, obj->numVertices * 2, GL_UNSIGNED_INT, (void*)0);
-	glDrawArrays(GL_LINES, 0, obj->numVertices * 2);
+	/* Every vertex once, as a point; no indices, so strips repeat none */
+	glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)0);
+	glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
+	glDrawArrays(GL_POINTS, obj->firstVertex, obj->numVertices);
 
 	/* Unbind/disable arrays. could also push/pop enables */
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDisableClientState(GL_VERTEX_ARRAY);
-	//glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
 }
 
 void freeObject(Object* obj)
 {
-	glDeleteBuffers(1, &obj->vertexBuffer);
-	glDeleteBuffers(1, &obj->elementBuffer);
-	obj->vertexBuffer = 0;
-	obj->elementBuffer = 0;
-	obj->numElements = 0;
+	if (obj->clusters)
+		freeClusters(obj->clusters);
+	if (obj->mega) {
+		releaseMegaObject(obj->mega, obj);
+	} else {
+		resDeleteBuffer(obj->vertexBuffer);
+		resDeleteBuffer(obj->elementBuffer);
+	}
+	resFree(obj);
 }
 
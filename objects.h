@@ -12,6 +12,7 @@
 
 #include <GL/gl.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 typedef struct {
 	float x, y, z;
@@ -22,15 +23,41 @@ typedef struct {
 	vector_t norm;
 } vertex_t;
 
+struct ClusterSet;
+struct MegaBuffer;
+
 typedef struct ObjectType {
 	GLuint vertexBuffer;
 	GLuint elementBuffer;
   int numVertices;
 	int numElements;
+	vector_t boundsMin; /* object space AABB of the vertices */
+	vector_t boundsMax;
+	GLenum primitive;   /* of the mesh it was uploaded from */
+	struct ClusterSet* clusters; /* optional, see clusters.h */
+	struct MegaBuffer* mega;     /* buffers shared, see megabuffer.h */
+	int firstVertex;             /* where the data starts in them */
+	int firstIndex;
 } Object;
 
+/* Host side mesh data: an indexed triangle strip, or indexed triangles */
+typedef struct {
+	vertex_t* vertices;
+	unsigned int* indices;
+	int numVertices;
+	int numIndices;
+	GLenum primitive;    /* GL_TRIANGLE_STRIP or GL_TRIANGLES */
+} Mesh;
+
 typedef vertex_t (*ParametricObjFunc)(float, float, va_list*);
 
+/* Counters for the scratch memory mesh generation builds into */
+typedef struct {
+	size_t capacity; /* bytes reserved: the high-water mark */
+	long grows;      /* generations that had to enlarge the arena */
+	long reuses;     /* generations served without allocating */
+} ScratchStats;
+
 vertex_t parametricSphere(float u, float v, va_list* args); /* args: radius */
 vertex_t parametricTorus(float u, float v, va_list* args); /* args: inner-radius, outer-radius */
 vertex_t parametricWave(float u, float v, va_list* args); /* args: width, height, time */
@@ -43,8 +70,56 @@ USAGE:
 myobject = createObject(<a parametric function from the list above>, <tessellation x>, <tessellation y>, <function arguments (args)>);
 */
 Object* createObject(ParametricObjFunc parametric, int x, int y, ...);
+
+/*
+Regenerates obj in place, reusing its struct and buffers, so a steady
+stream of regenerations (eg. wave animation) allocates nothing.
+Creates the object if obj is NULL.
+*/
+Object* rebuildObject(Object* obj, ParametricObjFunc parametric, int x, int y, ...);
+
+/*
+Generates a mesh into the generator's scratch memory without uploading it.
+The mesh is only valid until the next generation.
+*/
+void generateMesh(Mesh* mesh, ParametricObjFunc parametric, int x, int y, ...);
+
+/*
+Generates a sphere by subdividing an icosahedron level times, as indexed
+GL_TRIANGLES: 10 * 4^level + 2 vertices, 20 * 4^level triangles. Unlike
+parametricSphere's grid, no rows collapse at the poles and there are no
+degenerate triangles. Each edge's midpoint is created once, looked up by
+its end points in a hash table. Uses the same scratch memory as
+generateMesh(), for its temporaries too.
+*/
+void generateIcosphere(Mesh* mesh, int level, float radius);
+
+/* Uploads mesh into obj's buffers, creating the object if obj is NULL */
+Object* uploadMesh(Object* obj, const Mesh* mesh);
+
+/* Object space AABB of the mesh's vertices */
+void meshBounds(const Mesh* mesh, vector_t* lo, vector_t* hi);
+
 void drawObject(Object* obj);
+
+/*
+drawObject() in parts, for drawing objects back to back: bind once, draw
+each object sharing those buffers (a mega buffer's, see megabuffer.h),
+then unbind.
+*/
+void bindObject(Object* obj);
+void drawBoundObject(Object* obj);
+void unbindObject();
+
+/* Draws count sub-ranges of obj's strip: byte offsets into the index buffer */
+void drawObjectRanges(Object* obj, const GLsizei* counts, const GLvoid** offsets, int count);
+
+/* Draws each vertex as a point, for a geometry shader to expand (normals.geom) */
 void drawNormals(Object* obj);
 void freeObject(Object* obj);
 
+/* Both act on the calling thread's scratch memory */
+const ScratchStats* objectScratchStats();
+void freeObjectScratch(); /* releases the generator's scratch memory */
+
 #endif
@@ -0,0 +1,68 @@
+/* overdraw.c */
+
+#include "overdraw.h"
+#include "resources.h"
+
+OverdrawCounter* createOverdrawCounter()
+{
+	OverdrawCounter* counter = (OverdrawCounter*)resMalloc(sizeof(OverdrawCounter), RES_ORIGIN);
+	glGenQueries(1, &counter->shadedQuery);
+	glGenQueries(1, &counter->coveredQuery);
+	resetOverdrawCounter(counter);
+	return counter;
+}
+
+void freeOverdrawCounter(OverdrawCounter* counter)
+{
+	glDeleteQueries(1, &counter->shadedQuery);
+	glDeleteQueries(1, &counter->coveredQuery);
+	resFree(counter);
+}
+
+void collectOverdraw(OverdrawCounter* counter)
+{
+	GLuint available;
+
+	if (!counter->pending)
+		return;
+	/* The covered query was issued last */
+	glGetQueryObjectuiv(counter->coveredQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+	glGetQueryObjectuiv(counter->shadedQuery, GL_QUERY_RESULT, &counter->shaded);
+	glGetQueryObjectuiv(counter->coveredQuery, GL_QUERY_RESULT, &counter->covered);
+	counter->pending = 0;
+}
+
+void beginShadedCount(OverdrawCounter* counter)
+{
+	glBeginQuery(GL_SAMPLES_PASSED, counter->shadedQuery);
+}
+
+void endShadedCount()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void beginCoveredCount(OverdrawCounter* counter)
+{
+	glBeginQuery(GL_SAMPLES_PASSED, counter->coveredQuery);
+}
+
+void endCoveredCount(OverdrawCounter* counter)
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	counter->pending = 1;
+}
+
+void resetOverdrawCounter(OverdrawCounter* counter)
+{
+	counter->pending = 0;
+	counter->shaded = 0;
+	counter->covered = 0;
+}
+
+double overdrawPerPixel(const OverdrawCounter* counter)
+{
+	return counter->covered ? counter->shaded / (double)counter->covered : 0.0;
+}
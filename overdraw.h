@@ -0,0 +1,48 @@
+/* overdraw.h */
+
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+/* For vertex buffer objects */
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+
+/*
+Counts shaded fragments per covered pixel with two occlusion queries:
+	shaded:  samples passing the depth test in the shading pass
+	covered: samples of the finished depth buffer, drawn again depth only
+	         with GL_EQUAL
+With a depth pre-pass the ratio is 1; without, it is how many layers paid
+for lighting only to be drawn over.
+
+Results are collected a frame or more later, whenever they are ready, so
+counting never stalls on the GPU.
+*/
+typedef struct {
+	GLuint shadedQuery;
+	GLuint coveredQuery;
+	int pending;      /* queries issued but not yet collected */
+	GLuint shaded;    /* results of the last frame counted */
+	GLuint covered;
+} OverdrawCounter;
+
+OverdrawCounter* createOverdrawCounter();
+void freeOverdrawCounter(OverdrawCounter* counter);
+
+/* Call once per frame; picks up finished results */
+void collectOverdraw(OverdrawCounter* counter);
+
+/* Bracket the shading pass, then the depth only pass over the same geometry */
+void beginShadedCount(OverdrawCounter* counter);
+void endShadedCount();
+void beginCoveredCount(OverdrawCounter* counter);
+void endCoveredCount(OverdrawCounter* counter);
+
+/* Forgets results, including any still in flight */
+void resetOverdrawCounter(OverdrawCounter* counter);
+
+/* Shaded fragments per covered pixel, or 0 before anything was counted */
+double overdrawPerPixel(const OverdrawCounter* counter);
+
+#endif
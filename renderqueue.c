@@ -0,0 +1,194 @@
+/* renderqueue.c */
+
+#include <string.h>
+
+#include "renderqueue.h"
+#include "resources.h"
+#include "bench.h"
+
+#define DEPTH_SHIFT 0
+#define MESH_SHIFT (DEPTH_SHIFT + RENDER_DEPTH_BITS)
+#define MATERIAL_SHIFT (MESH_SHIFT + RENDER_MESH_BITS)
+#define PROGRAM_SHIFT (MATERIAL_SHIFT + RENDER_MATERIAL_BITS)
+#define PASS_SHIFT (PROGRAM_SHIFT + RENDER_PROGRAM_BITS)
+
+#define FIELD(key, name) \
+	((int)(((key) >> name##_SHIFT) & ((1 << RENDER_##name##_BITS) - 1)))
+
+#define DIGIT_BITS 8
+#define DIGITS (64 / DIGIT_BITS)
+#define BUCKETS (1 << DIGIT_BITS)
+
+RenderQueue* createRenderQueue(int capacity)
+{
+	RenderQueue* queue = (RenderQueue*)resMalloc(sizeof(RenderQueue), RES_ORIGIN);
+	memset(queue, 0, sizeof(RenderQueue));
+	queue->maxDraws = capacity > 0 ? capacity : 1;
+	queue->draws = (RenderDraw*)resMalloc(sizeof(RenderDraw) * queue->maxDraws, RES_ORIGIN);
+	queue->scratch = (RenderDraw*)resMalloc(sizeof(RenderDraw) * queue->maxDraws, RES_ORIGIN);
+	return queue;
+}
+
+void freeRenderQueue(RenderQueue* queue)
+{
+	resFree(queue->draws);
+	resFree(queue->scratch);
+	resFree(queue);
+}
+
+static RenderKey field(int value, int bits, int shift)
+{
+	return (RenderKey)(value & ((1 << bits) - 1)) << shift;
+}
+
+RenderKey renderKey(int pass, int program, int material, int mesh, float depth)
+{
+	const int maxDepth = (1 << RENDER_DEPTH_BITS) - 1;
+	int quantized;
+
+	if (depth < 0.0f)
+		depth = 0.0f;
+	if (depth > 1.0f)
+		depth = 1.0f;
+	quantized = (int)(depth * maxDepth);
+
+	return field(pass, RENDER_PASS_BITS, PASS_SHIFT)
+		| field(program, RENDER_PROGRAM_BITS, PROGRAM_SHIFT)
+		| field(material, RENDER_MATERIAL_BITS, MATERIAL_SHIFT)
+		| field(mesh, RENDER_MESH_BITS, MESH_SHIFT)
+		| field(quantized, RENDER_DEPTH_BITS, DEPTH_SHIFT);
+}
+
+void beginRenderQueue(RenderQueue* queue)
+{
+	queue->numDraws = 0;
+}
+
+void submitDraw(RenderQueue* queue, RenderKey key, int payload)
+{
+	if (queue->numDraws == queue->maxDraws)
+	{
+		queue->maxDraws *= 2;
+		queue->draws = (RenderDraw*)resRealloc(queue->draws,
+				sizeof(RenderDraw) * queue->maxDraws, RES_ORIGIN);
+		queue->scratch = (RenderDraw*)resRealloc(queue->scratch,
+				sizeof(RenderDraw) * queue->maxDraws, RES_ORIGIN);
+	}
+	queue->draws[queue->numDraws].key = key;
+	queue->draws[queue->numDraws].payload = payload;
+	queue->numDraws++;
+}
+
+/* Walks the draws in order, calling back for each field that changes.
+ * Returns the switches, and fills in the per field counts if stats isn't NULL. */
+static int countSwitches(const RenderDraw* draws, int count, const RenderCallbacks* callbacks,
+		void* data, RenderQueueStats* stats)
+{
+	int pass = -1, program = -1, material = -1, mesh = -1;
+	int switches[4] = {0, 0, 0, 0};
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		RenderKey key = draws[i].key;
+		if (FIELD(key, PASS) != pass)
+		{
+			pass = FIELD(key, PASS);
+			switches[0]++;
+			if (callbacks && callbacks->pass)
+				callbacks->pass(data, pass);
+		}
+		if (FIELD(key, PROGRAM) != program)
+		{
+			program = FIELD(key, PROGRAM);
+			switches[1]++;
+			if (callbacks && callbacks->program)
+				callbacks->program(data, program);
+		}
+		if (FIELD(key, MATERIAL) != material)
+		{
+			material = FIELD(key, MATERIAL);
+			switches[2]++;
+			if (callbacks && callbacks->material)
+				callbacks->material(data, material);
+		}
+		if (FIELD(key, MESH) != mesh)
+		{
+			mesh = FIELD(key, MESH);
+			switches[3]++;
+			if (callbacks && callbacks->mesh)
+				callbacks->mesh(data, mesh);
+		}
+		if (callbacks)
+			callbacks->draw(data, draws[i].payload);
+	}
+
+	if (stats)
+	{
+		stats->passSwitches = switches[0];
+		stats->programSwitches = switches[1];
+		stats->materialSwitches = switches[2];
+		stats->meshSwitches = switches[3];
+	}
+	return switches[0] + switches[1] + switches[2] + switches[3];
+}
+
+void sortRenderQueue(RenderQueue* queue)
+{
+	int counts[DIGITS][BUCKETS];
+	RenderDraw* from = queue->draws;
+	RenderDraw* to = queue->scratch;
+	RenderDraw* swap;
+	double start = benchNow();
+	int digit, i, sum, offset;
+
+	queue->stats.unsortedSwitches = countSwitches(queue->draws, queue->numDraws, NULL, NULL, NULL);
+
+	/* Every digit's histogram in one pass */
+	memset(counts, 0, sizeof counts);
+	for (i = 0; i < queue->numDraws; ++i)
+	{
+		RenderKey key = from[i].key;
+		for (digit = 0; digit < DIGITS; ++digit)
+			counts[digit][(key >> (digit * DIGIT_BITS)) & (BUCKETS - 1)]++;
+	}
+
+	queue->stats.digits = 0;
+	for (digit = 0; digit < DIGITS; ++digit)
+	{
+		int* count = counts[digit];
+		int shift = digit * DIGIT_BITS;
+
+		/* Every key has the same digit here: the order wouldn't change */
+		if (queue->numDraws == 0
+				|| count[(from[0].key >> shift) & (BUCKETS - 1)] == queue->numDraws)
+			continue;
+
+		/* Counts become each bucket's first slot */
+		for (i = 0, sum = 0; i < BUCKETS; ++i)
+		{
+			offset = count[i];
+			count[i] = sum;
+			sum += offset;
+		}
+		for (i = 0; i < queue->numDraws; ++i)
+			to[count[(from[i].key >> shift) & (BUCKETS - 1)]++] = from[i];
+
+		swap = from;
+		from = to;
+		to = swap;
+		queue->stats.digits++;
+	}
+
+	/* The sorted draws always end up in queue->draws */
+	queue->draws = from;
+	queue->scratch = to;
+	queue->stats.sortMs = benchNow() - start;
+}
+
+void executeRenderQueue(RenderQueue* queue, const RenderCallbacks* callbacks, void* data)
+{
+	queue->stats.draws = queue->numDraws;
+	queue->stats.switches = countSwitches(queue->draws, queue->numDraws, callbacks, data,
+			&queue->stats);
+}
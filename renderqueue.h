@@ -0,0 +1,89 @@
+/* renderqueue.h */
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <stdint.h>
+
+/*
+Draws submitted in any order and executed in an order that changes as
+little state as possible. Each draw is a 64 bit sort key and a payload
+index the caller interprets (eg. a scene instance). The key holds, from
+the most significant bits down:
+
+	pass      4 bits   eg. depth pre-pass before shading
+	program   8 bits   the program variant
+	material 12 bits
+	mesh     16 bits
+	depth    24 bits   0 nearest, so each batch draws front to back
+
+Sorting the keys as integers groups every draw by pass, then program and
+so on, and each group is drawn with its state set once:
+
+	beginRenderQueue(queue);
+	submitDraw(queue, renderKey(pass, program, material, mesh, depth), index); ...
+	sortRenderQueue(queue);
+	executeRenderQueue(queue, &callbacks, data);
+
+The sort is a stable least significant digit radix sort, 8 bits a digit;
+one pass over the keys counts every digit, and digits all keys share (a
+single pass or program, typically) are skipped. The queue touches no GL:
+callbacks set the state and draw.
+*/
+#define RENDER_PASS_BITS 4
+#define RENDER_PROGRAM_BITS 8
+#define RENDER_MATERIAL_BITS 12
+#define RENDER_MESH_BITS 16
+#define RENDER_DEPTH_BITS 24
+
+typedef uint64_t RenderKey;
+
+typedef struct {
+	RenderKey key;
+	int payload;
+} RenderDraw;
+
+/* data is executeRenderQueue()'s; value a key field, or the payload */
+typedef void (*RenderFunc)(void* data, int value);
+
+/* Called only when the field differs from the previous draw's */
+typedef struct {
+	RenderFunc pass;
+	RenderFunc program;
+	RenderFunc material;
+	RenderFunc mesh;
+	RenderFunc draw;     /* every draw, with its payload */
+} RenderCallbacks;
+
+typedef struct {
+	int draws;
+	int passSwitches;    /* of the last execute, the first draw's included */
+	int programSwitches;
+	int materialSwitches;
+	int meshSwitches;
+	int switches;        /* all of the above */
+	int unsortedSwitches; /* what drawing in submission order would have taken */
+	int digits;          /* radix passes the sort needed */
+	double sortMs;
+} RenderQueueStats;
+
+typedef struct {
+	RenderDraw* draws;
+	RenderDraw* scratch; /* the sort's other buffer */
+	int numDraws;
+	int maxDraws;
+	RenderQueueStats stats;
+} RenderQueue;
+
+RenderQueue* createRenderQueue(int capacity);
+void freeRenderQueue(RenderQueue* queue);
+
+/* Fields are masked to their widths; depth is clamped to [0, 1] */
+RenderKey renderKey(int pass, int program, int material, int mesh, float depth);
+
+void beginRenderQueue(RenderQueue* queue);
+void submitDraw(RenderQueue* queue, RenderKey key, int payload);
+void sortRenderQueue(RenderQueue* queue);
+void executeRenderQueue(RenderQueue* queue, const RenderCallbacks* callbacks, void* data);
+
+#endif
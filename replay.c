@@ -0,0 +1,244 @@
+/* replay.c */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+#include "bench.h"
+
+#define EVENT_SIZE 12
+
+enum {
+	MODE_NONE,
+	MODE_RECORD,
+	MODE_PLAY
+};
+
+static int mode = MODE_NONE;
+static FILE* file = NULL;
+static FILE* timings = NULL;
+static long frame = 0;
+static Uint32 delta = 0; /* of the frame being replayed */
+
+/* Events of the frame being recorded; the count is written first */
+static unsigned char pending[REPLAY_MAX_EVENTS][EVENT_SIZE];
+static int numPending = 0;
+
+static void put16(unsigned char* p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char* p, Uint32 v)
+{
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+
+static unsigned int get16(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static Uint32 get32(const unsigned char* p)
+{
+	return get16(p) | ((Uint32)get16(p + 2) << 16);
+}
+
+int replayStartRecording(const char* filename, int width, int height)
+{
+	unsigned char header[12];
+
+	file = fopen(filename, "wb");
+	if (!file)
+	{
+		printf("Error: could not record to %s\n", filename);
+		return -1;
+	}
+	memcpy(header, REPLAY_MAGIC, 4);
+	put32(header + 4, REPLAY_VERSION);
+	put16(header + 8, width);
+	put16(header + 10, height);
+	fwrite(header, sizeof header, 1, file);
+
+	mode = MODE_RECORD;
+	frame = 0;
+	numPending = 0;
+	printf("Recording input to %s\n", filename);
+	return 0;
+}
+
+int replayStartPlayback(const char* filename, int* width, int* height)
+{
+	unsigned char header[12];
+
+	file = fopen(filename, "rb");
+	if (!file)
+	{
+		printf("Error: could not open %s\n", filename);
+		return -1;
+	}
+	if (fread(header, sizeof header, 1, file) != 1
+			|| memcmp(header, REPLAY_MAGIC, 4) != 0
+			|| get32(header + 4) != REPLAY_VERSION)
+	{
+		printf("Error: %s is not a version %d recording\n", filename, REPLAY_VERSION);
+		fclose(file);
+		file = NULL;
+		return -1;
+	}
+	*width = get16(header + 8);
+	*height = get16(header + 10);
+
+	timings = benchOpen("replay", "frame,delta_ms,update_ms,display_ms,frame_ms");
+	mode = MODE_PLAY;
+	frame = 0;
+	printf("Replaying %s\n", filename);
+	return 0;
+}
+
+int replayRecording()
+{
+	return mode == MODE_RECORD;
+}
+
+int replayPlaying()
+{
+	return mode == MODE_PLAY;
+}
+
+void replayRecordEvent(const SDL_Event* event)
+{
+	unsigned char* p;
+
+	if (mode != MODE_RECORD || numPending == REPLAY_MAX_EVENTS)
+		return;
+	p = pending[numPending];
+	memset(p, 0, EVENT_SIZE);
+	p[0] = event->type;
+	switch (event->type)
+	{
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		p[1] = event->key.state;
+		put16(p + 4, event->key.keysym.sym);
+		put16(p + 6, event->key.keysym.mod);
+		break;
+	case SDL_MOUSEMOTION:
+		p[1] = event->motion.state;
+		put16(p + 4, event->motion.x);
+		put16(p + 6, event->motion.y);
+		put16(p + 8, (Uint16)event->motion.xrel);
+		put16(p + 10, (Uint16)event->motion.yrel);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		p[1] = event->button.state;
+		p[2] = event->button.button;
+		put16(p + 4, event->button.x);
+		put16(p + 6, event->button.y);
+		break;
+	case SDL_VIDEORESIZE:
+		put16(p + 4, event->resize.w);
+		put16(p + 6, event->resize.h);
+		break;
+	case SDL_QUIT:
+		break;
+	default:
+		return; /* nothing the program reacts to */
+	}
+	numPending++;
+}
+
+void replayRecordFrame(Uint32 milliseconds)
+{
+	unsigned char header[6];
+
+	if (mode != MODE_RECORD)
+		return;
+	put32(header, milliseconds);
+	put16(header + 4, numPending);
+	fwrite(header, sizeof header, 1, file);
+	fwrite(pending, EVENT_SIZE, numPending, file);
+	numPending = 0;
+	frame++;
+}
+
+int replayNextFrame(SDL_Event* events, int max, int* count, Uint32* milliseconds)
+{
+	unsigned char header[6];
+	unsigned char p[EVENT_SIZE];
+	int i, n;
+
+	*count = 0;
+	if (mode != MODE_PLAY || fread(header, sizeof header, 1, file) != 1)
+		return 0;
+	*milliseconds = delta = get32(header);
+	n = get16(header + 4);
+
+	for (i = 0; i < n; ++i)
+	{
+		SDL_Event* event = &events[*count];
+		if (fread(p, EVENT_SIZE, 1, file) != 1)
+			return 0;
+		if (*count == max)
+			continue;
+		memset(event, 0, sizeof(SDL_Event));
+		event->type = p[0];
+		switch (p[0])
+		{
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			event->key.state = p[1];
+			event->key.keysym.sym = (SDLKey)get16(p + 4);
+			event->key.keysym.mod = (SDLMod)get16(p + 6);
+			break;
+		case SDL_MOUSEMOTION:
+			event->motion.state = p[1];
+			event->motion.x = get16(p + 4);
+			event->motion.y = get16(p + 6);
+			event->motion.xrel = (Sint16)get16(p + 8);
+			event->motion.yrel = (Sint16)get16(p + 10);
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			event->button.state = p[1];
+			event->button.button = p[2];
+			event->button.x = get16(p + 4);
+			event->button.y = get16(p + 6);
+			break;
+		case SDL_VIDEORESIZE:
+			event->resize.w = get16(p + 4);
+			event->resize.h = get16(p + 6);
+			break;
+		}
+		(*count)++;
+	}
+	frame++;
+	return 1;
+}
+
+void replayFrameTiming(double updateMs, double displayMs)
+{
+	if (mode != MODE_PLAY || !timings)
+		return;
+	fprintf(timings, "%ld,%lu,%.3f,%.3f,%.3f\n", frame, (unsigned long)delta,
+			updateMs, displayMs, updateMs + displayMs);
+}
+
+void replayStop()
+{
+	if (mode == MODE_NONE)
+		return;
+	if (mode == MODE_RECORD)
+		printf("Recorded %ld frames\n", frame);
+	else
+		printf("Replayed %ld frames\n", frame);
+	fclose(file);
+	file = NULL;
+	if (timings)
+		fclose(timings);
+	timings = NULL;
+	mode = MODE_NONE;
+}
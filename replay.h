@@ -0,0 +1,47 @@
+/* replay.h */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <SDL/SDL.h>
+
+/*
+Records the input events and frame deltas the main loop sees, so the same
+interaction can be replayed exactly with a simulated clock:
+
+	ass2-base --record session.rec
+	ass2-base --replay session.rec
+
+The file is a small header (magic, version, window size) followed by one
+record per frame: its delta in milliseconds, its event count and the
+events, 12 bytes each, all little endian. Only keyboard, mouse, resize and
+quit events are kept. While replaying, per frame update/display times are
+written to bench-replay.csv so runs of different builds line up frame by
+frame. Replaying needs update and display in step, so not --threaded.
+*/
+#define REPLAY_MAGIC "RTRR"
+#define REPLAY_VERSION 1
+#define REPLAY_MAX_EVENTS 256 /* per frame, any more are dropped */
+
+/* Both return 0 on success */
+int replayStartRecording(const char* filename, int width, int height);
+int replayStartPlayback(const char* filename, int* width, int* height);
+
+int replayRecording();
+int replayPlaying();
+
+/* Recording: call for every event handled this frame, then once at its end */
+void replayRecordEvent(const SDL_Event* event);
+void replayRecordFrame(Uint32 milliseconds);
+
+/*
+Playback: reads the next frame's events (at most max) and delta.
+Returns 0 once the recording has ended.
+*/
+int replayNextFrame(SDL_Event* events, int max, int* count, Uint32* milliseconds);
+void replayFrameTiming(double updateMs, double displayMs);
+
+/* Finishes the file being written or read */
+void replayStop();
+
+#endif
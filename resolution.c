@@ -0,0 +1,190 @@
+/* resolution.c */
+
+#include <stdio.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "resolution.h"
+#include "resources.h"
+#include "bench.h"
+
+#define SMOOTHING 0.2 /* weight of the newest frame time */
+
+static GLuint createTarget(GLint internalFormat, GLenum format, GLenum type,
+		int width, int height, size_t texelSize)
+{
+	GLuint texture = resGenTexture(RES_ORIGIN);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	resTexImage2D(texture, internalFormat, width, height, format, type, NULL, texelSize);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+static void freeTargets(ResolutionScaler* scaler)
+{
+	if (scaler->colorTexture)
+		resDeleteTexture(scaler->colorTexture);
+	if (scaler->depthTexture)
+		resDeleteTexture(scaler->depthTexture);
+	scaler->colorTexture = 0;
+	scaler->depthTexture = 0;
+}
+
+ResolutionScaler* createResolutionScaler()
+{
+	ResolutionScaler* scaler = (ResolutionScaler*)resMalloc(sizeof(ResolutionScaler), RES_ORIGIN);
+	scaler->supported = GLEW_EXT_framebuffer_object;
+	scaler->framebuffer = 0;
+	scaler->colorTexture = 0;
+	scaler->depthTexture = 0;
+	scaler->width = scaler->height = 0;
+	scaler->renderWidth = scaler->renderHeight = 0;
+	scaler->scale = 1.0f;
+	resetResolutionScaler(scaler);
+	if (scaler->supported)
+		glGenFramebuffersEXT(1, &scaler->framebuffer);
+	else
+		printf("EXT_framebuffer_object not supported: no dynamic resolution\n");
+	return scaler;
+}
+
+void freeResolutionScaler(ResolutionScaler* scaler)
+{
+	freeTargets(scaler);
+	if (scaler->framebuffer)
+		glDeleteFramebuffersEXT(1, &scaler->framebuffer);
+	resFree(scaler);
+}
+
+void resizeResolutionScaler(ResolutionScaler* scaler, int width, int height)
+{
+	GLenum status;
+
+	if (!scaler->supported || (width == scaler->width && height == scaler->height))
+		return;
+	scaler->width = width;
+	scaler->height = height;
+
+	freeTargets(scaler);
+	scaler->colorTexture = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height, 4);
+	scaler->depthTexture = createTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT,
+			GL_UNSIGNED_INT, width, height, 4);
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, scaler->framebuffer);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+			GL_TEXTURE_2D, scaler->colorTexture, 0);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+			GL_TEXTURE_2D, scaler->depthTexture, 0);
+	status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		printf("Dynamic resolution framebuffer incomplete (%#x), disabled\n", status);
+		freeTargets(scaler);
+		scaler->supported = 0;
+	}
+}
+
+void resetResolutionScaler(ResolutionScaler* scaler)
+{
+	scaler->frameMs = 0.0;
+	scaler->lastFrame = 0.0;
+}
+
+/* Cost goes with area, so each side scales by the root of the time ratio */
+static void updateScale(ResolutionScaler* scaler, float targetMs)
+{
+	double now = benchNow();
+	float step;
+
+	if (scaler->lastFrame != 0.0)
+	{
+		double ms = now - scaler->lastFrame;
+		scaler->frameMs = scaler->frameMs == 0.0 ? ms :
+				scaler->frameMs + SMOOTHING * (ms - scaler->frameMs);
+	}
+	scaler->lastFrame = now;
+
+	if (scaler->frameMs == 0.0 || fabs(scaler->frameMs - targetMs) < targetMs * RESOLUTION_DEADBAND)
+		return;
+	step = (float)sqrt(targetMs / scaler->frameMs);
+	if (step > 1.0f + RESOLUTION_MAX_STEP)
+		step = 1.0f + RESOLUTION_MAX_STEP;
+	if (step < 1.0f - RESOLUTION_MAX_STEP)
+		step = 1.0f - RESOLUTION_MAX_STEP;
+	scaler->scale *= step;
+	if (scaler->scale > 1.0f)
+		scaler->scale = 1.0f;
+	if (scaler->scale < RESOLUTION_MIN_SCALE)
+		scaler->scale = RESOLUTION_MIN_SCALE;
+}
+
+void beginScaledFrame(ResolutionScaler* scaler, float targetMs)
+{
+	if (!scaler->supported)
+		return;
+	updateScale(scaler, targetMs);
+	scaler->renderWidth = (int)(scaler->width * scaler->scale + 0.5f);
+	scaler->renderHeight = (int)(scaler->height * scaler->scale + 0.5f);
+	if (scaler->renderWidth < 1)
+		scaler->renderWidth = 1;
+	if (scaler->renderHeight < 1)
+		scaler->renderHeight = 1;
+
+	/* The scissor keeps glClear to the corner being drawn */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, scaler->framebuffer);
+	glViewport(0, 0, scaler->renderWidth, scaler->renderHeight);
+	glScissor(0, 0, scaler->renderWidth, scaler->renderHeight);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void endScaledFrame(ResolutionScaler* scaler)
+{
+	float s, t;
+
+	if (!scaler->supported)
+		return;
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	glViewport(0, 0, scaler->width, scaler->height);
+
+	/* Only the drawn corner of the texture is stretched */
+	s = scaler->renderWidth / (float)scaler->width;
+	t = scaler->renderHeight / (float)scaler->height;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT | GL_TEXTURE_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, scaler->colorTexture);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glBegin(GL_QUADS);
+		glTexCoord2f(0, 0); glVertex2f(-1, -1);
+		glTexCoord2f(s, 0); glVertex2f(1, -1);
+		glTexCoord2f(s, t); glVertex2f(1, 1);
+		glTexCoord2f(0, t); glVertex2f(-1, 1);
+	glEnd();
+
+	glPopMatrix();	/* Pop modelview */
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();	/* Pop projection */
+	glMatrixMode(GL_MODELVIEW);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPopAttrib();
+}
@@ -0,0 +1,59 @@
+/* resolution.h */
+
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+/* For vertex buffer objects */
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+
+/*
+Dynamic resolution: the scene is drawn into an offscreen framebuffer at a
+fraction of the window size, then stretched over the window. A controller
+adjusts the fraction every frame to hold a target frame time, assuming the
+cost scales with the pixel count:
+
+	beginScaledFrame(scaler, targetMs);
+	... draw the scene ...
+	endScaledFrame(scaler);
+	... draw overlays at window resolution ...
+
+The framebuffer is allocated at the window size, so changing the scale
+never reallocates; only a corner of it is drawn to.
+With vsync the frame time never drops below the refresh interval, so a
+target under it only drives the scale down.
+Needs EXT_framebuffer_object; scaler->supported is 0 without it.
+*/
+#define RESOLUTION_MIN_SCALE 0.25f
+#define RESOLUTION_DEADBAND 0.05  /* fraction of the target left alone */
+#define RESOLUTION_MAX_STEP 0.1f  /* largest change in scale per frame */
+
+typedef struct {
+	int supported;
+	GLuint framebuffer;
+	GLuint colorTexture;
+	GLuint depthTexture;
+	int width, height;             /* window size, and the allocation */
+	int renderWidth, renderHeight; /* of the current frame */
+	float scale;                   /* of each side, RESOLUTION_MIN_SCALE-1 */
+	double frameMs;                /* smoothed time between frames */
+	double lastFrame;              /* benchNow() at the last begin, or 0 */
+} ResolutionScaler;
+
+ResolutionScaler* createResolutionScaler();
+void freeResolutionScaler(ResolutionScaler* scaler);
+
+/* Reallocates the framebuffer for a new window size; call from reshape() */
+void resizeResolutionScaler(ResolutionScaler* scaler, int width, int height);
+
+/* Updates the scale from the last frame's time, then draws to the framebuffer */
+void beginScaledFrame(ResolutionScaler* scaler, float targetMs);
+
+/* Stretches the frame over the window and draws to the window again */
+void endScaledFrame(ResolutionScaler* scaler);
+
+/* Forgets the last frame time, eg. after drawing at full resolution for a while */
+void resetResolutionScaler(ResolutionScaler* scaler);
+
+#endif
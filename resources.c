@@ -0,0 +1,365 @@
+/* resources.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <SDL/SDL.h>
+
+#include "resources.h"
+
+enum {
+	KIND_EMPTY = 0,
+	KIND_BUFFER,
+	KIND_PROGRAM,
+	KIND_HOST,
+	KIND_TEXTURE,
+	KIND_DELETED
+};
+
+static const char* kind_names[] = { "", "buffer", "program", "host", "texture", "" };
+
+typedef struct {
+	int kind;
+	uintptr_t key;  /* GL handle or host pointer */
+	size_t size;
+	const char* file;
+	int line;
+} Record;
+
+/* Open addressing hash table keyed by (kind, key) */
+static Record* table = NULL;
+static size_t capacity = 0;
+static size_t used = 0; /* live + deleted slots */
+
+static ResourceStats stats;
+
+/* The render thread uploads and frees while the main thread generates */
+static SDL_mutex* mutex = NULL;
+
+void resInit()
+{
+	assert(!mutex && "resInit called twice");
+	mutex = SDL_CreateMutex();
+}
+
+void resQuit()
+{
+	SDL_DestroyMutex(mutex);
+	mutex = NULL;
+}
+
+static void lock()
+{
+	assert(mutex && "resInit not called");
+	SDL_LockMutex(mutex);
+}
+
+static void unlock()
+{
+	SDL_UnlockMutex(mutex);
+}
+
+static size_t hashKey(int kind, uintptr_t key)
+{
+	uint64_t h = ((uint64_t)key << 2) ^ (uint64_t)kind;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+static Record* findSlot(Record* slots, size_t cap, int kind, uintptr_t key, int forInsert)
+{
+	size_t i = hashKey(kind, key) & (cap - 1);
+	Record* tomb = NULL;
+	for (;;)
+	{
+		Record* r = &slots[i];
+		if (r->kind == KIND_EMPTY)
+			return (forInsert && tomb) ? tomb : (forInsert ? r : NULL);
+		if (r->kind == KIND_DELETED)
+		{
+			if (!tomb) tomb = r;
+		}
+		else if (r->kind == kind && r->key == key)
+			return r;
+		i = (i + 1) & (cap - 1);
+	}
+}
+
+static void grow()
+{
+	size_t i, newCap = capacity ? capacity * 2 : 256;
+	Record* slots = (Record*)calloc(newCap, sizeof(Record));
+	used = 0;
+	for (i = 0; i < capacity; ++i)
+	{
+		if (table[i].kind != KIND_EMPTY && table[i].kind != KIND_DELETED)
+		{
+			*findSlot(slots, newCap, table[i].kind, table[i].key, 1) = table[i];
+			++used;
+		}
+	}
+	free(table);
+	table = slots;
+	capacity = newCap;
+}
+
+static void account(int kind, long delta)
+{
+	if (kind == KIND_HOST)
+	{
+		stats.hostBytes += delta;
+		if (stats.hostBytes > stats.hostPeak)
+			stats.hostPeak = stats.hostBytes;
+	}
+	else if (kind == KIND_BUFFER || kind == KIND_TEXTURE)
+	{
+		stats.gpuBytes += delta;
+		if (stats.gpuBytes > stats.gpuPeak)
+			stats.gpuPeak = stats.gpuBytes;
+	}
+}
+
+static void insert(int kind, uintptr_t key, size_t size, const char* file, int line)
+{
+	Record* r;
+	if ((used + 1) * 2 > capacity)
+		grow();
+	r = findSlot(table, capacity, kind, key, 1);
+	if (r->kind == KIND_EMPTY)
+		++used;
+	r->kind = kind;
+	r->key = key;
+	r->size = size;
+	r->file = file;
+	r->line = line;
+	account(kind, size);
+}
+
+static Record* lookup(int kind, uintptr_t key)
+{
+	if (!table)
+		return NULL;
+	return findSlot(table, capacity, kind, key, 0);
+}
+
+static void removeRecord(Record* r)
+{
+	account(r->kind, -(long)r->size);
+	r->kind = KIND_DELETED;
+}
+
+void* resMalloc(size_t size, const char* file, int line)
+{
+	void* ptr = malloc(size);
+	if (!ptr)
+		return NULL;
+	lock();
+	insert(KIND_HOST, (uintptr_t)ptr, size, file, line);
+	stats.allocations++;
+	stats.totalAllocations++;
+	unlock();
+	return ptr;
+}
+
+void* resRealloc(void* ptr, size_t size, const char* file, int line)
+{
+	Record* r;
+	void* newPtr;
+	if (!ptr)
+		return resMalloc(size, file, line);
+
+	lock();
+	r = lookup(KIND_HOST, (uintptr_t)ptr);
+	assert(r && "resRealloc of untracked pointer");
+	newPtr = realloc(ptr, size);
+	if (!newPtr)
+	{
+		unlock();
+		return NULL;
+	}
+	if (size > r->size)
+		stats.totalAllocations++;
+	removeRecord(r);
+	insert(KIND_HOST, (uintptr_t)newPtr, size, file, line);
+	unlock();
+	return newPtr;
+}
+
+void resFree(void* ptr)
+{
+	Record* r;
+	if (!ptr)
+		return;
+	lock();
+	r = lookup(KIND_HOST, (uintptr_t)ptr);
+	assert(r && "resFree of untracked pointer");
+	if (r)
+	{
+		removeRecord(r);
+		stats.allocations--;
+	}
+	unlock();
+	free(ptr);
+}
+
+GLuint resGenBuffer(const char* file, int line)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	lock();
+	insert(KIND_BUFFER, buffer, 0, file, line);
+	stats.buffers++;
+	unlock();
+	return buffer;
+}
+
+/* NOTE: buffer must be bound to target */
+void resBufferData(GLenum target, GLuint buffer, GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+	Record* r;
+	glBufferData(target, size, data, usage);
+	lock();
+	r = lookup(KIND_BUFFER, buffer);
+	assert(r && "resBufferData on untracked buffer");
+	if (r)
+	{
+		account(KIND_BUFFER, (long)size - (long)r->size);
+		r->size = size;
+	}
+	unlock();
+}
+
+void resDeleteBuffer(GLuint buffer)
+{
+	Record* r;
+	if (!buffer)
+		return;
+	lock();
+	r = lookup(KIND_BUFFER, buffer);
+	if (r)
+	{
+		removeRecord(r);
+		stats.buffers--;
+	}
+	unlock();
+	glDeleteBuffers(1, &buffer);
+}
+
+GLuint resGenTexture(const char* file, int line)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	lock();
+	insert(KIND_TEXTURE, texture, 0, file, line);
+	stats.textures++;
+	unlock();
+	return texture;
+}
+
+/* NOTE: texture must be bound to GL_TEXTURE_2D */
+void resTexImage2D(GLuint texture, GLint internalFormat, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, const GLvoid* data, size_t texelSize)
+{
+	Record* r;
+	size_t size = (size_t)width * height * texelSize;
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+	lock();
+	r = lookup(KIND_TEXTURE, texture);
+	assert(r && "resTexImage2D on untracked texture");
+	if (r)
+	{
+		account(KIND_TEXTURE, (long)size - (long)r->size);
+		r->size = size;
+	}
+	unlock();
+}
+
+void resDeleteTexture(GLuint texture)
+{
+	Record* r;
+	if (!texture)
+		return;
+	lock();
+	r = lookup(KIND_TEXTURE, texture);
+	if (r)
+	{
+		removeRecord(r);
+		stats.textures--;
+	}
+	unlock();
+	glDeleteTextures(1, &texture);
+}
+
+GLuint resTrackProgram(GLuint program, const char* file, int line)
+{
+	/* GL does not expose program storage, so programs are counted only */
+	if (program)
+	{
+		lock();
+		insert(KIND_PROGRAM, program, 0, file, line);
+		stats.programs++;
+		unlock();
+	}
+	return program;
+}
+
+void resDeleteProgram(GLuint program)
+{
+	Record* r;
+	if (!program)
+		return;
+	lock();
+	r = lookup(KIND_PROGRAM, program);
+	if (r)
+	{
+		removeRecord(r);
+		stats.programs--;
+	}
+	unlock();
+	glDeleteProgram(program);
+}
+
+ResourceStats resStats()
+{
+	ResourceStats copy;
+	lock();
+	copy = stats;
+	unlock();
+	return copy;
+}
+
+void resFormatStats(char* buffer, size_t size)
+{
+	const double mb = 1024.0 * 1024.0;
+	lock();
+	snprintf(buffer, size,
+			"GPU: %.2f MB (peak %.2f MB, %d buffers, %d textures)  host: %.2f MB (peak %.2f MB, %d allocs)",
+			stats.gpuBytes / mb, stats.gpuPeak / mb, stats.buffers, stats.textures,
+			stats.hostBytes / mb, stats.hostPeak / mb, stats.allocations);
+	unlock();
+}
+
+int resReportLeaks()
+{
+	size_t i;
+	int leaks = 0;
+	lock();
+	for (i = 0; i < capacity; ++i)
+	{
+		Record* r = &table[i];
+		if (r->kind == KIND_EMPTY || r->kind == KIND_DELETED)
+			continue;
+		printf("Leak: %s %#lx (%lu bytes) from %s:%i\n", kind_names[r->kind],
+				(unsigned long)r->key, (unsigned long)r->size, r->file, r->line);
+		++leaks;
+	}
+	printf("Resources: %i leaks, peak GPU %lu bytes, peak host %lu bytes\n",
+			leaks, (unsigned long)stats.gpuPeak, (unsigned long)stats.hostPeak);
+	unlock();
+	return leaks;
+}
@@ -0,0 +1,70 @@
+/* resources.h */
+
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <stddef.h>
+
+/* For vertex buffer objects */
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+
+/*
+Registry of every GL buffer, texture, program and host allocation made by the
+program, with its size and the file/line it came from. Pass RES_ORIGIN as
+the origin arguments, eg:
+
+	vertices = resMalloc(sizeof(vertex_t) * n, RES_ORIGIN);
+	buffer = resGenBuffer(RES_ORIGIN);
+	resBufferData(GL_ARRAY_BUFFER, buffer, bytes, vertices, GL_STATIC_DRAW);
+
+Anything still registered when resReportLeaks() is called is a leak.
+The registry is safe to use from the main and render threads at once, once
+resInit() has been called (before any other thread starts).
+*/
+#define RES_ORIGIN __FILE__, __LINE__
+
+typedef struct {
+	size_t gpuBytes;    /* live buffer and texture storage */
+	size_t gpuPeak;
+	size_t hostBytes;   /* live resMalloc'd memory */
+	size_t hostPeak;
+	int buffers;        /* live handle/allocation counts */
+	int textures;
+	int programs;
+	int allocations;
+	long totalAllocations; /* resMalloc/growing resRealloc calls since start */
+} ResourceStats;
+
+/* Creates the registry's lock; resQuit() destroys it, after the last use */
+void resInit();
+void resQuit();
+
+void* resMalloc(size_t size, const char* file, int line);
+/* Keeps the first min(old, new size) bytes, as realloc() does */
+void* resRealloc(void* ptr, size_t size, const char* file, int line);
+void resFree(void* ptr);
+
+GLuint resGenBuffer(const char* file, int line);
+void resBufferData(GLenum target, GLuint buffer, GLsizeiptr size, const GLvoid* data, GLenum usage);
+void resDeleteBuffer(GLuint buffer);
+
+GLuint resGenTexture(const char* file, int line);
+void resTexImage2D(GLuint texture, GLint internalFormat, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, const GLvoid* data, size_t texelSize);
+void resDeleteTexture(GLuint texture);
+
+GLuint resTrackProgram(GLuint program, const char* file, int line);
+void resDeleteProgram(GLuint program);
+
+/* A consistent copy, taken under the registry's lock */
+ResourceStats resStats();
+
+/* Formats live/peak memory into buffer as a single OSD line */
+void resFormatStats(char* buffer, size_t size);
+
+/* Prints every resource still registered. Returns the number of leaks. */
+int resReportLeaks();
+
+#endif
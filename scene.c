@@ -0,0 +1,279 @@
+/* scene.c */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "scene.h"
+#include "resources.h"
+#include "bench.h"
+
+/* qsort has no context argument */
+static const Scene* sort_scene;
+static int sort_axis;
+
+static float centroid(const SceneObject* obj, int axis)
+{
+	const float* lo = &obj->boundsMin.x;
+	const float* hi = &obj->boundsMax.x;
+	return lo[axis] + hi[axis];
+}
+
+static int compareCentroids(const void* a, const void* b)
+{
+	float ca = centroid(&sort_scene->objects[*(const int*)a], sort_axis);
+	float cb = centroid(&sort_scene->objects[*(const int*)b], sort_axis);
+	return (ca > cb) - (ca < cb);
+}
+
+static void boxUnion(vector_t* lo, vector_t* hi, vector_t bmin, vector_t bmax)
+{
+	lo->x = fminf(lo->x, bmin.x); hi->x = fmaxf(hi->x, bmax.x);
+	lo->y = fminf(lo->y, bmin.y); hi->y = fmaxf(hi->y, bmax.y);
+	lo->z = fminf(lo->z, bmin.z); hi->z = fmaxf(hi->z, bmax.z);
+}
+
+static float boxArea(vector_t lo, vector_t hi)
+{
+	float x = hi.x - lo.x, y = hi.y - lo.y, z = hi.z - lo.z;
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+/* World AABB of the mesh's local AABB under transform (Arvo's method) */
+static void transformBounds(SceneObject* obj)
+{
+	const float* m = obj->transform;
+	const float* lo = &obj->mesh->boundsMin.x;
+	const float* hi = &obj->mesh->boundsMax.x;
+	float* outMin = &obj->boundsMin.x;
+	float* outMax = &obj->boundsMax.x;
+	int i, j;
+
+	for (i = 0; i < 3; ++i)
+	{
+		float center = m[12 + i];
+		float extent = 0.0f;
+		for (j = 0; j < 3; ++j)
+		{
+			center += m[j * 4 + i] * (lo[j] + hi[j]) * 0.5f;
+			extent += fabsf(m[j * 4 + i]) * (hi[j] - lo[j]) * 0.5f;
+		}
+		outMin[i] = center - extent;
+		outMax[i] = center + extent;
+	}
+}
+
+Scene* createScene(int capacity)
+{
+	Scene* scene = (Scene*)resMalloc(sizeof(Scene), RES_ORIGIN);
+	memset(scene, 0, sizeof(Scene));
+	scene->capacity = capacity;
+	scene->objects = (SceneObject*)resMalloc(sizeof(SceneObject) * capacity, RES_ORIGIN);
+	scene->nodes = (SceneNode*)resMalloc(sizeof(SceneNode) * (2 * capacity), RES_ORIGIN);
+	scene->order = (int*)resMalloc(sizeof(int) * capacity, RES_ORIGIN);
+	scene->visible = (int*)resMalloc(sizeof(int) * capacity, RES_ORIGIN);
+	scene->stack = (int*)resMalloc(sizeof(int) * (2 * capacity), RES_ORIGIN);
+	return scene;
+}
+
+void freeScene(Scene* scene)
+{
+	resFree(scene->objects);
+	resFree(scene->nodes);
+	resFree(scene->order);
+	resFree(scene->visible);
+	resFree(scene->stack);
+	resFree(scene);
+}
+
+int addSceneObject(Scene* scene, Object* mesh, const float* transform)
+{
+	SceneObject* obj;
+	assert(scene->numObjects < scene->capacity);
+	obj = &scene->objects[scene->numObjects];
+	obj->mesh = mesh;
+	memcpy(obj->transform, transform, sizeof obj->transform);
+	obj->leaf = -1;
+	obj->material = 0;
+	transformBounds(obj);
+	scene->order[scene->numObjects] = scene->numObjects;
+	scene->built = 0;
+	scene->stats.objects = ++scene->numObjects;
+	return scene->numObjects - 1;
+}
+
+void moveSceneObject(Scene* scene, int index, const float* transform)
+{
+	SceneObject* obj = &scene->objects[index];
+	int node;
+
+	memcpy(obj->transform, transform, sizeof obj->transform);
+	transformBounds(obj);
+	if (!scene->built)
+		return;
+
+	/* Mark the path to the root for refitting */
+	for (node = obj->leaf; node >= 0 && !scene->nodes[node].dirty; node = scene->nodes[node].parent)
+		scene->nodes[node].dirty = 1;
+	scene->moved = 1;
+}
+
+/* Top down median split along the longest axis of the centroids */
+static int buildNode(Scene* scene, int first, int count, int parent)
+{
+	int index = scene->numNodes++;
+	SceneNode* node = &scene->nodes[index];
+	vector_t clo, chi;
+	int i, half;
+
+	node->parent = parent;
+	node->first = first;
+	node->count = count;
+	node->dirty = 0;
+	node->boundsMin = scene->objects[scene->order[first]].boundsMin;
+	node->boundsMax = scene->objects[scene->order[first]].boundsMax;
+	clo = chi = node->boundsMin;
+	for (i = first; i < first + count; ++i)
+	{
+		const SceneObject* obj = &scene->objects[scene->order[i]];
+		vector_t c;
+		c.x = centroid(obj, 0);
+		c.y = centroid(obj, 1);
+		c.z = centroid(obj, 2);
+		boxUnion(&node->boundsMin, &node->boundsMax, obj->boundsMin, obj->boundsMax);
+		if (i == first)
+			clo = chi = c;
+		boxUnion(&clo, &chi, c, c);
+	}
+
+	if (count == 1)
+	{
+		node->left = node->right = -1;
+		scene->objects[scene->order[first]].leaf = index;
+		return index;
+	}
+
+	sort_scene = scene;
+	sort_axis = 0;
+	if (chi.y - clo.y > chi.x - clo.x)
+		sort_axis = 1;
+	if (chi.z - clo.z > (&chi.x)[sort_axis] - (&clo.x)[sort_axis])
+		sort_axis = 2;
+	qsort(scene->order + first, count, sizeof(int), compareCentroids);
+
+	half = count / 2;
+	scene->nodes[index].left = buildNode(scene, first, half, index);
+	scene->nodes[index].right = buildNode(scene, first + half, count - half, index);
+	return index;
+}
+
+/* Surface area heuristic cost of the internal nodes, relative to the root */
+static float treeCost(const Scene* scene)
+{
+	float area = 0.0f;
+	int i;
+	for (i = 0; i < scene->numNodes; ++i)
+		if (scene->nodes[i].left >= 0)
+			area += boxArea(scene->nodes[i].boundsMin, scene->nodes[i].boundsMax);
+	return area / fmaxf(boxArea(scene->nodes[0].boundsMin, scene->nodes[0].boundsMax), 1e-6f);
+}
+
+void updateScene(Scene* scene)
+{
+	int i;
+
+	if (scene->numObjects == 0)
+		return;
+
+	if (scene->built && scene->moved)
+	{
+		/* Children always follow their parent, so a reverse pass refits bottom up */
+		for (i = scene->numNodes - 1; i >= 0; --i)
+		{
+			SceneNode* node = &scene->nodes[i];
+			if (!node->dirty)
+				continue;
+			node->dirty = 0;
+			if (node->left < 0)
+			{
+				const SceneObject* obj = &scene->objects[scene->order[node->first]];
+				node->boundsMin = obj->boundsMin;
+				node->boundsMax = obj->boundsMax;
+			}
+			else
+			{
+				node->boundsMin = scene->nodes[node->left].boundsMin;
+				node->boundsMax = scene->nodes[node->left].boundsMax;
+				boxUnion(&node->boundsMin, &node->boundsMax,
+						scene->nodes[node->right].boundsMin, scene->nodes[node->right].boundsMax);
+			}
+		}
+		scene->moved = 0;
+		scene->stats.refits++;
+
+		/* Refitting never changes the topology, so boxes grow as instances
+		 * scatter. Start again once the tree is noticeably worse. */
+		if (treeCost(scene) > scene->builtCost * SCENE_REBUILD_RATIO)
+			scene->built = 0;
+	}
+
+	if (!scene->built)
+	{
+		scene->numNodes = 0;
+		buildNode(scene, 0, scene->numObjects, -1);
+		scene->builtCost = treeCost(scene);
+		scene->built = 1;
+		scene->moved = 0;
+		scene->stats.rebuilds++;
+	}
+}
+
+void cullScene(Scene* scene, const Frustum* frustum)
+{
+	double start = benchNow();
+	int top = 0, i;
+
+	updateScene(scene);
+	scene->numVisible = 0;
+	scene->stats.nodesVisited = 0;
+
+	if (scene->numObjects > 0)
+		scene->stack[top++] = 0;
+	while (top > 0)
+	{
+		const SceneNode* node = &scene->nodes[scene->stack[--top]];
+		int result;
+
+		scene->stats.nodesVisited++;
+		result = classifyBox(frustum, node->boundsMin, node->boundsMax);
+		if (result == CULL_OUTSIDE)
+			continue;
+
+		/* Everything below a node entirely inside is visible */
+		if (result == CULL_INSIDE || node->left < 0)
+		{
+			for (i = node->first; i < node->first + node->count; ++i)
+				scene->visible[scene->numVisible++] = scene->order[i];
+			continue;
+		}
+		scene->stack[top++] = node->right;
+		scene->stack[top++] = node->left;
+	}
+
+	scene->stats.submitted = scene->numVisible;
+	scene->stats.culled = scene->numObjects - scene->numVisible;
+	scene->stats.cullMs = benchNow() - start;
+}
+
+void drawSceneBatched(Scene* scene, MegaBuffer* mega, GLint transformAttrib)
+{
+	int i;
+	beginMegaBatch(mega);
+	for (i = 0; i < scene->numVisible; ++i)
+	{
+		const SceneObject* obj = &scene->objects[scene->visible[i]];
+		addMegaDraw(mega, obj->mesh, obj->transform);
+	}
+	drawMegaBatch(mega, transformAttrib);
+}
@@ -0,0 +1,7 @@
+// scene instance fragment shader
+// the colour is lit per vertex in scene.vert
+
+void main(void)
+{
+	gl_FragColor = gl_Color;
+}
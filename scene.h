@@ -0,0 +1,82 @@
+/* scene.h */
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "objects.h"
+#include "cull.h"
+#include "megabuffer.h"
+
+/*
+A flat list of mesh instances, each with its own transform, organised in
+a bounding volume hierarchy for frustum culling. Moving an instance only
+refits the boxes above it; the tree is rebuilt from scratch once refits
+have degraded it past SCENE_REBUILD_RATIO of its built quality.
+Meshes are shared between instances and are not owned by the scene.
+*/
+#define SCENE_REBUILD_RATIO 1.5f
+
+typedef struct {
+	Object* mesh;
+	float transform[16]; /* column major, object to world */
+	vector_t boundsMin;  /* world space AABB */
+	vector_t boundsMax;
+	int leaf;            /* BVH node holding this instance */
+	int material;        /* the caller's, 0 unless set */
+} SceneObject;
+
+typedef struct {
+	vector_t boundsMin;
+	vector_t boundsMax;
+	int parent;
+	int left, right;     /* children, -1 for leaves */
+	int first, count;    /* range of the scene's order array below this node */
+	int dirty;
+} SceneNode;
+
+typedef struct {
+	int objects;
+	int submitted;
+	int culled;
+	int nodesVisited;
+	int refits;          /* frames that refit moved instances */
+	int rebuilds;        /* full rebuilds */
+	double cullMs;       /* CPU time of the last cullScene */
+} SceneStats;
+
+typedef struct {
+	SceneObject* objects;
+	int numObjects;
+	int capacity;
+
+	SceneNode* nodes;
+	int numNodes;
+	int* order;          /* instance indices, each node covers a contiguous range */
+	int built;           /* tree is up to date with the instance list */
+	int moved;           /* an instance moved since the last update */
+	float builtCost;     /* surface area heuristic cost when last built */
+
+	int* visible;        /* instances that survived the last cull */
+	int numVisible;
+	int* stack;
+
+	SceneStats stats;
+} Scene;
+
+Scene* createScene(int capacity);
+void freeScene(Scene* scene);
+
+/* Returns the instance index */
+int addSceneObject(Scene* scene, Object* mesh, const float* transform);
+void moveSceneObject(Scene* scene, int index, const float* transform);
+
+/* Builds, refits or rebuilds the hierarchy after instances were added or moved */
+void updateScene(Scene* scene);
+
+/* Fills the visible list with instances inside frustum (world space) */
+void cullScene(Scene* scene, const Frustum* frustum);
+
+/* Draws the visible list as one batch; every mesh must live in mega */
+void drawSceneBatched(Scene* scene, MegaBuffer* mega, GLint transformAttrib);
+
+#endif
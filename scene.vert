@@ -0,0 +1,63 @@
+// scene instance vertex shader
+// blinn-phong, single light, per vertex
+// the object to world transform comes per instance (see megabuffer.h),
+// the modelview matrix holds the camera alone
+
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+#include "blocks.glsl"
+
+attribute mat4 instanceTransform;
+
+void main(void)
+{
+	vec4 color = vec4(0.0);
+
+	// instances are scaled uniformly, so the normal needs no inverse transpose
+	vec4 world = instanceTransform * gl_Vertex;
+	vec3 normal = normalize(gl_NormalMatrix * vec3(instanceTransform * vec4(gl_Normal, 0.0)));
+
+	// eye space position, for a point light and a local viewer
+	vec3 position = vec3(gl_ModelViewMatrix * world);
+
+	// unit vector in direction of light, already in eye space: w is 0 for
+	// a directional light, 1 for a point light ([k])
+	vec3 light;
+	vec3 halfVector;
+	if (lightPosition.w == 0.0)
+	{
+		light = normalize(vec3(lightPosition));
+		halfVector = lightHalfVector.xyz;
+	}
+	else
+	{
+		// the block's half vector is for a directional light: as fixed
+		// function does, make this vertex's own
+		light = normalize(vec3(lightPosition) - position);
+		vec3 eye = isLocalViewer ? -normalize(position) : vec3(0.0, 0.0, 1.0);
+		halfVector = normalize(light + eye);
+	}
+
+	// compute diffuse scalar
+	float NdotL = max(dot(normal, light), 0.0);
+
+	// add global and light ambient
+	color += materialAmbient * (sceneAmbient + lightAmbient);
+
+	// add diffuse and specular color
+	if (NdotL > 0.0)
+	{
+		color += NdotL * materialDiffuse * lightDiffuse;
+
+		float NdotHV = max(dot(normal, halfVector), 0.0);
+		color += materialSpecular * lightSpecular *
+			pow(NdotHV, materialShininess);
+	}
+
+	// set the color
+	gl_FrontColor = color;
+
+	// camera and projection only: the instance transform is already applied
+	gl_Position = gl_ModelViewProjectionMatrix * world;
+}
@@ -6,6 +6,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* The render thread takes the context over with GLX directly: SDL 1.2 has
+ * no way to make its context current on another thread */
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+
+#include "replay.h"
+#include "bench.h"
+#include "latency.h"
+#include "resources.h"
 
 #define DEFAULT_WIDTH 800
 #define DEFAULT_HEIGHT 600
@@ -22,70 +33,256 @@ static int quit_flag;
 int frame_rate;
 const Uint32 frame_rate_update_interval = 1000;
 
+/* --threaded: display() runs on a render thread that owns the GL context,
+ * while this thread handles events and update() */
+static int threaded;
+static SDL_Thread *render_thread;
+static SDL_sem *render_paused;
+static SDL_sem *render_resumed;
+static int render_stop;		/* set by the main thread, read atomically */
+static int render_pause;
+static Display *glx_display;
+static GLXDrawable glx_drawable;
+static GLXContext glx_context;
+
 void quit()
 {
 	quit_flag = 1;
 }
 
+int render_threaded()
+{
+	return threaded;
+}
+
+static void count_frame(Uint32 now)
+{
+	frame_count++;
+	if (now - frame_time > frame_rate_update_interval)
+	{
+		frame_rate = (frame_count * frame_rate_update_interval) / (now - frame_time);
+		frame_count = 0;
+		frame_time = now;
+	}
+}
+
+/* Remembers the calling thread's context and releases it */
+static void release_context()
+{
+	glx_display = glXGetCurrentDisplay();
+	glx_drawable = glXGetCurrentDrawable();
+	glx_context = glXGetCurrentContext();
+	glXMakeCurrent(glx_display, None, NULL);
+}
+
+static void acquire_context()
+{
+	glXMakeCurrent(glx_display, glx_drawable, glx_context);
+}
+
+static int render_loop(void *unused)
+{
+	acquire_context();
+	while (!__atomic_load_n(&render_stop, __ATOMIC_ACQUIRE))
+	{
+		if (__atomic_load_n(&render_pause, __ATOMIC_ACQUIRE))
+		{
+			glXMakeCurrent(glx_display, None, NULL);
+			SDL_SemPost(render_paused);
+			SDL_SemWait(render_resumed);
+			acquire_context();
+			continue;
+		}
+		display(screen);
+		SDL_GL_SwapBuffers();
+		latencySwapped();
+		count_frame(SDL_GetTicks());
+	}
+	glXMakeCurrent(glx_display, None, NULL);
+	return 0;
+}
+
+static void start_render()
+{
+	render_paused = SDL_CreateSemaphore(0);
+	render_resumed = SDL_CreateSemaphore(0);
+	render_stop = 0;
+	render_pause = 0;
+	release_context();
+	render_thread = SDL_CreateThread(render_loop, NULL);
+}
+
+/* Takes the context back until resume_render(), eg. to resize the window */
+static void pause_render()
+{
+	__atomic_store_n(&render_pause, 1, __ATOMIC_RELEASE);
+	SDL_SemWait(render_paused);
+	__atomic_store_n(&render_pause, 0, __ATOMIC_RELEASE);
+	acquire_context();
+}
+
+static void resume_render()
+{
+	release_context();
+	SDL_SemPost(render_resumed);
+}
+
+/* Leaves the context current on this thread, for cleanup() */
+static void stop_render()
+{
+	__atomic_store_n(&render_stop, 1, __ATOMIC_RELEASE);
+	SDL_WaitThread(render_thread, NULL);
+	SDL_DestroySemaphore(render_paused);
+	SDL_DestroySemaphore(render_resumed);
+	acquire_context();
+}
+
+static void handle_event(SDL_Event *ev)
+{
+	switch (ev->type)
+	{
+	case SDL_QUIT:
+		quit();
+		break;
+	case SDL_VIDEORESIZE:
+		if (threaded)
+			pause_render();
+		screen = SDL_SetVideoMode(ev->resize.w, 
+								  ev->resize.h,
+								  DEFAULT_DEPTH, videoFlags);
+		reshape(screen->w, screen->h);
+		if (threaded)
+			resume_render();
+		break;
+	default:
+		event(ev);
+		break;
+	}
+}
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [--threaded] [--record file | --replay file]\n", program);
+}
+
 int main(int argc, char **argv)
 {
 	SDL_Event ev;
-	Uint32 now, last_frame_time;
+	SDL_Event replayed[REPLAY_MAX_EVENTS];
+	Uint32 now, last_frame_time, delta;
+	const char *record = NULL, *replay = NULL;
+	int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+	int i, count;
+	double start, updated;
+
+	for (i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay = argv[++i];
+		else if (strcmp(argv[i], "--threaded") == 0)
+			threaded = 1;
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* A replay times update() and display() per frame, which only happen
+	 * in step without the render thread */
+	if (replay && threaded)
+	{
+		printf("--replay only runs without --threaded\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Before anything is allocated, or any thread started */
+	resInit();
+
+	/* A replay starts in the window size it was recorded in */
+	if (replay && replayStartPlayback(replay, &width, &height) != 0)
+		return EXIT_FAILURE;
+
+	/* Xlib is used from both threads */
+	if (threaded)
+		XInitThreads();
 
 	quit_flag = 0;
 	videoFlags = DEFAULT_FLAGS;
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-	screen = SDL_SetVideoMode(DEFAULT_WIDTH, DEFAULT_HEIGHT, 
+	screen = SDL_SetVideoMode(width, height, 
 							  DEFAULT_DEPTH, videoFlags);
 
 	init();
 	reshape(screen->w, screen->h);
 
+	if (record && replayStartRecording(record, screen->w, screen->h) != 0)
+		quit();
+
 	frame_rate = 0;
 	frame_count = 0;
 	last_frame_time = frame_time = SDL_GetTicks();
+	if (threaded)
+		start_render();
 	while (!quit_flag) 
 	{
-		/* Process all pending events */
-		while (SDL_PollEvent(&ev))
+		if (replayPlaying())
 		{
-			switch (ev.type)
-			{
-			case SDL_QUIT:
-				quit();
-				break;
-			case SDL_VIDEORESIZE:
-				screen = SDL_SetVideoMode(ev.resize.w, 
-										  ev.resize.h,
-										  DEFAULT_DEPTH, videoFlags);
-				reshape(screen->w, screen->h);
-				break;
-			default:
-				event(&ev);
+			/* Live input is ignored, apart from closing the window */
+			while (SDL_PollEvent(&ev))
+				if (ev.type == SDL_QUIT)
+					quit();
+			if (!replayNextFrame(replayed, REPLAY_MAX_EVENTS, &count, &delta))
 				break;
+			for (i = 0; i < count; ++i)
+				handle_event(&replayed[i]);
+			now = SDL_GetTicks();
+		}
+		else
+		{
+			/* Process all pending events */
+			while (SDL_PollEvent(&ev))
+			{
+				replayRecordEvent(&ev);
+				handle_event(&ev);
 			}
+			/* Calculate time passed */
+			now = SDL_GetTicks();
+			delta = now - last_frame_time;
+			last_frame_time = now;
+			replayRecordFrame(delta);
+		}
+
+		if (threaded)
+		{
+			/* The render thread picks up each update as it's published */
+			update(delta);
+			SDL_Delay(1);
+			continue;
 		}
-		/* Calculate time passed */
-		now = SDL_GetTicks();
-		update(now - last_frame_time);
-		last_frame_time = now;
+
+		start = benchNow();
+		update(delta);
+		updated = benchNow();
 
 		/* Refresh display and flip buffers */
 		display(screen);
 		SDL_GL_SwapBuffers();
+		latencySwapped();
+		replayFrameTiming(updated - start, benchNow() - updated);
 
 		/* Update frame_rate */
-		frame_count++;
-		if (now - frame_time > frame_rate_update_interval)
-		{
-			frame_rate = (frame_count * frame_rate_update_interval) / (now - frame_time);
-			frame_count = 0;
-			frame_time = now;
-		}
+		count_frame(now);
 	}
 
+	if (threaded)
+		stop_render();
+	replayStop();
 	cleanup();
+	resQuit();
 	SDL_Quit();
 	
 	return EXIT_SUCCESS;
@@ -18,3 +18,7 @@ extern int frame_rate;
 /* Call this to quit. */
 void quit();
 
+/* Non-zero when display() runs on its own thread (--threaded). update() and
+ * event() always run on the main thread. */
+int render_threaded();
+
@@ -1,19 +1,94 @@
 // shader.frag
 
-/* lighting model:
- *  0 = phong
- *  1 = blinn-phong
- */
-uniform int lightingModel;
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
 
-uniform bool isPerPixelLighting;
+#include "blocks.glsl"
 
+/* pass:
+ *  0 = shade
+ *  1 = depth only, colour writes are masked
+ *  2 = overdraw, a constant added per fragment
+ */
+uniform int pass;
+
+/* clustered point lights, binned on the CPU (see lights.h); their count
+ * and the viewport are in the Frame block */
+uniform sampler2D lightData;   // eye position + radius, colour
+uniform sampler2D lightGrid;   // offset, count for each cluster
+uniform sampler2D lightIndex;  // light indices for every cluster
+uniform vec3 lightGridSize;
+uniform vec2 lightDepth;       // near, log(far / near)
+uniform float lightDataWidth;
+uniform float lightIndexSize;
 
 varying vec3 eye;
 varying vec3 normal;
+varying vec3 position;
+
+vec4 pointLights(vec3 n)
+{
+	const int Phong = 0;
+
+	vec4 color = vec4(0.0);
+
+	// find the cluster: screen tile and exponential depth slice
+	vec3 cell = vec3(
+			floor(gl_FragCoord.xy / viewport * lightGridSize.xy),
+			floor(log(-position.z / lightDepth.x) / lightDepth.y * lightGridSize.z));
+	cell = clamp(cell, vec3(0.0), lightGridSize - 1.0);
+
+	vec2 range = texture2D(lightGrid, vec2(
+			(cell.x + cell.y * lightGridSize.x + 0.5) / (lightGridSize.x * lightGridSize.y),
+			(cell.z + 0.5) / lightGridSize.z)).ra;
+
+	int count = int(range.y);
+	for (int i = 0; i < count; ++i) {
+		float ref = range.x + float(i);
+		float index = texture2D(lightIndex, vec2(
+				(mod(ref, lightIndexSize) + 0.5) / lightIndexSize,
+				(floor(ref / lightIndexSize) + 0.5) / lightIndexSize)).r;
+		float s = (index + 0.5) / lightDataWidth;
+		vec4 light = texture2D(lightData, vec2(s, 0.25));
+		vec4 lightColor = vec4(texture2D(lightData, vec2(s, 0.75)).rgb, 1.0);
+
+		vec3 toLight = light.xyz - position;
+		float dist = length(toLight);
+		vec3 l = toLight / dist;
+
+		// fades to nothing at the light's radius
+		float attenuation = max(1.0 - dist / light.w, 0.0);
+		attenuation *= attenuation;
+
+		float NdotL = max(dot(n, l), 0.0);
+		if (attenuation > 0.0 && NdotL > 0.0) {
+			float specular;
+			if (lightingModel == Phong)
+				specular = pow(max(dot(reflect(l, n), eye), 0.0), materialShininess);
+			else
+				specular = pow(max(dot(n, normalize(l - eye)), 0.0), materialShininess);
+
+			color += attenuation * lightColor * (NdotL * materialDiffuse +
+					specular * materialSpecular);
+		}
+	}
+	return color;
+}
 
 void main (void)
 {
+	const int DepthOnly = 1;
+	const int Overdraw = 2;
+
+	if (pass == DepthOnly) {
+		gl_FragColor = vec4(0.0);
+		return;
+	}
+	if (pass == Overdraw) {
+		gl_FragColor = vec4(0.15, 0.06, 0.02, 1.0);
+		return;
+	}
+
 	if (isPerPixelLighting) {
 		const int Phong = 0;
 		const int BlinnPhong = 1;
@@ -21,18 +96,18 @@ void main (void)
 		vec4 color = vec4(0.0);
 
 		// already transformed into eye space coordinates by modelview matrix
-		vec3 light = normalize(vec3(gl_LightSource[0].position));
+		vec3 light = normalize(vec3(lightPosition));
 
 		// compute diffuse scalar
 		float NdotL = max(dot(normal, light), 0.0);
 
 		// add global and light ambient
-		color += gl_FrontMaterial.ambient * (gl_LightModel.ambient + gl_LightSource[0].ambient);
+		color += materialAmbient * (sceneAmbient + lightAmbient);
 
 		if (NdotL > 0.0)
 		{
 			// add diffuse component
-			color += NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse;
+			color += NdotL * materialDiffuse * lightDiffuse;
 
 			// add specular color depending on light model
 			if (lightingModel == Phong) {
@@ -41,20 +116,23 @@ void main (void)
 				vec3 reflection = reflect(light, normal);
 				float RdotE = max(dot(reflection, eye), 0.0);
 
-				color += pow(RdotE, gl_FrontMaterial.shininess) *
-					gl_LightSource[0].specular * gl_FrontMaterial.specular;
+				color += pow(RdotE, materialShininess) *
+					lightSpecular * materialSpecular;
 
 			} else /* lightingModel == BlinnPhong */ {
 
 				// add specular color
-				float NdotHV = max(dot(normal, gl_LightSource[0].halfVector.xyz), 0.0);
+				float NdotHV = max(dot(normal, lightHalfVector.xyz), 0.0);
 
-				color += gl_FrontMaterial.specular * gl_LightSource[0].specular *
-					pow(NdotHV, gl_FrontMaterial.shininess);
+				color += materialSpecular * lightSpecular *
+					pow(NdotHV, materialShininess);
 
 			}
 		}
 
+		if (numLights > 0)
+			color += pointLights(normalize(normal));
+
 		gl_FragColor = color;
 
 	} else {
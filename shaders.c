@@ -109,6 +109,46 @@ char* readFile(const char* filename)
 	return data;
 }
 
+/*
+GLSL has no #include, so this expands each #include "file" itself. Used for
+blocks.glsl, the uniform blocks every program shares. Takes ownership of
+source; returns NULL if an included file can't be read.
+*/
+char* expandIncludes(char* source)
+{
+	const char* directive = "#include \"";
+	char *start, *name, *end, *included, *expanded;
+	size_t length;
+
+	while ((start = strstr(source, directive)) != NULL)
+	{
+		name = start + strlen(directive);
+		end = strchr(name, '"');
+		if (!end)
+			break; /* left for the compiler to report */
+
+		*end = '\0';
+		included = readFile(name);
+		if (!included)
+		{
+			printf("Error reading shader include %s\n", name);
+			free(source);
+			return NULL;
+		}
+
+		/* Everything before the directive, the file, everything after it */
+		length = start - source;
+		expanded = (char*)malloc(length + strlen(included) + strlen(end + 1) + 1);
+		memcpy(expanded, source, length);
+		strcpy(expanded + length, included);
+		strcat(expanded, end + 1);
+		free(included);
+		free(source);
+		source = expanded;
+	}
+	return source;
+}
+
 GLuint createShader(const char* filename, GLenum type)
 {
 	char* source;
@@ -116,6 +156,8 @@ GLuint createShader(const char* filename, GLenum type)
 
 	/* Read the contents of the source files */
 	source = readFile(filename);
+	if (source)
+		source = expandIncludes(source);
 	if (!source)
 	{
 		printf("Error reading shader %s\n", filename);
@@ -174,3 +216,44 @@ GLuint getShader(const char* vertexFile, const char* fragmentFile)
 	return program; /* NOTE: use glDeleteProgram to free resources */
 }
 
+
+GLuint getGeometryShader(const char* vertexFile, const char* geometryFile, const char* fragmentFile,
+		GLenum inputType, GLenum outputType, int maxVertices)
+{
+	GLuint vert, geom, frag, program;
+
+	/* If the error points here, it's before this function is called */
+	CHECKERROR;
+
+	/* Create the shaders; without all three there is nothing to draw */
+	vert = createShader(vertexFile, GL_VERTEX_SHADER);
+	geom = createShader(geometryFile, GL_GEOMETRY_SHADER_EXT);
+	frag = createShader(fragmentFile, GL_FRAGMENT_SHADER);
+	program = 0;
+	if (vert && geom && frag)
+	{
+		/* The primitive types are program state, fixed before linking */
+		program = glCreateProgram();
+		glAttachShader(program, vert);
+		glAttachShader(program, geom);
+		glAttachShader(program, frag);
+		glProgramParameteriEXT(program, GL_GEOMETRY_INPUT_TYPE_EXT, inputType);
+		glProgramParameteriEXT(program, GL_GEOMETRY_OUTPUT_TYPE_EXT, outputType);
+		glProgramParameteriEXT(program, GL_GEOMETRY_VERTICES_OUT_EXT, maxVertices);
+		glLinkProgram(program);
+		if (programError(program, geometryFile, fragmentFile))
+		{
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	/* Clean up intermediates and return the program */
+	if (vert)
+		glDeleteShader(vert);
+	if (geom)
+		glDeleteShader(geom);
+	if (frag)
+		glDeleteShader(frag);
+	return program; /* NOTE: use glDeleteProgram to free resources */
+}
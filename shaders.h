@@ -8,4 +8,8 @@
 int oglError(int line, const char* file);
 GLuint getShader(const char* vertexFile, const char* fragmentFile);
 
+/* Needs EXT_geometry_shader4. Returns 0 if any stage fails */
+GLuint getGeometryShader(const char* vertexFile, const char* geometryFile, const char* fragmentFile,
+		GLenum inputType, GLenum outputType, int maxVertices);
+
 #endif
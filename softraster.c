@@ -0,0 +1,574 @@
+/* softraster.c */
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "softraster.h"
+#include "resources.h"
+#include "bench.h"
+
+/* Outcodes: outside each clip plane */
+#define OUT_LEFT   1
+#define OUT_RIGHT  2
+#define OUT_BOTTOM 4
+#define OUT_TOP    8
+#define OUT_NEAR   16
+#define OUT_FAR    32
+
+SoftRaster* createSoftRaster(JobPool* pool)
+{
+	SoftRaster* raster = (SoftRaster*)resMalloc(sizeof(SoftRaster), RES_ORIGIN);
+	memset(raster, 0, sizeof(SoftRaster));
+	raster->pool = pool;
+	raster->stats.threads = jobPoolThreads(raster->pool);
+	return raster;
+}
+
+static void freeBuffers(SoftRaster* raster)
+{
+	if (raster->surface)
+		SDL_FreeSurface(raster->surface);
+	raster->surface = NULL;
+	resFree(raster->depth);
+	resFree(raster->binStart);
+	resFree(raster->binCursor);
+	raster->depth = NULL;
+	raster->binStart = NULL;
+	raster->binCursor = NULL;
+}
+
+void freeSoftRaster(SoftRaster* raster)
+{
+	freeBuffers(raster);
+	resFree(raster->vertices);
+	resFree(raster->indices);
+	resFree(raster->transformed);
+	resFree(raster->triangles);
+	resFree(raster->binTriangles);
+	resFree(raster);
+}
+
+void resizeSoftRaster(SoftRaster* raster, int width, int height)
+{
+	raster->width = width;
+	raster->height = height;
+}
+
+/* Brings the buffers to the window size, if they aren't already */
+static void allocateBuffers(SoftRaster* raster)
+{
+	int tiles;
+
+	if (raster->surface && raster->surface->w == raster->width
+			&& raster->surface->h == raster->height)
+		return;
+	freeBuffers(raster);
+	raster->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, raster->width, raster->height, 32,
+			0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+	raster->depthStride = (raster->width + 3) & ~3;
+	raster->depth = (float*)resMalloc(sizeof(float) * raster->depthStride * raster->height, RES_ORIGIN);
+	raster->tilesX = (raster->width + SOFT_TILE - 1) / SOFT_TILE;
+	raster->tilesY = (raster->height + SOFT_TILE - 1) / SOFT_TILE;
+	tiles = raster->tilesX * raster->tilesY;
+	raster->binStart = (int*)resMalloc(sizeof(int) * (tiles + 1), RES_ORIGIN);
+	raster->binCursor = (int*)resMalloc(sizeof(int) * tiles, RES_ORIGIN);
+}
+
+void setSoftMesh(SoftRaster* raster, const Mesh* mesh)
+{
+	int triangles;
+
+	if (!mesh)
+	{
+		raster->numVertices = raster->numIndices = 0;
+		return;
+	}
+
+	/* Capacity only grows, so a steady stream of rebuilds allocates nothing */
+	if (mesh->numVertices > raster->maxVertices)
+	{
+		raster->maxVertices = mesh->numVertices;
+		raster->vertices = (vertex_t*)resRealloc(raster->vertices,
+				sizeof(vertex_t) * raster->maxVertices, RES_ORIGIN);
+		raster->transformed = (SoftVertex*)resRealloc(raster->transformed,
+				sizeof(SoftVertex) * raster->maxVertices, RES_ORIGIN);
+	}
+	if (mesh->numIndices > raster->maxIndices)
+	{
+		raster->maxIndices = mesh->numIndices;
+		raster->indices = (unsigned int*)resRealloc(raster->indices,
+				sizeof(unsigned int) * raster->maxIndices, RES_ORIGIN);
+		/* A strip has the most triangles per index */
+		triangles = raster->maxIndices > 2 ? raster->maxIndices - 2 : 1;
+		raster->triangles = (SoftTriangle*)resRealloc(raster->triangles,
+				sizeof(SoftTriangle) * triangles, RES_ORIGIN);
+	}
+	memcpy(raster->vertices, mesh->vertices, sizeof(vertex_t) * mesh->numVertices);
+	memcpy(raster->indices, mesh->indices, sizeof(unsigned int) * mesh->numIndices);
+	raster->numVertices = mesh->numVertices;
+	raster->numIndices = mesh->numIndices;
+	raster->primitive = mesh->primitive;
+}
+
+void softParamsFromGL(SoftParams* params)
+{
+	GLint value;
+
+	glGetFloatv(GL_MODELVIEW_MATRIX, params->modelview);
+	glGetFloatv(GL_PROJECTION_MATRIX, params->projection);
+	glGetLightfv(GL_LIGHT0, GL_POSITION, params->light);
+	glGetLightfv(GL_LIGHT0, GL_AMBIENT, params->lightAmbient);
+	glGetLightfv(GL_LIGHT0, GL_DIFFUSE, params->lightDiffuse);
+	glGetLightfv(GL_LIGHT0, GL_SPECULAR, params->lightSpecular);
+	glGetFloatv(GL_LIGHT_MODEL_AMBIENT, params->sceneAmbient);
+	glGetMaterialfv(GL_FRONT, GL_AMBIENT, params->materialAmbient);
+	glGetMaterialfv(GL_FRONT, GL_DIFFUSE, params->materialDiffuse);
+	glGetMaterialfv(GL_FRONT, GL_SPECULAR, params->materialSpecular);
+	glGetMaterialfv(GL_FRONT, GL_SHININESS, &params->shininess);
+	glGetFloatv(GL_CURRENT_COLOR, params->color);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, params->clear);
+	params->lighting = glIsEnabled(GL_LIGHTING);
+	glGetIntegerv(GL_LIGHT_MODEL_LOCAL_VIEWER, &value);
+	params->localViewer = value;
+	glGetIntegerv(GL_SHADE_MODEL, &value);
+	params->smooth = value == GL_SMOOTH;
+	params->perPixel = 0;
+	params->phong = 0;
+}
+
+static float dot3(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void normalize3(float* v)
+{
+	float length = sqrtf(dot3(v, v));
+	if (length > 0.0f)
+	{
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+}
+
+/* The lighting of mesh-generation.vert and shader.frag, for one point */
+static void shade(const SoftRaster* raster, const float* position, const float* normal, float* rgb)
+{
+	const SoftParams* p = &raster->params;
+	const float* lightDir = raster->lightDir;
+	const float* halfVector = raster->halfVector;
+	float eye[3] = {0.0f, 0.0f, -1.0f};
+	float pointDir[3], pointHalf[3];
+	float reflection[3], NdotL, specular;
+	int i;
+
+	if (!p->lighting)
+	{
+		rgb[0] = p->color[0];
+		rgb[1] = p->color[1];
+		rgb[2] = p->color[2];
+		return;
+	}
+
+	if (p->localViewer)
+	{
+		eye[0] = position[0];
+		eye[1] = position[1];
+		eye[2] = position[2];
+		normalize3(eye);
+	}
+	/* A point light's direction, and so its half vector, vary per point */
+	if (p->light[3] != 0.0f)
+	{
+		for (i = 0; i < 3; ++i)
+			pointDir[i] = p->light[i] - position[i];
+		normalize3(pointDir);
+		for (i = 0; i < 3; ++i)
+			pointHalf[i] = pointDir[i] - eye[i];
+		normalize3(pointHalf);
+		lightDir = pointDir;
+		halfVector = pointHalf;
+	}
+	NdotL = dot3(normal, lightDir);
+	for (i = 0; i < 3; ++i)
+		rgb[i] = p->materialAmbient[i] * (p->sceneAmbient[i] + p->lightAmbient[i]);
+	if (NdotL <= 0.0f)
+		return;
+
+	if (p->phong)
+	{
+		for (i = 0; i < 3; ++i)
+			reflection[i] = lightDir[i] - 2.0f * NdotL * normal[i];
+		specular = powf(fmaxf(dot3(reflection, eye), 0.0f), p->shininess);
+	}
+	else
+		specular = powf(fmaxf(dot3(normal, halfVector), 0.0f), p->shininess);
+
+	for (i = 0; i < 3; ++i)
+		rgb[i] += NdotL * p->materialDiffuse[i] * p->lightDiffuse[i]
+			+ specular * p->materialSpecular[i] * p->lightSpecular[i];
+}
+
+static void transformChunk(void* data, int chunk)
+{
+	SoftRaster* raster = (SoftRaster*)data;
+	const SoftParams* p = &raster->params;
+	const float* mv = p->modelview;
+	const float* pr = p->projection;
+	int first = chunk * SOFT_VERTEX_CHUNK;
+	int last = first + SOFT_VERTEX_CHUNK;
+	float clip[4];
+	int i, j;
+
+	if (last > raster->numVertices)
+		last = raster->numVertices;
+	for (i = first; i < last; ++i)
+	{
+		const vertex_t* in = &raster->vertices[i];
+		SoftVertex* out = &raster->transformed[i];
+		const float* v = &in->vert.x;
+		const float* n = &in->norm.x;
+
+		for (j = 0; j < 3; ++j)
+		{
+			out->eye[j] = mv[j] * v[0] + mv[4 + j] * v[1] + mv[8 + j] * v[2] + mv[12 + j];
+			out->normal[j] = mv[j] * n[0] + mv[4 + j] * n[1] + mv[8 + j] * n[2];
+		}
+		normalize3(out->normal);
+		for (j = 0; j < 4; ++j)
+			clip[j] = pr[j] * out->eye[0] + pr[4 + j] * out->eye[1] + pr[8 + j] * out->eye[2] + pr[12 + j];
+
+		out->outcode = (clip[0] < -clip[3] ? OUT_LEFT : 0) | (clip[0] > clip[3] ? OUT_RIGHT : 0)
+			| (clip[1] < -clip[3] ? OUT_BOTTOM : 0) | (clip[1] > clip[3] ? OUT_TOP : 0)
+			| (clip[2] < -clip[3] ? OUT_NEAR : 0) | (clip[2] > clip[3] ? OUT_FAR : 0);
+		if (!(out->outcode & OUT_NEAR))
+		{
+			out->invW = 1.0f / clip[3];
+			out->x = (clip[0] * out->invW * 0.5f + 0.5f) * raster->surface->w;
+			out->y = (0.5f - clip[1] * out->invW * 0.5f) * raster->surface->h;
+			out->z = clip[2] * out->invW * 0.5f + 0.5f;
+		}
+		if (!p->perPixel)
+			shade(raster, out->eye, out->normal, out->color);
+	}
+}
+
+/* Assembles, culls and sets up triangles, then bins them by tile */
+static void setupTriangles(SoftRaster* raster)
+{
+	const int list = raster->primitive == GL_TRIANGLES;
+	const int count = list ? raster->numIndices / 3 : raster->numIndices - 2;
+	const int width = raster->surface->w;
+	const int height = raster->surface->h;
+	const int tiles = raster->tilesX * raster->tilesY;
+	int t, i, tx, ty, tile, total;
+
+	raster->numTriangles = 0;
+	raster->stats.culled = 0;
+	for (t = 0; t < count; ++t)
+	{
+		SoftTriangle* tri = &raster->triangles[raster->numTriangles];
+		const SoftVertex *a, *b, *c;
+		double area, x0, y0;
+
+		for (i = 0; i < 3; ++i)
+			tri->v[i] = raster->indices[list ? t * 3 + i : t + i];
+		tri->provoking = tri->v[2];
+		a = &raster->transformed[tri->v[0]];
+		b = &raster->transformed[tri->v[1]];
+		c = &raster->transformed[tri->v[2]];
+		if (tri->v[0] == tri->v[1] || tri->v[1] == tri->v[2] || tri->v[0] == tri->v[2]
+				|| ((a->outcode | b->outcode | c->outcode) & OUT_NEAR)
+				|| (a->outcode & b->outcode & c->outcode))
+		{
+			raster->stats.culled++;
+			continue;
+		}
+
+		/* Either winding is drawn: make the area positive */
+		area = (b->x - a->x) * (double)(c->y - a->y) - (b->y - a->y) * (double)(c->x - a->x);
+		if (area < 0.0)
+		{
+			const SoftVertex* temp = b;
+			i = tri->v[1];
+			tri->v[1] = tri->v[2];
+			tri->v[2] = i;
+			b = c;
+			c = temp;
+			area = -area;
+		}
+
+		tri->minX = (int)floorf(fminf(a->x, fminf(b->x, c->x)));
+		tri->minY = (int)floorf(fminf(a->y, fminf(b->y, c->y)));
+		tri->maxX = (int)ceilf(fmaxf(a->x, fmaxf(b->x, c->x)));
+		tri->maxY = (int)ceilf(fmaxf(a->y, fmaxf(b->y, c->y)));
+		tri->minX = tri->minX < 0 ? 0 : tri->minX;
+		tri->minY = tri->minY < 0 ? 0 : tri->minY;
+		tri->maxX = tri->maxX >= width ? width - 1 : tri->maxX;
+		tri->maxY = tri->maxY >= height ? height - 1 : tri->maxY;
+		if (area <= 1e-12 || tri->minX > tri->maxX || tri->minY > tri->maxY)
+		{
+			raster->stats.culled++;
+			continue;
+		}
+
+		/* Barycentrics from the first pixel centre, so c stays small and
+		 * single precision holds up across the screen */
+		x0 = tri->minX + 0.5;
+		y0 = tri->minY + 0.5;
+		for (i = 0; i < 3; ++i)
+		{
+			const SoftVertex* p = &raster->transformed[tri->v[(i + 1) % 3]];
+			const SoftVertex* q = &raster->transformed[tri->v[(i + 2) % 3]];
+			tri->edge[i][0] = (float)((p->y - q->y) / area);
+			tri->edge[i][1] = (float)((q->x - p->x) / area);
+			tri->edge[i][2] = (float)(((p->x - x0) * (q->y - y0) - (p->y - y0) * (q->x - x0)) / area);
+		}
+		raster->numTriangles++;
+	}
+
+	/* Count per tile, then fill in submission order so depth ties resolve as GL does */
+	memset(raster->binStart, 0, sizeof(int) * (tiles + 1));
+	for (t = 0; t < raster->numTriangles; ++t)
+	{
+		const SoftTriangle* tri = &raster->triangles[t];
+		for (ty = tri->minY / SOFT_TILE; ty <= tri->maxY / SOFT_TILE; ++ty)
+			for (tx = tri->minX / SOFT_TILE; tx <= tri->maxX / SOFT_TILE; ++tx)
+				raster->binStart[ty * raster->tilesX + tx + 1]++;
+	}
+	for (tile = 0; tile < tiles; ++tile)
+		raster->binStart[tile + 1] += raster->binStart[tile];
+	total = raster->binStart[tiles];
+	if (total > raster->maxBinned)
+	{
+		raster->maxBinned = total;
+		raster->binTriangles = (int*)resRealloc(raster->binTriangles,
+				sizeof(int) * raster->maxBinned, RES_ORIGIN);
+	}
+	memcpy(raster->binCursor, raster->binStart, sizeof(int) * tiles);
+	for (t = 0; t < raster->numTriangles; ++t)
+	{
+		const SoftTriangle* tri = &raster->triangles[t];
+		for (ty = tri->minY / SOFT_TILE; ty <= tri->maxY / SOFT_TILE; ++ty)
+			for (tx = tri->minX / SOFT_TILE; tx <= tri->maxX / SOFT_TILE; ++tx)
+				raster->binTriangles[raster->binCursor[ty * raster->tilesX + tx]++] = t;
+	}
+
+	raster->stats.triangles = raster->numTriangles;
+	raster->stats.binned = total;
+}
+
+static Uint32 packColor(const float* rgb)
+{
+	int r = (int)(fminf(fmaxf(rgb[0], 0.0f), 1.0f) * 255.0f + 0.5f);
+	int g = (int)(fminf(fmaxf(rgb[1], 0.0f), 1.0f) * 255.0f + 0.5f);
+	int b = (int)(fminf(fmaxf(rgb[2], 0.0f), 1.0f) * 255.0f + 0.5f);
+	return 0xff000000u | (Uint32)r << 16 | (Uint32)g << 8 | (Uint32)b;
+}
+
+/* Colour of a covered pixel, given its screen space barycentrics */
+static Uint32 shadePixel(const SoftRaster* raster, const SoftTriangle* tri, const float* l)
+{
+	const SoftVertex* v[3];
+	float w[3], sum, rgb[3], eye[3], normal[3];
+	int i, j;
+
+	if (!raster->params.perPixel && !raster->params.smooth)
+		return packColor(raster->transformed[tri->provoking].color);
+
+	for (i = 0; i < 3; ++i)
+	{
+		v[i] = &raster->transformed[tri->v[i]];
+		w[i] = l[i] * v[i]->invW;
+	}
+	sum = w[0] + w[1] + w[2];
+	for (i = 0; i < 3; ++i)
+		w[i] /= sum;
+
+	if (!raster->params.perPixel)
+	{
+		for (j = 0; j < 3; ++j)
+			rgb[j] = w[0] * v[0]->color[j] + w[1] * v[1]->color[j] + w[2] * v[2]->color[j];
+		return packColor(rgb);
+	}
+	for (j = 0; j < 3; ++j)
+	{
+		eye[j] = w[0] * v[0]->eye[j] + w[1] * v[1]->eye[j] + w[2] * v[2]->eye[j];
+		normal[j] = w[0] * v[0]->normal[j] + w[1] * v[1]->normal[j] + w[2] * v[2]->normal[j];
+	}
+	normalize3(normal);
+	shade(raster, eye, normal, rgb);
+	return packColor(rgb);
+}
+
+/*
+Tests the four pixels from (x, y) against the triangle and the depth
+buffer, writing the depth of those that pass. lanes is how many of the four
+are inside the triangle's bounds. Returns a bit per passing pixel, with
+their barycentrics in l.
+*/
+static int coverQuad(const SoftTriangle* tri, const SoftVertex** v, int x, int y, int lanes,
+		float* depth, float l[3][4])
+{
+#ifdef __SSE__
+	const __m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	__m128 dx = _mm_add_ps(_mm_set1_ps((float)(x - tri->minX)), offsets);
+	__m128 dy = _mm_set1_ps((float)(y - tri->minY));
+	__m128 zero = _mm_setzero_ps();
+	__m128 bary[3], inside, z, old;
+	int i;
+
+	inside = _mm_cmplt_ps(offsets, _mm_set1_ps((float)lanes));
+	for (i = 0; i < 3; ++i)
+	{
+		bary[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri->edge[i][0]), dx),
+					_mm_mul_ps(_mm_set1_ps(tri->edge[i][1]), dy)), _mm_set1_ps(tri->edge[i][2]));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(bary[i], zero));
+	}
+	if (!_mm_movemask_ps(inside))
+		return 0;
+
+	z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(bary[0], _mm_set1_ps(v[0]->z)),
+				_mm_mul_ps(bary[1], _mm_set1_ps(v[1]->z))), _mm_mul_ps(bary[2], _mm_set1_ps(v[2]->z)));
+	old = _mm_loadu_ps(depth);
+	inside = _mm_and_ps(inside, _mm_cmplt_ps(z, old));
+	_mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old)));
+	for (i = 0; i < 3; ++i)
+		_mm_storeu_ps(l[i], bary[i]);
+	return _mm_movemask_ps(inside);
+#else
+	int mask = 0, lane, i;
+	float z;
+
+	for (lane = 0; lane < lanes; ++lane)
+	{
+		for (i = 0; i < 3; ++i)
+			l[i][lane] = tri->edge[i][0] * (x - tri->minX + lane)
+				+ tri->edge[i][1] * (y - tri->minY) + tri->edge[i][2];
+		if (l[0][lane] < 0.0f || l[1][lane] < 0.0f || l[2][lane] < 0.0f)
+			continue;
+		z = l[0][lane] * v[0]->z + l[1][lane] * v[1]->z + l[2][lane] * v[2]->z;
+		if (z < depth[lane])
+		{
+			depth[lane] = z;
+			mask |= 1 << lane;
+		}
+	}
+	return mask;
+#endif
+}
+
+static void rasterTile(void* data, int tile)
+{
+	SoftRaster* raster = (SoftRaster*)data;
+	SDL_Surface* surface = raster->surface;
+	const int x0 = (tile % raster->tilesX) * SOFT_TILE;
+	const int y0 = (tile / raster->tilesX) * SOFT_TILE;
+	const int x1 = x0 + SOFT_TILE < surface->w ? x0 + SOFT_TILE : surface->w;
+	const int y1 = y0 + SOFT_TILE < surface->h ? y0 + SOFT_TILE : surface->h;
+	const Uint32 clear = packColor(raster->params.clear);
+	float l[3][4], bary[3];
+	int i, x, y, lane, mask, left, right, top, bottom;
+
+	for (y = y0; y < y1; ++y)
+	{
+		Uint32* row = (Uint32*)((char*)surface->pixels + y * surface->pitch);
+		float* depth = raster->depth + y * raster->depthStride;
+		for (x = x0; x < x1; ++x)
+		{
+			row[x] = clear;
+			depth[x] = 1.0f;
+		}
+	}
+
+	for (i = raster->binStart[tile]; i < raster->binStart[tile + 1]; ++i)
+	{
+		const SoftTriangle* tri = &raster->triangles[raster->binTriangles[i]];
+		const SoftVertex* v[3];
+		v[0] = &raster->transformed[tri->v[0]];
+		v[1] = &raster->transformed[tri->v[1]];
+		v[2] = &raster->transformed[tri->v[2]];
+
+		/* Quads start on multiples of four: tiles are too, so none straddle two */
+		left = (tri->minX > x0 ? tri->minX : x0) & ~3;
+		right = tri->maxX < x1 - 1 ? tri->maxX : x1 - 1;
+		top = tri->minY > y0 ? tri->minY : y0;
+		bottom = tri->maxY < y1 - 1 ? tri->maxY : y1 - 1;
+		for (y = top; y <= bottom; ++y)
+		{
+			Uint32* row = (Uint32*)((char*)surface->pixels + y * surface->pitch);
+			float* depth = raster->depth + y * raster->depthStride;
+			for (x = left; x <= right; x += 4)
+			{
+				mask = coverQuad(tri, v, x, y, right - x + 1 < 4 ? right - x + 1 : 4, depth + x, l);
+				for (lane = 0; mask; ++lane, mask >>= 1)
+				{
+					if (!(mask & 1))
+						continue;
+					bary[0] = l[0][lane];
+					bary[1] = l[1][lane];
+					bary[2] = l[2][lane];
+					row[x + lane] = shadePixel(raster, tri, bary);
+				}
+			}
+		}
+	}
+}
+
+void drawSoft(SoftRaster* raster, const SoftParams* params)
+{
+	double start;
+
+	if (raster->width <= 0 || raster->height <= 0)
+		return;
+	allocateBuffers(raster);
+	raster->params = *params;
+	memcpy(raster->lightDir, params->light, sizeof(float) * 3);
+	normalize3(raster->lightDir);
+	memcpy(raster->halfVector, raster->lightDir, sizeof(float) * 3);
+	raster->halfVector[2] += 1.0f;
+	normalize3(raster->halfVector);
+
+	start = benchNow();
+	runJobs(raster->pool, transformChunk, raster,
+			(raster->numVertices + SOFT_VERTEX_CHUNK - 1) / SOFT_VERTEX_CHUNK);
+	raster->stats.transformMs = benchNow() - start;
+
+	start = benchNow();
+	if (raster->numIndices >= 3)
+		setupTriangles(raster);
+	else
+	{
+		raster->numTriangles = 0;
+		memset(raster->binStart, 0, sizeof(int) * (raster->tilesX * raster->tilesY + 1));
+	}
+	raster->stats.setupMs = benchNow() - start;
+
+	start = benchNow();
+	runJobs(raster->pool, rasterTile, raster, raster->tilesX * raster->tilesY);
+	raster->stats.rasterMs = benchNow() - start;
+}
+
+void presentSoft(const SoftRaster* raster)
+{
+	SDL_Surface* surface = raster->surface;
+
+	if (!surface)
+		return;
+	glPushAttrib(GL_ENABLE_BIT | GL_PIXEL_MODE_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+
+	/* The surface is top down: start at the top and step down */
+	glWindowPos2i(0, surface->h);
+	glPixelZoom(1.0f, -1.0f);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / 4);
+	glDrawPixels(surface->w, surface->h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, surface->pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPopAttrib();
+}
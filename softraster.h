@@ -0,0 +1,138 @@
+/* softraster.h */
+
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <SDL/SDL.h>
+
+#include "objects.h"
+#include "jobs.h"
+
+/*
+A CPU renderer for one mesh, for hosts without a GPU, where a generic
+software GL would run the whole pipeline far slower than this one needs.
+It takes the same vertex_t data as drawObject():
+
+	setSoftMesh(raster, &mesh);    after each rebuild
+	softParamsFromGL(&params);     camera, light and material, as GL has them
+	drawSoft(raster, &params);
+	presentSoft(raster);
+
+Each frame runs three stages:
+	transform   SOFT_VERTEX_CHUNK vertices per job: window position, eye
+	            space position and normal, and the lit colour when lighting
+	            is per vertex
+	setup       on the calling thread: triangles are assembled, culled and
+	            binned into SOFT_TILE squared pixel tiles
+	raster      one job per tile, so no two jobs touch the same pixel.
+	            Coverage and depth use half-space edge functions, four
+	            pixels at a time with SSE.
+Lighting follows shader.frag: one light, directional or point as GL_LIGHT0's
+w says, Phong or Blinn-Phong, per vertex or per pixel, flat or smooth. Nothing is back face culled,
+matching the GL path. Triangles crossing the near plane are dropped rather
+than clipped.
+
+The colour buffer is an SDL surface. presentSoft() copies it into the GL
+window with one glDrawPixels, so the overlays still draw on top.
+*/
+#define SOFT_TILE 64
+#define SOFT_VERTEX_CHUNK 4096
+
+typedef struct {
+	float modelview[16];   /* column major, no scale: its 3x3 transforms normals */
+	float projection[16];
+	float light[4];        /* GL_LIGHT0 position, eye space */
+	float lightAmbient[4];
+	float lightDiffuse[4];
+	float lightSpecular[4];
+	float sceneAmbient[4]; /* GL_LIGHT_MODEL_AMBIENT */
+	float materialAmbient[4];
+	float materialDiffuse[4];
+	float materialSpecular[4];
+	float shininess;
+	float color[4];        /* used unlit */
+	float clear[4];
+	int lighting;
+	int localViewer;
+	int smooth;
+	int perPixel;
+	int phong;             /* else Blinn-Phong */
+} SoftParams;
+
+/* Window space vertex, y down */
+typedef struct {
+	float x, y, z;         /* pixels, and depth 0-1 */
+	float invW;            /* for perspective correct interpolation */
+	float eye[3];
+	float normal[3];
+	float color[3];        /* lit, when lighting is per vertex */
+	int outcode;           /* clip planes the vertex is outside of */
+} SoftVertex;
+
+typedef struct {
+	int v[3];              /* wound so the barycentrics are positive inside */
+	int provoking;         /* the vertex flat shading takes its colour from */
+	int minX, minY, maxX, maxY; /* pixels covered, inclusive */
+	float edge[3][3];      /* barycentric i = a dx + b dy + c, from (minX, minY) */
+} SoftTriangle;
+
+typedef struct {
+	int triangles;         /* binned */
+	int culled;            /* degenerate, outside or crossing the near plane */
+	int binned;            /* tile references */
+	int threads;
+	double transformMs;
+	double setupMs;
+	double rasterMs;
+} SoftStats;
+
+typedef struct {
+	int width, height;     /* window size; buffers follow on the next draw */
+	SDL_Surface* surface;  /* colour, 32 bit xRGB */
+	float* depth;
+	int depthStride;       /* a multiple of four, so quads never leave a row */
+	int tilesX, tilesY;
+
+	vertex_t* vertices;    /* copy of the mesh */
+	unsigned int* indices;
+	int numVertices;
+	int numIndices;
+	GLenum primitive;
+	int maxVertices;
+	int maxIndices;
+
+	SoftVertex* transformed;
+	SoftTriangle* triangles;
+	int numTriangles;
+	int* binStart;         /* tiles + 1 offsets into binTriangles */
+	int* binCursor;
+	int* binTriangles;
+	int maxBinned;
+
+	/* The frame being drawn */
+	SoftParams params;
+	float lightDir[3];     /* a directional light's */
+	float halfVector[3];
+
+	JobPool* pool;         /* shared, not owned */
+	SoftStats stats;
+} SoftRaster;
+
+/* Runs its jobs on pool, which must outlive it */
+SoftRaster* createSoftRaster(JobPool* pool);
+void freeSoftRaster(SoftRaster* raster);
+
+void resizeSoftRaster(SoftRaster* raster, int width, int height);
+
+/* Copies mesh, or forgets it if mesh is NULL */
+void setSoftMesh(SoftRaster* raster, const Mesh* mesh);
+
+/* Reads the fixed function state; perPixel and phong are left 0 */
+void softParamsFromGL(SoftParams* params);
+
+void drawSoft(SoftRaster* raster, const SoftParams* params);
+
+/* Draws the colour buffer over the whole window */
+void presentSoft(const SoftRaster* raster);
+
+#endif
@@ -0,0 +1,513 @@
+/* tiles.c */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tiles.h"
+#include "resources.h"
+
+#define TILE_VERTS (TILE_QUADS + 1)
+#define GRID_VERTS (TILE_VERTS * TILE_VERTS)
+#define SLOT_VERTS (GRID_VERTS + 4 * TILE_VERTS)     /* the grid, then its skirt */
+#define GRID_INDICES (TILE_QUADS * (TILE_VERTS * 2 + 2))
+#define TILE_INDICES (GRID_INDICES + 2 + 4 * TILE_VERTS * 2 + 3 * 2) /* skirt joined on */
+#define TILE_BYTES (sizeof(vertex_t) * SLOT_VERTS)
+#define SAMPLES 9 /* per side when estimating bounds of an unbuilt tile */
+
+/* Calls func with stored arguments. Unused trailing arguments are ignored. */
+static vertex_t evaluate(ParametricObjFunc func, double u, double v, ...)
+{
+	va_list args;
+	vertex_t ret;
+	va_start(args, v);
+	ret = func((float)u, (float)v, &args);
+	va_end(args);
+	return ret;
+}
+
+static vertex_t evaluateParams(const TiledSurface* surface, double u, double v)
+{
+	const double* p = surface->params;
+	return evaluate(surface->func, u, v, p[0], p[1], p[2], p[3]);
+}
+
+/* Parameter of the node's grid line i, along either side */
+static double nodeParam(const TiledSurface* surface, const Tile* t, int tile, double i)
+{
+	return (tile * TILE_QUADS + i) * (1 << t->level) / (double)surface->quads;
+}
+
+static void estimateBounds(TiledSurface* surface, int node)
+{
+	vertex_t samples[SAMPLES * SAMPLES];
+	Tile* t = &surface->tiles[node];
+	double step = TILE_QUADS / (double)(SAMPLES - 1);
+	float spacing = 0.0f, angle = 0.0f;
+	int i, j;
+
+	for (i = 0; i < SAMPLES; ++i)
+		for (j = 0; j < SAMPLES; ++j)
+			samples[i * SAMPLES + j] = evaluateParams(surface,
+					nodeParam(surface, t, t->ti, i * step), nodeParam(surface, t, t->tj, j * step));
+
+	/* Widest gap between neighbouring samples, in distance and normal angle */
+	for (i = 0; i < SAMPLES; ++i)
+		for (j = 0; j < SAMPLES; ++j)
+		{
+			const vertex_t* s = &samples[i * SAMPLES + j];
+			const vertex_t* n[2];
+			int k;
+			n[0] = i + 1 < SAMPLES ? &samples[(i + 1) * SAMPLES + j] : NULL;
+			n[1] = j + 1 < SAMPLES ? &samples[i * SAMPLES + j + 1] : NULL;
+			for (k = 0; k < 2; ++k)
+			{
+				float dx, dy, dz, c;
+				if (!n[k])
+					continue;
+				dx = n[k]->vert.x - s->vert.x;
+				dy = n[k]->vert.y - s->vert.y;
+				dz = n[k]->vert.z - s->vert.z;
+				spacing = fmaxf(spacing, sqrtf(dx * dx + dy * dy + dz * dz));
+				c = n[k]->norm.x * s->norm.x + n[k]->norm.y * s->norm.y + n[k]->norm.z * s->norm.z;
+				angle = fmaxf(angle, acosf(fmaxf(-1.0f, fminf(1.0f, c))));
+			}
+		}
+
+	boundsFromSamples(&t->bounds, samples, SAMPLES * SAMPLES, spacing, angle);
+	t->estimated = 1;
+	t->stale = 0;
+}
+
+/* Grid vertex k along edge e, going round the tile */
+static int edgeVertex(int e, int k)
+{
+#define INDEX(I, J) ((I)*TILE_VERTS + (J))
+	switch (e)
+	{
+	case 0: return INDEX(k, 0);
+	case 1: return INDEX(TILE_QUADS, k);
+	case 2: return INDEX(TILE_QUADS - k, TILE_QUADS);
+	default: return INDEX(0, TILE_QUADS - k);
+	}
+#undef INDEX
+}
+
+TiledSurface* createTiledSurface(ParametricObjFunc func, int quads, int closed,
+		const double* params, int numParams)
+{
+	TiledSurface* surface;
+	unsigned short* indices;
+	size_t poolSlots;
+	int i, j, e, side, level, ci = 0;
+
+	assert(quads % TILE_QUADS == 0);
+
+	surface = (TiledSurface*)resMalloc(sizeof(TiledSurface), RES_ORIGIN);
+	memset(surface, 0, sizeof(TiledSurface));
+	surface->func = func;
+	surface->closed = closed;
+	surface->quads = quads;
+	surface->tilesPerSide = quads / TILE_QUADS;
+	surface->numTiles = surface->tilesPerSide * surface->tilesPerSide;
+	setTiledSurfaceParams(surface, params, numParams);
+
+	/* Every level down to a single root node */
+	assert((surface->tilesPerSide & (surface->tilesPerSide - 1)) == 0);
+	for (side = surface->tilesPerSide; side > 0; side /= 2)
+	{
+		surface->levelStart[surface->levels++] = surface->numNodes;
+		surface->numNodes += side * side;
+	}
+	surface->tiles = (Tile*)resMalloc(sizeof(Tile) * surface->numNodes, RES_ORIGIN);
+	for (level = 0, side = surface->tilesPerSide; level < surface->levels; ++level, side /= 2)
+		for (i = 0; i < side; ++i)
+			for (j = 0; j < side; ++j)
+			{
+				Tile* t = &surface->tiles[surface->levelStart[level] + i * side + j];
+				t->level = level;
+				t->ti = i;
+				t->tj = j;
+				t->slot = -1;
+				t->dirty = 1;
+				t->stale = 1;
+			}
+
+	poolSlots = TILE_POOL_BYTES / TILE_BYTES;
+	surface->numSlots = poolSlots < (size_t)surface->numNodes ? (int)poolSlots : surface->numNodes;
+	surface->slotTile = (int*)resMalloc(sizeof(int) * surface->numSlots, RES_ORIGIN);
+	surface->slotUsed = (unsigned int*)resMalloc(sizeof(unsigned int) * surface->numSlots, RES_ORIGIN);
+	for (i = 0; i < surface->numSlots; ++i)
+	{
+		surface->slotTile[i] = -1;
+		surface->slotUsed[i] = 0;
+	}
+
+	surface->levelList = (TileOrder*)resMalloc(sizeof(TileOrder) * surface->numNodes, RES_ORIGIN);
+	surface->nextList = (TileOrder*)resMalloc(sizeof(TileOrder) * surface->numNodes, RES_ORIGIN);
+	surface->drawList = (int*)resMalloc(sizeof(int) * surface->numNodes, RES_ORIGIN);
+	surface->pendingList = (int*)resMalloc(sizeof(int) * surface->numNodes, RES_ORIGIN);
+	surface->prefetchList = (int*)resMalloc(sizeof(int) * surface->numNodes, RES_ORIGIN);
+	surface->refreshList = (int*)resMalloc(sizeof(int) * surface->numNodes, RES_ORIGIN);
+	surface->staging = (vertex_t*)resMalloc(TILE_BYTES, RES_ORIGIN);
+
+	/* Same strip layout as createObject, local to one tile */
+	indices = (unsigned short*)resMalloc(sizeof(unsigned short) * TILE_INDICES, RES_ORIGIN);
+#define INDEX(I, J) ((I)*TILE_VERTS + (J))
+	for (j = 0; j < TILE_VERTS-1; ++j)
+	{
+		indices[ci++] = INDEX(0, j);
+		for (i = 0; i < TILE_VERTS; ++i)
+		{
+			indices[ci++] = INDEX(i, j);
+			indices[ci++] = INDEX(i, j+1);
+		}
+		indices[ci++] = INDEX(i-1, j+1);
+	}
+#undef INDEX
+	assert(ci == GRID_INDICES);
+
+	/* The skirt: each edge, joined on with degenerate triangles */
+	for (e = 0; e < 4; ++e)
+	{
+		indices[ci] = indices[ci - 1];
+		ci++;
+		indices[ci++] = edgeVertex(e, 0);
+		for (i = 0; i < TILE_VERTS; ++i)
+		{
+			indices[ci++] = edgeVertex(e, i);
+			indices[ci++] = GRID_VERTS + e * TILE_VERTS + i;
+		}
+	}
+	assert(ci == TILE_INDICES);
+
+	surface->elementBuffer = resGenBuffer(RES_ORIGIN);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface->elementBuffer);
+	resBufferData(GL_ELEMENT_ARRAY_BUFFER, surface->elementBuffer,
+			sizeof(unsigned short) * TILE_INDICES, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	surface->indices = indices; /* kept for computing tile bounds */
+
+	surface->vertexBuffer = resGenBuffer(RES_ORIGIN);
+	glBindBuffer(GL_ARRAY_BUFFER, surface->vertexBuffer);
+	resBufferData(GL_ARRAY_BUFFER, surface->vertexBuffer,
+			(GLsizeiptr)TILE_BYTES * surface->numSlots, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	surface->stats.tiles = surface->numTiles;
+	return surface;
+}
+
+void setTiledSurfaceParams(TiledSurface* surface, const double* params, int numParams)
+{
+	int i;
+	assert(numParams <= TILE_MAX_PARAMS);
+	for (i = 0; i < TILE_MAX_PARAMS; ++i)
+		surface->params[i] = i < numParams ? params[i] : 0.0;
+	for (i = 0; surface->tiles && i < surface->numNodes; ++i)
+	{
+		surface->tiles[i].dirty = 1;
+		surface->tiles[i].stale = 1;
+	}
+}
+
+/* Finds a free slot or evicts the least recently drawn tile not drawn this frame */
+static int acquireSlot(TiledSurface* surface)
+{
+	int i, best = -1;
+	for (i = 0; i < surface->numSlots; ++i)
+	{
+		if (surface->slotTile[i] < 0)
+			return i;
+		if (surface->slotUsed[i] != surface->frame
+				&& (best < 0 || surface->slotUsed[i] < surface->slotUsed[best]))
+			best = i;
+	}
+	if (best >= 0)
+	{
+		surface->tiles[surface->slotTile[best]].slot = -1;
+		surface->slotTile[best] = -1;
+		surface->stats.resident--;
+	}
+	return best;
+}
+
+static void buildTile(TiledSurface* surface, int node)
+{
+	Tile* t = &surface->tiles[node];
+	vertex_t* v = surface->staging;
+	float depth = 0.0f;
+	int i, j, e;
+
+	for (i = 0; i < TILE_VERTS; ++i)
+		for (j = 0; j < TILE_VERTS; ++j)
+			v[i * TILE_VERTS + j] = evaluateParams(surface,
+					nodeParam(surface, t, t->ti, i), nodeParam(surface, t, t->tj, j));
+
+	/* A finer neighbour's edge strays from this one's by less than a quad:
+	 * hang the skirt that far below the surface */
+	for (e = 0; e < 4; ++e)
+		for (i = 0; i + 1 < TILE_VERTS; ++i)
+		{
+			const vector_t* a = &v[edgeVertex(e, i)].vert;
+			const vector_t* b = &v[edgeVertex(e, i + 1)].vert;
+			float dx = b->x - a->x, dy = b->y - a->y, dz = b->z - a->z;
+			depth = fmaxf(depth, sqrtf(dx * dx + dy * dy + dz * dz));
+		}
+	for (e = 0; e < 4; ++e)
+		for (i = 0; i < TILE_VERTS; ++i)
+		{
+			const vertex_t* edge = &v[edgeVertex(e, i)];
+			vertex_t* skirt = &v[GRID_VERTS + e * TILE_VERTS + i];
+			skirt->norm = edge->norm;
+			skirt->vert.x = edge->vert.x - depth * edge->norm.x;
+			skirt->vert.y = edge->vert.y - depth * edge->norm.y;
+			skirt->vert.z = edge->vert.z - depth * edge->norm.z;
+		}
+
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)TILE_BYTES * t->slot, TILE_BYTES, surface->staging);
+
+	/* Replace the estimate with the exact bounds of what was built */
+	boundsFromStrip(&t->bounds, surface->staging, surface->indices, 2, 0, GRID_INDICES);
+	t->estimated = 0;
+	t->stale = 0;
+	t->dirty = 0;
+}
+
+/* Estimates the node's bounds if needed, then culls it */
+static int nodeVisible(TiledSurface* surface, int node, const Frustum* frustum)
+{
+	Tile* t = &surface->tiles[node];
+	if (t->stale)
+		estimateBounds(surface, node);
+	if (!sphereInFrustum(frustum, t->bounds.center, t->bounds.radius))
+	{
+		surface->stats.culledFrustum++;
+		return 0;
+	}
+	if (surface->closed && boundsBackfacing(&t->bounds, frustum->eye))
+	{
+		surface->stats.culledBackface++;
+		return 0;
+	}
+	return 1;
+}
+
+/* Size over distance: how much finer the node would look refined */
+static float nodeError(const Tile* t, vector_t eye)
+{
+	float dx = t->bounds.center.x - eye.x;
+	float dy = t->bounds.center.y - eye.y;
+	float dz = t->bounds.center.z - eye.z;
+	float distance = sqrtf(dx * dx + dy * dy + dz * dz) - t->bounds.radius;
+	return t->bounds.radius / fmaxf(distance, 1e-6f);
+}
+
+static int compareError(const void* a, const void* b)
+{
+	float ea = ((const TileOrder*)a)->error, eb = ((const TileOrder*)b)->error;
+	return ea < eb ? 1 : (ea > eb ? -1 : 0);
+}
+
+static void childNodes(const TiledSurface* surface, const Tile* t, int* children)
+{
+	int side = surface->tilesPerSide >> (t->level - 1);
+	int first = surface->levelStart[t->level - 1];
+	children[0] = first + (2 * t->ti) * side + 2 * t->tj;
+	children[1] = children[0] + 1;
+	children[2] = children[0] + side;
+	children[3] = children[2] + 1;
+}
+
+/* Draws the node if it's resident, and queues it to build if missing or out of date */
+static void selectNode(TiledSurface* surface, int node, int* numDraw, int* numPending)
+{
+	Tile* t = &surface->tiles[node];
+	surface->stats.visible++;
+	surface->stats.coarse += t->level > 0;
+
+	/* Out of date tiles still draw until their turn to regenerate */
+	if (t->slot >= 0)
+	{
+		surface->slotUsed[t->slot] = surface->frame;
+		surface->drawList[(*numDraw)++] = node;
+		if (t->dirty)
+			surface->refreshList[surface->numRefresh++] = node;
+	}
+	else
+		surface->pendingList[(*numPending)++] = node;
+}
+
+/*
+Picks the nodes to draw: each level's visible nodes, largest error first,
+are replaced by their visible children while those fit in the pool and
+are all resident. Children that would fit but aren't resident are queued
+to prefetch while their parent draws. A refined node keeps its slot, so
+the children can refine in turn next frame and the parent can draw again
+straight away when the camera backs off: total counts every slot the
+traversal holds, drawn or not, and never exceeds the pool. That keeps
+room for every prefetch, so a refinement is only ever a few frames away.
+*/
+static void selectNodes(TiledSurface* surface, const Frustum* frustum,
+		int* numDraw, int* numPending, int* numPrefetch)
+{
+	TileOrder* current = surface->levelList;
+	TileOrder* next = surface->nextList;
+	TileOrder* swap;
+	int root = surface->numNodes - 1;
+	int numCurrent = 0, numNext, total, level, i, c;
+
+	if (nodeVisible(surface, root, frustum))
+		current[numCurrent++].node = root;
+	total = numCurrent;
+
+	for (level = surface->levels - 1; level > 0; --level)
+	{
+		for (i = 0; i < numCurrent; ++i)
+			current[i].error = nodeError(&surface->tiles[current[i].node], frustum->eye);
+		qsort(current, numCurrent, sizeof(TileOrder), compareError);
+
+		numNext = 0;
+		for (i = 0; i < numCurrent; ++i)
+		{
+			int node = current[i].node;
+			Tile* parent = &surface->tiles[node];
+			int children[4], visible = 0, ready = parent->slot >= 0;
+
+			if (total + 1 > surface->numSlots)
+			{
+				selectNode(surface, node, numDraw, numPending);
+				continue;
+			}
+			childNodes(surface, parent, children);
+			for (c = 0; c < 4; ++c)
+				if (nodeVisible(surface, children[c], frustum))
+					children[visible++] = children[c];
+			if (total + visible > surface->numSlots)
+			{
+				selectNode(surface, node, numDraw, numPending);
+				continue;
+			}
+			total += visible;
+
+			for (c = 0; c < visible; ++c)
+			{
+				Tile* t = &surface->tiles[children[c]];
+				if (t->slot >= 0)
+					surface->slotUsed[t->slot] = surface->frame;
+				else
+				{
+					surface->prefetchList[(*numPrefetch)++] = children[c];
+					ready = 0;
+				}
+			}
+			if (!ready)
+			{
+				selectNode(surface, node, numDraw, numPending);
+				continue;
+			}
+			surface->slotUsed[parent->slot] = surface->frame;
+			for (c = 0; c < visible; ++c)
+				next[numNext++].node = children[c];
+		}
+
+		swap = current;
+		current = next;
+		next = swap;
+		numCurrent = numNext;
+	}
+
+	for (i = 0; i < numCurrent; ++i)
+		selectNode(surface, current[i].node, numDraw, numPending);
+}
+
+/* Builds a queued node, finding it a slot if it has none. Returns 0 on failure. */
+static int streamNode(TiledSurface* surface, int node)
+{
+	Tile* t = &surface->tiles[node];
+	if (t->slot < 0)
+	{
+		t->slot = acquireSlot(surface);
+		if (t->slot < 0)
+			return 0;
+		surface->slotTile[t->slot] = node;
+		surface->stats.resident++;
+	}
+	surface->slotUsed[t->slot] = surface->frame;
+	buildTile(surface, node);
+	surface->stats.uploads++;
+	return 1;
+}
+
+void drawTiledSurface(TiledSurface* surface, const Frustum* frustum)
+{
+	TileStats* stats = &surface->stats;
+	int numDraw = 0, numPending = 0, numPrefetch = 0;
+	int i;
+
+	surface->frame++;
+	surface->numRefresh = 0;
+	stats->visible = stats->coarse = stats->culledFrustum = stats->culledBackface = 0;
+	stats->uploads = stats->starved = stats->drawnVertices = stats->drawnTriangles = 0;
+
+	selectNodes(surface, frustum, &numDraw, &numPending, &numPrefetch);
+
+	glBindBuffer(GL_ARRAY_BUFFER, surface->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface->elementBuffer);
+
+	/* Stream in as many tiles as the budget allows: missing ones that
+	 * should draw now, then ones that would let them refine, then, taking
+	 * turns, those drawing out of date (eg. while the wave animates) */
+	for (i = 0; i < numPending; ++i)
+	{
+		int node = surface->pendingList[i];
+		if (stats->uploads == TILE_UPLOADS_PER_FRAME || !streamNode(surface, node))
+			stats->starved++;
+		else
+			surface->drawList[numDraw++] = node;
+	}
+	for (i = 0; i < numPrefetch && stats->uploads < TILE_UPLOADS_PER_FRAME; ++i)
+		streamNode(surface, surface->prefetchList[i]);
+	for (i = 0; i < surface->numRefresh && stats->uploads < TILE_UPLOADS_PER_FRAME; ++i)
+	{
+		surface->refreshCursor = (surface->refreshCursor + 1) % surface->numRefresh;
+		streamNode(surface, surface->refreshList[surface->refreshCursor]);
+	}
+
+	/* Draw */
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	for (i = 0; i < numDraw; ++i)
+	{
+		size_t base = TILE_BYTES * surface->tiles[surface->drawList[i]].slot;
+		glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)base);
+		glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)(base + sizeof(vector_t)));
+		glDrawElements(GL_TRIANGLE_STRIP, TILE_INDICES, GL_UNSIGNED_SHORT, (void*)0);
+	}
+	stats->drawnVertices = numDraw * SLOT_VERTS;
+	stats->drawnTriangles = numDraw * (TILE_INDICES - 2);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+}
+
+void freeTiledSurface(TiledSurface* surface)
+{
+	resDeleteBuffer(surface->vertexBuffer);
+	resDeleteBuffer(surface->elementBuffer);
+	resFree(surface->tiles);
+	resFree(surface->slotTile);
+	resFree(surface->slotUsed);
+	resFree(surface->levelList);
+	resFree(surface->nextList);
+	resFree(surface->drawList);
+	resFree(surface->pendingList);
+	resFree(surface->prefetchList);
+	resFree(surface->refreshList);
+	resFree(surface->staging);
+	resFree(surface->indices);
+	resFree(surface);
+}
@@ -0,0 +1,114 @@
+/* tiles.h */
+
+#ifndef TILES_H
+#define TILES_H
+
+#include "objects.h"
+#include "cull.h"
+
+/*
+A parametric surface split into square tiles of TILE_QUADS x TILE_QUADS
+quads, for tessellations too fine to build as one mesh. Every tile shares
+one 16 bit index strip and occupies a fixed size slot in a pooled VBO.
+Tiles are generated and uploaded only when they become visible, at most
+TILE_UPLOADS_PER_FRAME a frame, and invisible tiles are evicted (least
+recently drawn first) when the pool is full.
+
+The tiles form a quadtree: a node one level up covers four tiles' area
+with the same TILE_QUADS x TILE_QUADS quads, every other vertex, in a slot
+of the same size. The pool holds far fewer slots than the finest level has
+tiles (about 650 against 16384 at tessellation 14), so each frame the
+visible nodes are refined from the root, nearest (largest on screen)
+first, only while the refined set still fits the pool, and only into
+children already resident; missing children stream in while their
+parent draws. The full level is drawn whenever it fits; otherwise the
+far tiles stay coarser rather than leaving holes. A skirt hanging below
+each tile's edges hides the cracks between neighbours of different
+levels. Bounds are only estimated for nodes the traversal reaches, so
+culled subtrees cost nothing.
+*/
+#define TILE_QUADS 128                      /* (TILE_QUADS + 1)^2 vertices fit 16 bit indices */
+#define TILE_UPLOADS_PER_FRAME 16
+#define TILE_POOL_BYTES (256 * 1024 * 1024) /* upper limit on the slot pool */
+#define TILE_MAX_PARAMS 4
+
+typedef struct {
+	int tiles;
+	int visible;   /* nodes selected to draw, of any level */
+	int coarse;    /* of those, above the finest level */
+	int culledFrustum;
+	int culledBackface;
+	int resident;  /* nodes currently holding a slot */
+	int uploads;   /* nodes generated this frame */
+	int starved;   /* selected nodes left undrawn for lack of budget or slots */
+	int drawnVertices;
+	int drawnTriangles;
+} TileStats;
+
+typedef struct {
+	Bounds bounds;
+	int level;         /* 0 is the finest */
+	int ti, tj;        /* position among its level's nodes */
+	int slot;          /* -1 when not resident */
+	int dirty;         /* resident data is out of date */
+	int estimated;     /* bounds are sampled estimates, not from the mesh */
+	int stale;         /* bounds need estimating */
+} Tile;
+
+/* A node to refine, and how large it looks */
+typedef struct {
+	float error;
+	int node;
+} TileOrder;
+
+typedef struct {
+	ParametricObjFunc func;
+	double params[TILE_MAX_PARAMS];
+	int closed;        /* back facing tiles are only hidden on closed surfaces */
+	int quads;         /* quads along each side of the whole surface */
+	int tilesPerSide;  /* at the finest level */
+	int numTiles;      /* at the finest level */
+	int levels;
+	int levelStart[32]; /* first node of each level; the root is the last node */
+	int numNodes;
+	Tile* tiles;       /* every level's nodes */
+
+	/* Slot pool */
+	GLuint vertexBuffer;
+	GLuint elementBuffer;
+	int numSlots;
+	int* slotTile;          /* node in each slot, -1 if free */
+	unsigned int* slotUsed; /* frame each slot was last drawn or wanted */
+	unsigned int frame;
+
+	/* Per frame working lists, allocated once */
+	TileOrder* levelList;
+	TileOrder* nextList;
+	int* drawList;
+	int* pendingList;  /* selected nodes missing */
+	int* prefetchList; /* children of selected nodes, to refine into */
+	int* refreshList;  /* selected nodes drawing out of date */
+	int numRefresh;
+	int refreshCursor; /* where rebuilding out of date nodes resumes */
+	vertex_t* staging;
+	unsigned short* indices; /* host copy of the shared strip */
+
+	TileStats stats;
+} TiledSurface;
+
+/*
+Creates a tiled surface of quads x quads (a multiple of TILE_QUADS).
+params are passed to func in order, as createObject's extra arguments.
+*/
+TiledSurface* createTiledSurface(ParametricObjFunc func, int quads, int closed,
+		const double* params, int numParams);
+
+/* Changes the function's arguments (eg. animation time), invalidating every tile */
+void setTiledSurfaceParams(TiledSurface* surface, const double* params, int numParams);
+
+/* Culls against frustum (in surface space), streams in tiles and draws */
+void drawTiledSurface(TiledSurface* surface, const Frustum* frustum);
+
+void freeTiledSurface(TiledSurface* surface);
+
+#endif